@@ -0,0 +1,215 @@
+#include "activation.h"
+#include "vecmath.h"
+#include <algorithm>
+#include <cmath>
+
+bool parseActivation(const std::string &name, Activation &act)
+{
+    if (name == "linear")
+        act = Activation::Linear;
+    else if (name == "sigmoid")
+        act = Activation::Sigmoid;
+    else if (name == "tanh")
+        act = Activation::Tanh;
+    else if (name == "relu")
+        act = Activation::ReLU;
+    else if (name == "softmax")
+        act = Activation::Softmax;
+    else
+        return 0;
+    return 1;
+}
+
+static inline double sigmoidScalar(double x)
+{
+    return 1.0 / (1.0 + std::exp(-x));
+}
+
+// 减去行最大值后再取指数，避免溢出
+static void softmaxRowScalar(const double *z, double *y, size_t cols)
+{
+    double m = *std::max_element(z, z + cols);
+    double sum = 0;
+    for (size_t c = 0; c < cols; c++)
+    {
+        y[c] = std::exp(z[c] - m);
+        sum += y[c];
+    }
+    const double inv = 1.0 / sum;
+    for (size_t c = 0; c < cols; c++)
+        y[c] *= inv;
+}
+
+// 逐元素激活的标量部分，[begin, end) 为展平后的下标
+static void activateRange(Activation act, const double *Z, double *Y, size_t begin, size_t end)
+{
+    switch (act)
+    {
+    case Activation::Sigmoid:
+        for (size_t e = begin; e < end; e++)
+            Y[e] = sigmoidScalar(Z[e]);
+        break;
+    case Activation::Tanh:
+        for (size_t e = begin; e < end; e++)
+            Y[e] = std::tanh(Z[e]);
+        break;
+    case Activation::ReLU:
+        for (size_t e = begin; e < end; e++)
+            Y[e] = Z[e] > 0 ? Z[e] : 0;
+        break;
+    default:
+        if (Y != Z)
+            std::copy(Z + begin, Z + end, Y + begin);
+        break;
+    }
+}
+
+void activateScalar(Activation act, const double *Z, double *Y, size_t n, size_t cols)
+{
+    if (act == Activation::Softmax)
+    {
+        for (size_t i = 0; i < n; i++)
+            softmaxRowScalar(Z + i * cols, Y + i * cols, cols);
+        return;
+    }
+    activateRange(act, Z, Y, 0, n * cols);
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+static inline double hmax(__m256d a)
+{
+    __m128d m = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+}
+
+static inline double hsum(__m256d a)
+{
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+// 不足 4 个的尾部补成一个向量，和主体用同一条计算路径，结果与元素所在位置无关
+static inline __m256d loadTail(const double *p, size_t count, double fill)
+{
+    alignas(32) double buf[4] = {fill, fill, fill, fill};
+    std::copy(p, p + count, buf);
+    return _mm256_load_pd(buf);
+}
+
+static inline void storeTail(double *p, size_t count, __m256d v)
+{
+    alignas(32) double buf[4];
+    _mm256_store_pd(buf, v);
+    std::copy(buf, buf + count, p);
+}
+
+template <__m256d (*F)(__m256d)>
+static void applyElementwise(const double *Z, double *Y, size_t total)
+{
+    size_t e = 0;
+    for (; e + 4 <= total; e += 4)
+        _mm256_storeu_pd(Y + e, F(_mm256_loadu_pd(Z + e)));
+    if (e < total)
+        storeTail(Y + e, total - e, F(loadTail(Z + e, total - e, 0)));
+}
+
+static void softmaxRow(const double *z, double *y, size_t cols)
+{
+    const size_t vec = cols & ~size_t(3);
+    const size_t tail = cols - vec;
+    __m256d mv = _mm256_set1_pd(-INFINITY);
+    for (size_t c = 0; c < vec; c += 4)
+        mv = _mm256_max_pd(mv, _mm256_loadu_pd(z + c));
+    if (tail)
+        mv = _mm256_max_pd(mv, loadTail(z + vec, tail, -INFINITY));
+    const __m256d mb = _mm256_set1_pd(hmax(mv));
+    __m256d sv = _mm256_setzero_pd();
+    for (size_t c = 0; c < vec; c += 4)
+    {
+        __m256d e = exp4(_mm256_sub_pd(_mm256_loadu_pd(z + c), mb));
+        _mm256_storeu_pd(y + c, e);
+        sv = _mm256_add_pd(sv, e);
+    }
+    if (tail)
+    {
+        // 补位的 -inf 减去最大值后被截到 -708，exp 约为 3e-308，不影响和
+        __m256d e = exp4(_mm256_sub_pd(loadTail(z + vec, tail, -INFINITY), mb));
+        storeTail(y + vec, tail, e);
+        sv = _mm256_add_pd(sv, e);
+    }
+    const __m256d inv = _mm256_set1_pd(1.0 / hsum(sv));
+    for (size_t c = 0; c < vec; c += 4)
+        _mm256_storeu_pd(y + c, _mm256_mul_pd(_mm256_loadu_pd(y + c), inv));
+    if (tail)
+        storeTail(y + vec, tail, _mm256_mul_pd(loadTail(y + vec, tail, 0), inv));
+}
+
+void activate(Activation act, const double *Z, double *Y, size_t n, size_t cols)
+{
+    switch (act)
+    {
+    case Activation::Softmax:
+        for (size_t i = 0; i < n; i++)
+            softmaxRow(Z + i * cols, Y + i * cols, cols);
+        break;
+    // 逐元素的激活与行无关，整块展平处理
+    case Activation::Sigmoid:
+        applyElementwise<sigmoid4>(Z, Y, n * cols);
+        break;
+    case Activation::Tanh:
+        applyElementwise<tanh4>(Z, Y, n * cols);
+        break;
+    case Activation::ReLU:
+        applyElementwise<relu4>(Z, Y, n * cols);
+        break;
+    default:
+        if (Y != Z)
+            std::copy(Z, Z + n * cols, Y);
+        break;
+    }
+}
+
+#else
+
+void activate(Activation act, const double *Z, double *Y, size_t n, size_t cols)
+{
+    activateScalar(act, Z, Y, n, cols);
+}
+
+#endif
+
+void activateDeri(Activation act, const double *Y, double *D, size_t n, size_t cols)
+{
+    const size_t total = n * cols;
+    switch (act)
+    {
+    case Activation::Sigmoid:
+        for (size_t e = 0; e < total; e++)
+            D[e] *= Y[e] * (1.0 - Y[e]);
+        break;
+    case Activation::Tanh:
+        for (size_t e = 0; e < total; e++)
+            D[e] *= 1.0 - Y[e] * Y[e];
+        break;
+    case Activation::ReLU:
+        for (size_t e = 0; e < total; e++)
+            D[e] = Y[e] > 0 ? D[e] : 0.0;
+        break;
+    case Activation::Softmax:
+        // dL/dz_j = y_j * (dL/dy_j - sum_k dL/dy_k * y_k)
+        for (size_t i = 0; i < n; i++)
+        {
+            const double *y = Y + i * cols;
+            double *d = D + i * cols;
+            double dot = 0;
+            for (size_t c = 0; c < cols; c++)
+                dot += d[c] * y[c];
+            for (size_t c = 0; c < cols; c++)
+                d[c] = y[c] * (d[c] - dot);
+        }
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// 层的激活函数，compile 时由层上的名字解析一次，前向/反向按整层批量计算
+enum class Activation
+{
+    Linear,
+    Sigmoid,
+    Tanh,
+    ReLU,
+    Softmax // 按行归一化；作输出层时训练使用交叉熵
+};
+
+// "linear" / "sigmoid" / "tanh" / "relu" / "softmax"，未知名字返回 false
+bool parseActivation(const std::string &name, Activation &act);
+
+// Y = f(Z)，Z、Y 为 n x cols，可以是同一块内存
+void activate(Activation act, const double *Z, double *Y, size_t n, size_t cols);
+
+// D *= f'(Z)，D 原为 dL/dY，结束时为 dL/dZ；导数全部由前向的输出 Y 算出（relu 取 Y > 0），
+// 所以融合前向不必保留激活前的 Z
+void activateDeri(Activation act, const double *Y, double *D, size_t n, size_t cols);
+
+// 无 SIMD 的参考实现，也是不支持 AVX2/FMA 时的回退路径
+void activateScalar(Activation act, const double *Z, double *Y, size_t n, size_t cols);
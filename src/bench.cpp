@@ -0,0 +1,1126 @@
+#include "bench.h"
+#include "net.h"
+#include "kernel.h"
+#include "server.h"
+#include "staticnet.h"
+#include "sweep.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <numeric>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <ctime>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+// 返回每次调用的平均耗时（微秒）
+template <typename F>
+static double timeIt(F &&f, size_t iters)
+{
+    for (size_t i = 0; i < iters / 10 + 1; i++)
+        f();
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; i++)
+        f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / iters;
+}
+
+// 当前进程的常驻内存（字节）
+static size_t residentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return pmc.WorkingSetSize;
+#else
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// 把 src 重复 times 次写到临时目录，返回文件路径
+static std::string makeScaledCopy(const std::string &src, size_t times)
+{
+    std::ifstream in(src, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string path = (std::filesystem::temp_directory_path() / ("digits_x" + std::to_string(times) + ".csv")).string();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (size_t i = 0; i < times; i++)
+        out << content;
+    return path;
+}
+
+// 256 -> hidden -> 10 的 sigmoid 数字识别网络
+static Network makeDigitNet(size_t hidden, std::optional<unsigned> seed = std::nullopt)
+{
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses(seed);
+    hid2out->normalInitSynapses(seed ? std::optional<unsigned>(*seed + 1) : std::nullopt);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+    return net;
+}
+
+void benchPredict()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    std::span<const double> sample = smpSet.at(0).features;
+
+    for (size_t hidden : {16, 64, 256})
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+
+        auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+        auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+        in2hid->normalInitSynapses();
+        hid2out->normalInitSynapses();
+        Network dense(in, out);
+        dense.addLayer(hid);
+        dense.addLink(in2hid);
+        dense.addLink(hid2out);
+
+        // 同样的权重，按旧的逐突触方式存放
+        auto synIn2hid = std::make_shared<Network::Link>(in, hid);
+        auto synHid2out = std::make_shared<Network::Link>(hid, out);
+        for (auto [dl, sl] : {std::pair{in2hid, synIn2hid}, std::pair{hid2out, synHid2out}})
+        {
+            for (size_t j = 0; j < dl->rows(); j++)
+                for (size_t i = 0; i < dl->cols(); i++)
+                    sl->addSynapse(i, j, dl->weights()[j * dl->cols() + i]);
+        }
+        Network synapse(in, out);
+        synapse.addLayer(hid);
+        synapse.addLink(synIn2hid);
+        synapse.addLink(synHid2out);
+
+        double tSynapse = timeIt([&]
+                                 { synapse.predict(sample); }, 2000);
+        double tDense = timeIt([&]
+                               { dense.predict(sample); }, 2000);
+
+        std::vector<double> y(in2hid->rows());
+        const double *x = sample.data();
+        double tScalar = timeIt([&]
+                                { gemvScalar(in2hid->weights(), x, y.data(), in2hid->rows(), in2hid->cols()); }, 20000);
+        double tSimd = timeIt([&]
+                              { gemv(in2hid->weights(), x, y.data(), in2hid->rows(), in2hid->cols()); }, 20000);
+
+        std::cout << "256-" << hidden << "-10  predict: synapse " << tSynapse << " us, dense " << tDense
+                  << " us (x" << tSynapse / tDense << ")  first-layer gemv: scalar " << tScalar
+                  << " us, simd " << tSimd << " us (x" << tScalar / tSimd << ")" << std::endl;
+    }
+}
+
+void benchPredictBatch()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+
+    for (size_t hidden : {64, 256})
+    {
+        Network net = makeDigitNet(hidden);
+
+        const size_t total = smpSet.size();
+        std::vector<Sample> samples = smpSet.getSamples();
+        double tSingle = timeIt([&]
+                                { for (const auto &s : samples) net.predict(s); }, 20);
+        std::cout << "256-" << hidden << "-10  per-sample: " << total / tSingle * 1e6 << " samples/s" << std::endl;
+        for (size_t batchSize : {1, 8, 32, 128, 512})
+        {
+            double tBatch = timeIt([&]
+                                   { net.predictBatch(smpSet, batchSize); }, 20);
+            std::cout << "    batch " << batchSize << ": " << total / tBatch * 1e6 << " samples/s (x"
+                      << tSingle / tBatch << ")" << std::endl;
+        }
+    }
+}
+
+void benchCompile()
+{
+    // 层数多、每层很小时，调度开销占比最大
+    for (size_t depth : {2, 8, 32})
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({4}));
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({4}), "sigmoid");
+        Network net(in, out);
+        auto prev = in;
+        for (size_t d = 1; d < depth; d++)
+        {
+            auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({4}), "sigmoid");
+            net.addLayer(hid);
+            auto link = std::make_shared<Network::DenseLink>(prev, hid);
+            link->normalInitSynapses();
+            net.addLink(link);
+            prev = hid;
+        }
+        auto last = std::make_shared<Network::DenseLink>(prev, out);
+        last->normalInitSynapses();
+        net.addLink(last);
+
+        Sample sample;
+        sample.features = {1, 0, 1, 0};
+        double tReschedule = timeIt([&]
+                                    { net.compile(); net.predict(sample); }, 20000);
+        double tPlan = timeIt([&]
+                              { net.predict(sample); }, 20000);
+        std::cout << depth << " links  compile+predict: " << tReschedule << " us, compiled predict: " << tPlan
+                  << " us, scheduling overhead: " << tReschedule - tPlan << " us/call" << std::endl;
+    }
+}
+
+void benchTrain()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    struct Config
+    {
+        const char *name;
+        Optimizer optimizer;
+        double learningRate;
+    };
+    for (Config config : {Config{"sgd", Optimizer::SGD, 1.0}, Config{"momentum", Optimizer::Momentum, 0.1},
+                          Config{"adam", Optimizer::Adam, 0.01}})
+    {
+        Network net = makeDigitNet(64);
+
+        TrainOptions options;
+        options.optimizer = config.optimizer;
+        options.learningRate = config.learningRate;
+        options.epochs = 30;
+        options.verbose = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        net.train(trainSet, options);
+        auto t1 = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(t1 - t0).count();
+        std::cout << "256-64-10 " << config.name << ": " << options.epochs / seconds << " epochs/s, test accuracy "
+                  << net.accuracy(testSet) << std::endl;
+    }
+}
+
+void benchTrainScaling()
+{
+    SampleSet trainSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet))
+        return;
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    double base = 0;
+    for (size_t threads : {1, 2, 4, 8, 16})
+    {
+        TrainOptions options;
+        options.optimizer = Optimizer::Adam;
+        options.learningRate = 0.01;
+        options.batchSize = 256;
+        options.epochs = 10;
+        options.threads = threads;
+        options.verbose = 0;
+        // 同样的初始权重训练两次，输出完全一致才算可复现
+        double outputs[2];
+        double seconds = 0;
+        for (double &o : outputs)
+        {
+            Network net = makeDigitNet(128, 1);
+            auto t0 = std::chrono::steady_clock::now();
+            net.train(trainSet, options);
+            auto t1 = std::chrono::steady_clock::now();
+            seconds = std::chrono::duration<double>(t1 - t0).count();
+            Matrix out = net.predictBatch(trainSet, 128);
+            o = std::accumulate(out.data.begin(), out.data.end(), 0.0);
+        }
+        double eps = options.epochs / seconds;
+        if (threads == 1)
+            base = eps;
+        std::cout << "256-128-10 adam batch 256, " << threads << " threads: " << eps << " epochs/s (x" << eps / base
+                  << ")  deterministic: " << (outputs[0] == outputs[1] ? "yes" : "no") << std::endl;
+    }
+}
+
+void benchConcurrentPredict()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    const Network net = makeDigitNet(64);
+    const std::vector<Sample> samples = smpSet.getSamples();
+    const size_t perThread = 20000;
+    double base = 0;
+    for (size_t threads : {1, 2, 4, 8})
+    {
+        std::vector<std::thread> workers;
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&]
+                                 {
+                Network::InferenceContext ctx = net.makeContext();
+                for (size_t i = 0; i < perThread; i++)
+                    net.predict(samples[i % samples.size()], ctx); });
+        }
+        for (auto &w : workers)
+            w.join();
+        auto t1 = std::chrono::steady_clock::now();
+        double qps = threads * perThread / std::chrono::duration<double>(t1 - t0).count();
+        if (threads == 1)
+            base = qps;
+        std::cout << "256-64-10 shared model, " << threads << " threads: " << qps << " predict/s (x" << qps / base << ")" << std::endl;
+    }
+}
+
+// 旧的逐样本布局：每行两个独立的 std::vector<double>
+static size_t loadLegacySamples(const std::string &path, std::vector<Sample> &samples, size_t featureSize, size_t labelSize)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::stringstream ss(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (ss >> token)
+            tokens.push_back(token);
+        if (tokens.size() != featureSize + labelSize)
+            continue;
+        std::vector<double> numTokens;
+        for (const auto &t : tokens)
+            numTokens.push_back(std::stod(t));
+        Sample sp;
+        sp.features = std::vector<double>(numTokens.begin(), numTokens.begin() + featureSize);
+        sp.labels = std::vector<double>(numTokens.begin() + featureSize, numTokens.end());
+        samples.push_back(sp);
+    }
+    return samples.size();
+}
+
+void benchSampleStorage()
+{
+    const std::string path = makeScaledCopy("../data/train.csv", 100);
+    // 先测新布局：旧布局释放后留在堆里的内存会被后来的分配复用，影响常驻内存的统计
+    {
+        size_t rss0 = residentBytes();
+        auto t0 = std::chrono::steady_clock::now();
+        SampleSet smpSet(256, 10);
+        loadSamples(path, smpSet);
+        auto t1 = std::chrono::steady_clock::now();
+        size_t rss1 = residentBytes();
+        size_t bytes = smpSet.size() * (smpSet.featureSize + smpSet.labelSize) * sizeof(double);
+        std::cout << "train.csv x100, SampleSet:      " << smpSet.size() << " rows, load "
+                  << std::chrono::duration<double>(t1 - t0).count() << " s, resident +"
+                  << (rss1 - rss0) / 1048576.0 << " MB, 2 buffers, payload "
+                  << bytes / 1048576.0 << " MB" << std::endl;
+    }
+    {
+        size_t rss0 = residentBytes();
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<Sample> samples;
+        size_t rows = loadLegacySamples(path, samples, 256, 10);
+        auto t1 = std::chrono::steady_clock::now();
+        size_t rss1 = residentBytes();
+        // 每个 std::vector 的堆块另有约 16 字节的分配器头
+        size_t bytes = samples.capacity() * sizeof(Sample);
+        for (const auto &s : samples)
+            bytes += (s.features.capacity() + s.labels.capacity()) * sizeof(double) + 32;
+        std::cout << "train.csv x100, vector<Sample>: " << rows << " rows, load "
+                  << std::chrono::duration<double>(t1 - t0).count() << " s, resident +"
+                  << (rss1 - rss0) / 1048576.0 << " MB, " << 2 * rows << " heap blocks, heap "
+                  << bytes / 1048576.0 << " MB" << std::endl;
+    }
+    std::filesystem::remove(path);
+}
+
+void benchLoadSamples()
+{
+    const std::string path = makeScaledCopy("../data/train.csv", 100);
+    const double mb = std::filesystem::file_size(path) / 1048576.0;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Sample> legacy;
+    size_t legacyRows = loadLegacySamples(path, legacy, 256, 10);
+    auto t1 = std::chrono::steady_clock::now();
+    double tLegacy = std::chrono::duration<double>(t1 - t0).count();
+    std::cout << "train.csv x100 (" << mb << " MB), getline+stod: " << legacyRows << " rows, "
+              << mb / tLegacy << " MB/s, " << legacyRows / tLegacy << " rows/s" << std::endl;
+    legacy = std::vector<Sample>();
+
+    for (size_t threads : {size_t(1), size_t(0)})
+    {
+        SampleSet smpSet(256, 10);
+        auto t2 = std::chrono::steady_clock::now();
+        loadSamples(path, smpSet, threads);
+        auto t3 = std::chrono::steady_clock::now();
+        double t = std::chrono::duration<double>(t3 - t2).count();
+        std::cout << "train.csv x100 (" << mb << " MB), mmap+parse " << (threads ? std::to_string(threads) : std::string("all"))
+                  << " threads: " << smpSet.size() << " rows, " << mb / t << " MB/s, " << smpSet.size() / t
+                  << " rows/s (x" << tLegacy / t << ")" << std::endl;
+    }
+    std::filesystem::remove(path);
+}
+
+void benchBinarySamples()
+{
+    const std::string csvPath = makeScaledCopy("../data/train.csv", 100);
+    const std::string binPath = csvPath + ".nlds";
+    SampleSet csvSet(256, 10);
+    double tCsv = timeIt([&]
+                         { loadSamples(csvPath, csvSet); }, 1);
+    std::cout << "train.csv x100 text load: " << tCsv / 1000 << " ms" << std::endl;
+    for (SampleType type : {SampleType::F64, SampleType::U8, SampleType::Bit})
+    {
+        saveSamplesBinary(binPath, csvSet, type);
+        SampleSet binSet(256, 10);
+        double tBin = timeIt([&]
+                             { loadSamplesBinary(binPath, binSet); }, 10);
+        // 映射后第一次遍历才真正读页，单独计时
+        auto t0 = std::chrono::steady_clock::now();
+        double sum = std::accumulate(binSet.featureData(), binSet.featureData() + binSet.size() * binSet.featureSize, 0.0);
+        auto t1 = std::chrono::steady_clock::now();
+        std::cout << "train x100 " << (type == SampleType::F64 ? "f64" : type == SampleType::U8 ? "u8 " : "bit")
+                  << ": " << std::filesystem::file_size(binPath) / 1048576.0 << " MB, load " << tBin / 1000
+                  << " ms (x" << tCsv / tBin << "), first pass " << std::chrono::duration<double, std::milli>(t1 - t0).count()
+                  << " ms (checksum " << sum << ")" << std::endl;
+    }
+    std::filesystem::remove(binPath);
+    std::filesystem::remove(csvPath);
+}
+
+void benchModelLoad()
+{
+    for (size_t hidden : {1024, 4096})
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto h1 = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+        auto h2 = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+        Network net(in, out);
+        net.addLayer(h1);
+        net.addLayer(h2);
+        for (auto [s, t] : {std::pair{in, h1}, std::pair{h1, h2}, std::pair{h2, out}})
+        {
+            auto link = std::make_shared<Network::DenseLink>(s, t);
+            link->normalInitSynapses(1);
+            net.addLink(link);
+        }
+        const std::string path = (std::filesystem::temp_directory_path() / ("bench_" + std::to_string(hidden) + ".nll")).string();
+        auto t0 = std::chrono::steady_clock::now();
+        net.saveModel(path);
+        auto t1 = std::chrono::steady_clock::now();
+        std::vector<double> x(256, 1.0);
+        double first = 0;
+        std::chrono::steady_clock::time_point t2, t3, t4;
+        {
+            t2 = std::chrono::steady_clock::now();
+            Network loaded(path);
+            t3 = std::chrono::steady_clock::now();
+            first = loaded.predict(x).labels.at(0);
+            t4 = std::chrono::steady_clock::now();
+        }
+        auto ms = [](auto a, auto b)
+        { return std::chrono::duration<double, std::milli>(b - a).count(); };
+        std::cout << "256-" << hidden << "-" << hidden << "-10 model (" << std::filesystem::file_size(path) / 1048576.0
+                  << " MB): save " << ms(t0, t1) << " ms, load " << ms(t2, t3) << " ms, first predict "
+                  << ms(t3, t4) << " ms (output " << first << ")" << std::endl;
+        std::filesystem::remove(path);
+    }
+}
+
+void benchPrecision()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    std::span<const double> x = testSet.at(0).features;
+    for (size_t hidden : {64, 256})
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+        auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+        auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+        in2hid->normalInitSynapses(7);
+        hid2out->normalInitSynapses(8);
+        Network net(in, out);
+        net.addLayer(hid);
+        net.addLink(in2hid);
+        net.addLink(hid2out);
+        TrainOptions options;
+        options.optimizer = Optimizer::Adam;
+        options.learningRate = 0.01;
+        options.epochs = 20;
+        options.verbose = 0;
+        net.train(trainSet, options);
+        for (Precision p : {Precision::Double, Precision::Float32, Precision::Int8})
+        {
+            net.setPrecision(p);
+            double tSingle = timeIt([&]
+                                    { net.predict(x); }, 2000);
+            double tBatch = timeIt([&]
+                                   { net.predictBatch(testSet, 64); }, 20);
+            std::cout << "256-" << hidden << "-10 " << (p == Precision::Double ? "f64 " : p == Precision::Float32 ? "f32 " : "int8")
+                      << ": test accuracy " << net.accuracy(testSet) << ", weights "
+                      << (in2hid->weightBytes() + hid2out->weightBytes()) / 1024.0 << " KB, predict " << tSingle
+                      << " us, predictBatch " << tBatch / testSet.size() << " us/sample" << std::endl;
+        }
+    }
+}
+
+void benchBinaryInput()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    SampleSet packedSet = smpSet;
+    packedSet.packFeatureBits();
+    std::span<const double> x = smpSet.at(0).features;
+    for (size_t hidden : {64, 256, 1024})
+    {
+        Network net = makeDigitNet(hidden, 1);
+        double tDense = timeIt([&]
+                               { net.predict(x); }, 2000);
+        double tDenseBatch = timeIt([&]
+                                    { net.predictBatch(smpSet, 64); }, 20);
+        net.setBinaryInput(1);
+        double tBits = timeIt([&]
+                              { net.predict(x); }, 2000);
+        double tBitsBatch = timeIt([&]
+                                   { net.predictBatch(smpSet, 64); }, 20);
+        double tPackedBatch = timeIt([&]
+                                     { net.predictBatch(packedSet, 64); }, 20);
+        const size_t n = smpSet.size();
+        std::cout << "256-" << hidden << "-10 predict: dense " << tDense << " us, bits " << tBits << " us (x"
+                  << tDense / tBits << ")  predictBatch: dense " << tDenseBatch / n
+                  << " us/sample, bits packed per batch " << tBitsBatch / n << ", bits from set "
+                  << tPackedBatch / n << " (x" << tDenseBatch / tPackedBatch << ")" << std::endl;
+    }
+}
+
+void benchActivation()
+{
+    // 旧实现：按名字查 std::function，逐元素调用
+    std::function<double(double)> sigmoidFunc = sigmoid;
+    const size_t batch = 64;
+    for (size_t cols : {64, 256, 1024})
+    {
+        const size_t total = batch * cols;
+        std::vector<double> z(total), y(total);
+        for (size_t e = 0; e < total; e++)
+            z[e] = std::sin(e * 0.37) * 4;
+        double tOld = timeIt([&]
+                             { for (size_t e = 0; e < total; e++) y[e] = sigmoidFunc(z[e]); }, 200);
+        std::cout << "activation " << batch << "x" << cols << ": sigmoid std::function " << tOld << " us";
+        for (Activation act : {Activation::Sigmoid, Activation::Tanh, Activation::ReLU, Activation::Softmax})
+        {
+            double tScalar = timeIt([&]
+                                    { activateScalar(act, z.data(), y.data(), batch, cols); }, 200);
+            double tSimd = timeIt([&]
+                                  { activate(act, z.data(), y.data(), batch, cols); }, 200);
+            const char *name = act == Activation::Sigmoid ? "sigmoid" : act == Activation::Tanh ? "tanh"
+                                                                    : act == Activation::ReLU   ? "relu"
+                                                                                                : "softmax";
+            std::cout << ", " << name << " " << tScalar << " -> " << tSimd << " us";
+        }
+        std::cout << std::endl;
+    }
+}
+
+void benchFusion()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    std::span<const double> x = smpSet.at(0).features;
+    const size_t n = smpSet.size();
+    for (bool skip : {false, true})
+    {
+        for (size_t hidden : {64, 256, 1024})
+        {
+            auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+            auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+            auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+            auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+            auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+            in2hid->normalInitSynapses(1);
+            hid2out->normalInitSynapses(2);
+            Network net(in, out);
+            net.addLayer(hid);
+            net.addLink(in2hid);
+            net.addLink(hid2out);
+            if (skip)
+            {
+                // 输入层直连输出层，输出层有两条入链接
+                auto in2out = std::make_shared<Network::DenseLink>(in, out);
+                in2out->normalInitSynapses(3);
+                net.addLink(in2out);
+            }
+            // 按内核的访问方式估算每个样本读写层缓冲的字节数：未融合时清零写一遍，每条链接加偏置、
+            // 累加点积各读写一遍（gemm 每 256 列一个 K 块），激活再读写一遍；融合后只写一遍输出
+            auto linkBytes = [](size_t rows, size_t cols)
+            { return 8 * rows * (2 + 2 * ((cols + 255) / 256)); };
+            double plainTraffic = 8 * 3 * (hidden + 10) + linkBytes(hidden, 256) + linkBytes(10, hidden) +
+                                  (skip ? linkBytes(10, 256) : 0);
+            double fusedTraffic = 8.0 * (hidden + 10);
+            // 两种方式交替测几轮取最好的一次，减少机器抖动的影响
+            double tPlain = 1e300, tPlainBatch = 1e300, tFused = 1e300, tFusedBatch = 1e300;
+            for (int round = 0; round < 5; round++)
+            {
+                net.setFusion(0);
+                tPlain = std::min(tPlain, timeIt([&]
+                                                 { net.predict(x); }, 500));
+                tPlainBatch = std::min(tPlainBatch, timeIt([&]
+                                                           { net.predictBatch(smpSet, 64); }, 4));
+                net.setFusion(1);
+                tFused = std::min(tFused, timeIt([&]
+                                                 { net.predict(x); }, 500));
+                tFusedBatch = std::min(tFusedBatch, timeIt([&]
+                                                           { net.predictBatch(smpSet, 64); }, 4));
+            }
+            std::cout << "256-" << hidden << "-10" << (skip ? " +skip" : "") << ": layer buffer traffic "
+                      << plainTraffic / 1024 << " -> " << fusedTraffic / 1024 << " KB/sample, predict " << tPlain
+                      << " -> " << tFused << " us (x" << tPlain / tFused << "), predictBatch " << tPlainBatch / n
+                      << " -> " << tFusedBatch / n << " us/sample (x" << tPlainBatch / tFusedBatch << ")" << std::endl;
+        }
+    }
+}
+
+void benchSparse()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    std::span<const double> x = testSet.at(0).features;
+    const std::string path = (std::filesystem::temp_directory_path() / "benchSparse.nll").string();
+    // 输入到隐藏层分别用稠密、局部感受野、随机稀疏三种连接，隐藏层都是 4x8x8 = 256 个神经元；
+    // field 为 0 表示不是局部连接
+    struct Variant
+    {
+        const char *name;
+        size_t field;
+        size_t stride;
+    };
+    for (Variant v : {Variant{"dense", 0, 0}, Variant{"local 5x5/2", 5, 2}, Variant{"local 7x7/3", 7, 3},
+                      Variant{"random 10%", 0, 0}})
+    {
+        const std::string kind = v.name;
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({4, 8, 8}), "sigmoid");
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+        std::shared_ptr<Network::Link> in2hid;
+        size_t nnz = 0;
+        if (v.field)
+        {
+            auto local = std::make_shared<Network::LocalLink>(in, hid, std::vector<size_t>({v.field, v.field}),
+                                                              std::vector<size_t>({v.stride, v.stride}));
+            nnz = local->nnz();
+            in2hid = local;
+        }
+        else if (kind == "dense")
+        {
+            in2hid = std::make_shared<Network::DenseLink>(in, hid);
+            nnz = in->size() * hid->size();
+        }
+        else
+        {
+            std::mt19937 gen(9);
+            std::bernoulli_distribution keep(0.1);
+            std::vector<std::pair<size_t, size_t>> connections;
+            for (size_t t = 0; t < hid->size(); t++)
+                for (size_t s = 0; s < in->size(); s++)
+                    if (keep(gen))
+                        connections.push_back({s, t});
+            auto sparse = std::make_shared<Network::SparseLink>(in, hid, connections);
+            nnz = sparse->nnz();
+            in2hid = sparse;
+        }
+        auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+        in2hid->normalInitSynapses(1);
+        hid2out->normalInitSynapses(2);
+        Network net(in, out);
+        net.addLayer(hid);
+        net.addLink(in2hid);
+        net.addLink(hid2out);
+        TrainOptions options;
+        options.optimizer = Optimizer::Adam;
+        options.learningRate = 0.01;
+        options.epochs = 20;
+        options.verbose = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        net.train(trainSet, options);
+        double trainMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        net.saveModel(path);
+        double fileKB = std::filesystem::file_size(path) / 1024.0;
+        std::filesystem::remove(path);
+        double tSingle = timeIt([&]
+                                { net.predict(x); }, 2000);
+        double tBatch = timeIt([&]
+                               { net.predictBatch(testSet, 64); }, 20);
+        std::cout << "256-256-10 " << kind << ": first layer " << nnz << " weights (" << 2.0 * nnz / 1000
+                  << " kFLOP/sample), model " << fileKB << " KB, train " << trainMs << " ms, test accuracy "
+                  << net.accuracy(testSet) << ", predict " << tSingle << " us, predictBatch "
+                  << tBatch / testSet.size() << " us/sample" << std::endl;
+    }
+}
+
+void benchConv()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    std::span<const double> x = testSet.at(0).features;
+    // 前三种参数量都在 5.3K 左右：两种卷积都是 8 个 5x5 卷积核接 512 -> 10 的输出层，
+    // 一种先保持 16x16 再 2x2 最大池化，一种直接步长 2；稠密的 256-256-10 作为参考
+    for (std::string kind : {"dense 256-20-10", "conv 8@5x5 + maxpool", "conv 8@5x5/2", "dense 256-256-10"})
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+        Network net(in, out);
+        std::vector<std::shared_ptr<Network::Link>> links;
+        std::shared_ptr<Network::Layer> last;
+        if (kind.starts_with("dense"))
+        {
+            last = std::make_shared<Network::Layer>(std::vector<size_t>({kind == "dense 256-20-10" ? size_t(20) : size_t(256)}), "sigmoid");
+            net.addLayer(last);
+            links.push_back(std::make_shared<Network::DenseLink>(in, last));
+        }
+        else
+        {
+            const bool pooled = kind.ends_with("maxpool");
+            const size_t side = pooled ? 16 : 8;
+            auto conv = std::make_shared<Network::Layer>(std::vector<size_t>({8, side, side}), "relu");
+            net.addLayer(conv);
+            links.push_back(std::make_shared<Network::ConvLink>(in, conv, std::vector<size_t>({5, 5}),
+                                                            std::vector<size_t>({16 / side, 16 / side}), std::vector<size_t>({2, 2})));
+            last = conv;
+            if (pooled)
+            {
+                last = std::make_shared<Network::Layer>(std::vector<size_t>({8, 8, 8}));
+                net.addLayer(last);
+                links.push_back(std::make_shared<Network::PoolLink>(conv, last, std::vector<size_t>({2, 2})));
+            }
+        }
+        links.push_back(std::make_shared<Network::DenseLink>(last, out));
+        size_t params = 0;
+        unsigned seed = 1;
+        for (const auto &link : links)
+        {
+            link->normalInitSynapses(seed++);
+            params += link->paramCount();
+            net.addLink(link);
+        }
+        TrainOptions options;
+        options.optimizer = Optimizer::Adam;
+        options.learningRate = 0.01;
+        options.epochs = 20;
+        options.verbose = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        net.train(trainSet, options);
+        double trainMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        double tSingle = timeIt([&]
+                                { net.predict(x); }, 2000);
+        double tBatch = timeIt([&]
+                               { net.predictBatch(testSet, 64); }, 20);
+        std::cout << kind << ": " << params << " params, train " << trainMs << " ms, test accuracy "
+                  << net.accuracy(testSet) << ", predict " << tSingle << " us, predictBatch "
+                  << tBatch / testSet.size() << " us/sample" << std::endl;
+    }
+}
+
+// 基准套件的一项结果，耗时均为每次调用的微秒数
+struct SuiteResult
+{
+    std::string name;
+    size_t hidden = 0; // 与网络无关的项为 0
+    size_t items = 1;  // 每次调用处理的样本数，用于换算 samples/s
+    size_t runs = 0;
+    size_t reps = 0;   // 每个计时样本包含的调用次数
+    double median = 0, p99 = 0, mean = 0, min = 0;
+};
+
+// 先预热（至少 2 次、20 ms），再按估计的单次耗时把 reps 次调用合成一个计时样本（至少约 50 us），
+// 短操作的时钟开销可以忽略；共取 runs 个样本做统计
+template <typename F>
+static SuiteResult measure(std::string name, size_t hidden, size_t items, size_t runs, F &&f)
+{
+    using clock = std::chrono::steady_clock;
+    auto since = [](clock::time_point t0)
+    { return std::chrono::duration<double, std::micro>(clock::now() - t0).count(); };
+    size_t calls = 0;
+    auto t0 = clock::now();
+    while (calls < 2 || since(t0) < 20000)
+    {
+        f();
+        calls++;
+    }
+    SuiteResult r;
+    r.name = std::move(name);
+    r.hidden = hidden;
+    r.items = items;
+    r.runs = runs;
+    r.reps = std::max<size_t>(1, size_t(50.0 / (since(t0) / calls)));
+    std::vector<double> samples(runs);
+    for (double &s : samples)
+    {
+        auto t = clock::now();
+        for (size_t i = 0; i < r.reps; i++)
+            f();
+        s = since(t) / r.reps;
+    }
+    std::sort(samples.begin(), samples.end());
+    r.median = runs % 2 ? samples[runs / 2] : (samples[runs / 2 - 1] + samples[runs / 2]) / 2;
+    r.p99 = samples[std::min(runs - 1, size_t(std::ceil(0.99 * runs)) - 1)];
+    r.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / runs;
+    r.min = samples.front();
+    return r;
+}
+
+static std::string suiteKey(const std::string &name, size_t hidden)
+{
+    return name + "/" + std::to_string(hidden);
+}
+
+// 只用来读本套件自己写出的 JSON：每项结果占一行，取 "key": 后面的值
+static std::string jsonField(const std::string &line, const std::string &key)
+{
+    size_t pos = line.find("\"" + key + "\": ");
+    if (pos == std::string::npos)
+        return "";
+    pos += key.size() + 4;
+    size_t end = line.find_first_of(",}", pos);
+    std::string value = line.substr(pos, end - pos);
+    if (value.size() >= 2 && value.front() == '"')
+        value = value.substr(1, value.size() - 2);
+    return value;
+}
+
+bool benchSuite(const std::string &jsonPath, const std::string &baselinePath, double threshold)
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return 0;
+    std::span<const double> x = testSet.at(0).features;
+    const std::string modelPath = (std::filesystem::temp_directory_path() / "benchSuite.nll").string();
+    std::vector<SuiteResult> results;
+    results.push_back(measure("loadSamples", 0, trainSet.size(), 10, [&]
+                              {
+                                  SampleSet s(256, 10);
+                                  loadSamples("../data/train.csv", s);
+                              }));
+    for (size_t hidden : {16, 64, 256, 1024})
+    {
+        Network net = makeDigitNet(hidden, 1);
+        results.push_back(measure("predict", hidden, 1, 200, [&]
+                                  { net.predict(x); }));
+        results.push_back(measure("predictBatch", hidden, testSet.size(), 50, [&]
+                                  { net.predictBatch(testSet, 64); }));
+        results.push_back(measure("save", hidden, 1, 20, [&]
+                                  { net.saveModel(modelPath); }));
+        results.push_back(measure("load", hidden, 1, 20, [&]
+                                  { Network loaded(modelPath); }));
+        TrainOptions options;
+        options.epochs = 1;
+        options.verbose = 0;
+        results.push_back(measure("trainEpoch", hidden, trainSet.size(), 10, [&]
+                                  { net.train(trainSet, options); }));
+    }
+    std::filesystem::remove(modelPath);
+
+    // 基线每项的 (median, min)
+    std::map<std::string, std::pair<double, double>> baseline;
+    if (!baselinePath.empty())
+    {
+        std::ifstream in(baselinePath);
+        if (!in)
+        {
+            std::cout << "benchSuite Error: couldn't open baseline " << baselinePath << std::endl;
+            return 0;
+        }
+        for (std::string line; std::getline(in, line);)
+        {
+            std::string name = jsonField(line, "name");
+            if (!name.empty())
+                baseline[suiteKey(name, std::stoul(jsonField(line, "hidden")))] = {std::stod(jsonField(line, "median_us")),
+                                                                                   std::stod(jsonField(line, "min_us"))};
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"build\": {\"compiler\": \"" << __VERSION__ << "\", \"simd\": \""
+#if defined(__AVX2__) && defined(__FMA__)
+         << "avx2+fma"
+#else
+         << "scalar"
+#endif
+         << "\", \"threads\": " << std::thread::hardware_concurrency() << "},\n  \"results\": [\n";
+    size_t regressions = 0;
+    for (size_t k = 0; k < results.size(); k++)
+    {
+        const SuiteResult &r = results[k];
+        const double perSec = r.items * 1e6 / r.median;
+        json << "    {\"name\": \"" << r.name << "\", \"hidden\": " << r.hidden << ", \"runs\": " << r.runs
+             << ", \"reps\": " << r.reps << ", \"median_us\": " << r.median << ", \"p99_us\": " << r.p99
+             << ", \"mean_us\": " << r.mean << ", \"min_us\": " << r.min << ", \"samples_per_sec\": " << perSec << "}"
+             << (k + 1 < results.size() ? "," : "") << "\n";
+        std::cout << r.name << (r.hidden ? " 256-" + std::to_string(r.hidden) + "-10" : "") << ": median " << r.median
+                  << " us, p99 " << r.p99 << " us, " << perSec << " samples/s";
+        auto base = baseline.find(suiteKey(r.name, r.hidden));
+        if (base != baseline.end())
+        {
+            // 中位数和最小值都比基线慢出阈值以上才记为回归，单看中位数在共享机器上容易被调度抖动误报
+            const double ratio = r.median / base->second.first;
+            std::cout << ", x" << ratio << " vs baseline";
+            if (ratio > 1 + threshold && r.min / base->second.second > 1 + threshold)
+            {
+                std::cout << " REGRESSION";
+                regressions++;
+            }
+        }
+        std::cout << std::endl;
+    }
+    json << "  ]\n}\n";
+
+    std::ofstream out(jsonPath, std::ios::trunc);
+    out << json.str();
+    if (!out)
+    {
+        std::cout << "benchSuite Error: couldn't write " << jsonPath << std::endl;
+        return 0;
+    }
+    if (!baseline.empty())
+        std::cout << regressions << " regression(s) over " << threshold * 100 << "% against " << baselinePath << std::endl;
+    return regressions == 0;
+}
+
+void benchPrefetch()
+{
+    SampleSet trainSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet))
+        return;
+    // 16x16 图像随机平移至多 1 个像素（空出的位置补 0）再加高斯噪声，代价和一个样本的前向/反向相当
+    auto shiftNoise = [](double *features, size_t rows, size_t featureSize, std::mt19937 &gen)
+    {
+        std::uniform_int_distribution<int> shift(-1, 1);
+        std::normal_distribution<double> noise(0.0, 0.05);
+        double image[256];
+        for (size_t r = 0; r < rows; r++)
+        {
+            double *x = features + r * featureSize;
+            std::copy(x, x + 256, image);
+            const int dy = shift(gen), dx = shift(gen);
+            for (int i = 0; i < 16; i++)
+                for (int j = 0; j < 16; j++)
+                {
+                    const int si = i - dy, sj = j - dx;
+                    const bool inside = si >= 0 && si < 16 && sj >= 0 && sj < 16;
+                    x[i * 16 + j] = (inside ? image[si * 16 + sj] : 0.0) + noise(gen);
+                }
+        }
+    };
+    for (bool augment : {false, true})
+    {
+        for (size_t prefetch : {0, 1, 3})
+        {
+            Network net = makeDigitNet(64, 1);
+            TrainOptions options;
+            options.epochs = 5;
+            options.verbose = 0;
+            options.prefetch = prefetch;
+            if (augment)
+                options.augment = shiftNoise;
+            // 进程 CPU 时间（含预取线程）除以墙钟时间，即平均占用的核数
+            std::clock_t c0 = std::clock();
+            auto t0 = std::chrono::steady_clock::now();
+            net.train(trainSet, options);
+            double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            double cpu = double(std::clock() - c0) / CLOCKS_PER_SEC;
+            std::cout << "256-64-10 " << (augment ? "shift+noise" : "no augment") << ", prefetch " << prefetch << ": "
+                      << wall / options.epochs * 1e3 << " ms/epoch, CPU utilisation " << cpu / wall * 100 << "%" << std::endl;
+        }
+    }
+}
+
+void benchServer()
+{
+    SampleSet testSet(256, 10);
+    if (!loadSamples("../data/test.csv", testSet))
+        return;
+    Network net = makeDigitNet(256, 1);
+    // 对照：单线程直接 predict 的延迟
+    double direct = timeIt([&]
+                           { net.predict(testSet.at(0).features); }, 2000);
+    std::cout << "direct predict (256-256-10): " << direct << " us" << std::endl;
+    for (size_t clients : {1, 8, 32})
+    {
+        for (long delay : {0L, 200L, 1000L})
+        {
+            ServerOptions options;
+            options.maxBatch = 32;
+            options.maxDelay = std::chrono::microseconds(delay);
+            BatchingServer server(net, options);
+            TcpServer tcp(server);
+            if (!tcp.listen(0))
+                return;
+            std::thread acceptor([&]
+                                 { tcp.run(); });
+            // 闭环压测：每个连接一问一答
+            LoadgenResult r = runLoadgen(tcp.port(), testSet, clients, 4000 / clients);
+            ServerStats s = server.stats();
+            tcp.stop();
+            acceptor.join();
+            std::cout << "serve " << clients << " clients, maxDelay " << delay << " us: " << r.qps << " qps, p50 " << r.p50
+                      << " us, p99 " << r.p99 << " us, server mean batch " << s.meanBatch
+                      << (r.errors ? " (errors)" : "") << std::endl;
+        }
+    }
+}
+
+void benchPredictInto()
+{
+    SampleSet testSet(256, 10);
+    if (!loadSamples("../data/test.csv", testSet))
+        return;
+    for (size_t hidden : {16, 64, 256})
+    {
+        Network net = makeDigitNet(hidden, 1);
+        Network::InferenceContext ctx = net.makeContext();
+        std::span<const double> x = testSet.at(0).features;
+        double out[10];
+        // 返回 Sample 每次要分配并拷贝特征和输出；写进调用方缓冲的版本没有堆分配
+        double tSample = timeIt([&]
+                                { net.predict(x, ctx); }, 20000);
+        double tSpan = timeIt([&]
+                              { net.predict(x, out, ctx); }, 20000);
+        std::cout << "256-" << hidden << "-10  predict: Sample " << tSample << " us, into span " << tSpan << " us (x"
+                  << tSample / tSpan << ")" << std::endl;
+    }
+}
+
+template <size_t Hidden>
+static void benchStaticAt(const SampleSet &testSet)
+{
+    Network net = makeDigitNet(Hidden, 1);
+    const std::string path = (std::filesystem::temp_directory_path() / "bench_static.nll").string();
+    net.saveModel(path);
+    auto fixed = std::make_unique<StaticNetwork<Dense<256, Hidden, Activation::Sigmoid>, Dense<Hidden, 10, Activation::Sigmoid>>>();
+    bool loaded = fixed->load(path);
+    std::filesystem::remove(path);
+    if (!loaded)
+        return;
+    Network::InferenceContext ctx = net.makeContext();
+    double out[10];
+    size_t i = 0, j = 0;
+    double tDynamic = timeIt([&]
+                             { net.predict(testSet.at(i++ % testSet.size()).features, out, ctx); }, 20000);
+    double tStatic = timeIt([&]
+                            { fixed->predict(testSet.at(j++ % testSet.size()).features.data(), out); }, 20000);
+    std::cout << "256-" << Hidden << "-10  single-sample predict: Network " << tDynamic << " us, StaticNetwork " << tStatic
+              << " us (x" << tDynamic / tStatic << ")" << std::endl;
+}
+
+void benchStaticNetwork()
+{
+    SampleSet testSet(256, 10);
+    if (!loadSamples("../data/test.csv", testSet))
+        return;
+    benchStaticAt<16>(testSet);
+    benchStaticAt<64>(testSet);
+    benchStaticAt<256>(testSet);
+}
+
+void benchIncrementalPredict()
+{
+    SampleSet testSet(256, 10);
+    if (!loadSamples("../data/test.csv", testSet))
+        return;
+    // 预先生成要翻转的像素，计时里只有翻转和前向
+    std::mt19937 gen(7);
+    std::vector<size_t> pixels(4096);
+    for (size_t &p : pixels)
+        p = gen() % 256;
+    for (size_t hidden : {16, 64, 256})
+    {
+        Network net = makeDigitNet(hidden, 1);
+        // 二值输入时增量更新读 setBinaryInput 生成的按列权重，否则按行扫行主序权重
+        for (bool binary : {false, true})
+        {
+            net.setBinaryInput(binary);
+            Network::InferenceContext ctx = net.makeContext();
+            std::vector<double> x(testSet.at(0).features.begin(), testSet.at(0).features.end());
+            double out[10];
+            double tFull = timeIt([&]
+                                  { net.predict(x, out, ctx); }, 20000);
+            std::cout << "256-" << hidden << "-10 " << (binary ? "binary" : "dense ") << "  full predict " << tFull << " us";
+            for (size_t edits : {1, 10})
+            {
+                size_t next = 0;
+                net.predictIncremental(x, {}, out, ctx);
+                double t = timeIt([&]
+                                  {
+                    std::span<const size_t> changed(pixels.data() + next, edits);
+                    next = (next + edits) % (pixels.size() - edits);
+                    for (size_t p : changed)
+                        x[p] = 1 - x[p];
+                    net.predictIncremental(x, changed, out, ctx); }, 20000);
+                std::cout << ", " << edits << "-pixel edit " << t << " us (x" << tFull / t << ")";
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+
+void benchSweep()
+{
+    SampleSet samples(256, 10), trainSet(256, 10), validationSet(256, 10);
+    auto tLoad = std::chrono::steady_clock::now();
+    if (!loadSamples("../data/train.csv", samples))
+        return;
+    double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tLoad).count();
+    if (!splitValidation(samples, 0.2, 1, trainSet, validationSet))
+        return;
+    std::vector<SweepConfig> configs = defaultSweepGrid();
+    SweepOptions options;
+    options.maxEpochs = 20;
+    options.verbose = 0;
+    // 一个进程一个配置时，每个进程都要重新解析一遍数据
+    std::cout << "sweep of " << configs.size() << " configs, parsing data once: " << loadSeconds * 1000
+              << " ms instead of " << loadSeconds * 1000 * configs.size() << " ms" << std::endl;
+    for (size_t threads : {size_t(1), size_t(0)})
+    {
+        options.threads = threads;
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<SweepResult> results = runSweep(trainSet, validationSet, configs, options);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (results.empty() || !results[0].ok)
+            return;
+        double jobSeconds = 0;
+        size_t epochs = 0, early = 0;
+        for (const SweepResult &r : results)
+        {
+            jobSeconds += r.seconds;
+            epochs += r.epochs;
+            early += r.stoppedEarly;
+        }
+        std::cout << "  " << (threads ? threads : std::max(1u, std::thread::hardware_concurrency())) << " threads: wall "
+                  << seconds << " s, sum of jobs " << jobSeconds << " s, " << epochs << " epochs (" << early
+                  << " runs stopped early, full grid would be " << configs.size() * options.maxEpochs << "), best "
+                  << results[0].config.name() << " " << results[0].bestAccuracy << std::endl;
+    }
+}
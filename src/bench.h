@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+void benchPredict();
+void benchPredictBatch();
+void benchCompile();
+void benchTrain();
+void benchTrainScaling();
+void benchConcurrentPredict();
+void benchSampleStorage();
+void benchLoadSamples();
+void benchBinarySamples();
+void benchModelLoad();
+void benchPrecision();
+void benchBinaryInput();
+void benchActivation();
+void benchFusion();
+void benchSparse();
+void benchConv();
+void benchPrefetch();
+void benchServer();
+void benchPredictInto();
+void benchStaticNetwork();
+void benchIncrementalPredict();
+void benchSweep();
+
+// 统计化的基准套件：predict / predictBatch / 单轮训练 / loadSamples / 模型存取，隐藏层 16 ~ 1024。
+// 结果写成 JSON；给出基线 JSON 时，中位数和最小值都慢出 threshold 以上的项记为回归并返回 false
+bool benchSuite(const std::string &jsonPath, const std::string &baselinePath = "", double threshold = 0.1);
@@ -0,0 +1,866 @@
+#include "kernel.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+void gemvScalar(const double *W, const double *x, double *y, size_t rows, size_t cols)
+{
+    for (size_t r = 0; r < rows; r++)
+    {
+        const double *w = W + r * cols;
+        double acc = 0;
+        for (size_t c = 0; c < cols; c++)
+        {
+            acc += w[c] * x[c];
+        }
+        y[r] += acc;
+    }
+}
+
+void gemmScalar(const double *X, const double *W, double *C, size_t n, size_t rows, size_t cols)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        gemvScalar(W, X + i * cols, C + i * rows, rows, cols);
+    }
+}
+
+void gemmF32Scalar(const float *X, const float *W, double *C, size_t n, size_t rows, size_t ld)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t r = 0; r < rows; r++)
+        {
+            float acc = 0;
+            for (size_t c = 0; c < ld; c++)
+            {
+                acc += X[i * ld + c] * W[r * ld + c];
+            }
+            C[i * rows + r] += acc;
+        }
+    }
+}
+
+void gemmI8Scalar(const int8_t *X, const float *xScale, const int8_t *W, const float *wScale,
+                  double *C, size_t n, size_t rows, size_t ld)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t r = 0; r < rows; r++)
+        {
+            int32_t acc = 0;
+            for (size_t c = 0; c < ld; c++)
+            {
+                acc += int32_t(X[i * ld + c]) * int32_t(W[r * ld + c]);
+            }
+            C[i * rows + r] += double(xScale[i] * wScale[r]) * acc;
+        }
+    }
+}
+
+void denseFusedScalar(const DenseSegment *segs, size_t count, Activation act, double *Y, size_t n, size_t rows)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t r = 0; r < rows; r++)
+        {
+            double acc = 0;
+            double bias = 0;
+            for (size_t s = 0; s < count; s++)
+            {
+                const DenseSegment &seg = segs[s];
+                const double *w = seg.W + r * seg.cols;
+                const double *x = seg.X + i * seg.cols;
+                for (size_t c = 0; c < seg.cols; c++)
+                    acc += w[c] * x[c];
+                bias += seg.bias[r];
+            }
+            Y[i * rows + r] = acc + bias;
+        }
+    }
+    activateScalar(act, Y, Y, n, rows);
+}
+
+void spmmScalar(const uint32_t *rowPtr, const uint32_t *colIdx, const double *values, const double *X, double *Y,
+                size_t n, size_t rows, size_t cols)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const double *x = X + i * cols;
+        for (size_t r = 0; r < rows; r++)
+        {
+            double acc = 0;
+            for (uint32_t k = rowPtr[r]; k < rowPtr[r + 1]; k++)
+                acc += values[k] * x[colIdx[k]];
+            Y[i * rows + r] += acc;
+        }
+    }
+}
+
+static inline void sumSetColumnsScalar(const double *WT, size_t ldw, const uint64_t *bits, size_t words,
+                                       double *y, size_t r0, size_t r1)
+{
+    for (size_t wi = 0; wi < words; wi++)
+    {
+        for (uint64_t w = bits[wi]; w; w &= w - 1)
+        {
+            const double *col = WT + (wi * 64 + std::countr_zero(w)) * ldw;
+            for (size_t r = r0; r < r1; r++)
+                y[r] += col[r];
+        }
+    }
+}
+
+static inline void addColumnsScalar(const double *W, size_t cols, const size_t *idx, const double *delta, size_t count,
+                                    double *y, size_t r0, size_t r1)
+{
+    for (size_t r = r0; r < r1; r++)
+    {
+        const double *w = W + r * cols;
+        double sum = 0;
+        for (size_t k = 0; k < count; k++)
+            sum += w[idx[k]] * delta[k];
+        y[r] += sum;
+    }
+}
+
+static inline void addColumnsTScalar(const double *WT, size_t ldw, const size_t *idx, const double *delta, size_t count,
+                                     double *y, size_t r0, size_t r1)
+{
+    for (size_t k = 0; k < count; k++)
+    {
+        const double *col = WT + idx[k] * ldw;
+        for (size_t r = r0; r < r1; r++)
+            y[r] += col[r] * delta[k];
+    }
+}
+
+// c[0, m) += sum_q a[q * aStride] * B[q * ldb + (0, m)]
+static inline void axpyPanelScalar(const double *a, size_t aStride, const double *B, size_t ldb,
+                                   double *c, size_t m, size_t p)
+{
+    for (size_t q = 0; q < p; q++)
+    {
+        const double s = a[q * aStride];
+        const double *b = B + q * ldb;
+        for (size_t j = 0; j < m; j++)
+        {
+            c[j] += s * b[j];
+        }
+    }
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+// 把四个累加器各自水平求和，结果依次放进一个向量
+static inline __m256d hsum4(__m256d a0, __m256d a1, __m256d a2, __m256d a3)
+{
+    __m256d s01 = _mm256_hadd_pd(a0, a1);
+    __m256d s23 = _mm256_hadd_pd(a2, a3);
+    __m256d lo = _mm256_permute2f128_pd(s01, s23, 0x20);
+    __m256d hi = _mm256_permute2f128_pd(s01, s23, 0x31);
+    return _mm256_add_pd(lo, hi);
+}
+
+static inline double hsum(__m256d a)
+{
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+void gemv(const double *W, const double *x, double *y, size_t rows, size_t cols)
+{
+    const size_t vecCols = cols & ~size_t(3);
+    size_t r = 0;
+    // 每次处理四行，x 的每个分块只加载一次
+    for (; r + 4 <= rows; r += 4)
+    {
+        const double *w0 = W + r * cols;
+        const double *w1 = w0 + cols;
+        const double *w2 = w1 + cols;
+        const double *w3 = w2 + cols;
+        __m256d a0 = _mm256_setzero_pd();
+        __m256d a1 = _mm256_setzero_pd();
+        __m256d a2 = _mm256_setzero_pd();
+        __m256d a3 = _mm256_setzero_pd();
+        for (size_t c = 0; c < vecCols; c += 4)
+        {
+            __m256d xv = _mm256_loadu_pd(x + c);
+            a0 = _mm256_fmadd_pd(_mm256_loadu_pd(w0 + c), xv, a0);
+            a1 = _mm256_fmadd_pd(_mm256_loadu_pd(w1 + c), xv, a1);
+            a2 = _mm256_fmadd_pd(_mm256_loadu_pd(w2 + c), xv, a2);
+            a3 = _mm256_fmadd_pd(_mm256_loadu_pd(w3 + c), xv, a3);
+        }
+        __m256d sum = hsum4(a0, a1, a2, a3);
+        for (size_t c = vecCols; c < cols; c++)
+        {
+            sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set_pd(w3[c], w2[c], w1[c], w0[c]), _mm256_set1_pd(x[c])));
+        }
+        _mm256_storeu_pd(y + r, _mm256_add_pd(_mm256_loadu_pd(y + r), sum));
+    }
+    for (; r < rows; r++)
+    {
+        const double *w = W + r * cols;
+        __m256d a = _mm256_setzero_pd();
+        for (size_t c = 0; c < vecCols; c += 4)
+        {
+            a = _mm256_fmadd_pd(_mm256_loadu_pd(w + c), _mm256_loadu_pd(x + c), a);
+        }
+        double acc = hsum(a);
+        for (size_t c = vecCols; c < cols; c++)
+        {
+            acc += w[c] * x[c];
+        }
+        y[r] += acc;
+    }
+}
+
+// 分块大小：KC 个 double 的 x 行段留在 L1，NC 行权重块留在 L2
+static constexpr size_t GEMM_KC = 256;
+static constexpr size_t GEMM_NC = 64;
+
+// MR 个样本 x NR 行权重的微内核，在 [k0, k1) 上累加点积
+// 3x4 时正好用满 16 个 ymm 寄存器（12 个累加器）
+template <size_t MR, size_t NR>
+static inline void gemmMicro(const double *X, const double *W, double *C,
+                             size_t rows, size_t cols, size_t k0, size_t k1)
+{
+    const size_t vecEnd = k0 + ((k1 - k0) & ~size_t(3));
+    __m256d acc[MR][NR];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; i++)
+#pragma GCC unroll 4
+        for (size_t j = 0; j < NR; j++)
+            acc[i][j] = _mm256_setzero_pd();
+    for (size_t k = k0; k < vecEnd; k += 4)
+    {
+        __m256d xv[MR];
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; i++)
+            xv[i] = _mm256_loadu_pd(X + i * cols + k);
+#pragma GCC unroll 4
+        for (size_t j = 0; j < NR; j++)
+        {
+            __m256d wv = _mm256_loadu_pd(W + j * cols + k);
+#pragma GCC unroll 4
+            for (size_t i = 0; i < MR; i++)
+                acc[i][j] = _mm256_fmadd_pd(wv, xv[i], acc[i][j]);
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; i++)
+    {
+        double *c = C + i * rows;
+        if constexpr (NR == 4)
+        {
+            __m256d sum = hsum4(acc[i][0], acc[i][1], acc[i][2], acc[i][3]);
+            for (size_t k = vecEnd; k < k1; k++)
+            {
+                sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set_pd(W[3 * cols + k], W[2 * cols + k], W[cols + k], W[k]),
+                                                       _mm256_set1_pd(X[i * cols + k])));
+            }
+            _mm256_storeu_pd(c, _mm256_add_pd(_mm256_loadu_pd(c), sum));
+        }
+        else
+        {
+            for (size_t j = 0; j < NR; j++)
+            {
+                double sum = hsum(acc[i][j]);
+                for (size_t k = vecEnd; k < k1; k++)
+                    sum += W[j * cols + k] * X[i * cols + k];
+                c[j] += sum;
+            }
+        }
+    }
+}
+
+template <size_t MR>
+static inline void gemmRowPanel(const double *X, const double *W, double *C,
+                                size_t rows, size_t cols, size_t j0, size_t j1, size_t k0, size_t k1)
+{
+    size_t j = j0;
+    for (; j + 4 <= j1; j += 4)
+        gemmMicro<MR, 4>(X, W + j * cols, C + j, rows, cols, k0, k1);
+    for (; j < j1; j++)
+        gemmMicro<MR, 1>(X, W + j * cols, C + j, rows, cols, k0, k1);
+}
+
+void gemm(const double *X, const double *W, double *C, size_t n, size_t rows, size_t cols)
+{
+    for (size_t k0 = 0; k0 < cols; k0 += GEMM_KC)
+    {
+        size_t k1 = std::min(cols, k0 + GEMM_KC);
+        for (size_t j0 = 0; j0 < rows; j0 += GEMM_NC)
+        {
+            size_t j1 = std::min(rows, j0 + GEMM_NC);
+            size_t i = 0;
+            for (; i + 3 <= n; i += 3)
+                gemmRowPanel<3>(X + i * cols, W, C + i * rows, rows, cols, j0, j1, k0, k1);
+            for (; i < n; i++)
+                gemmRowPanel<1>(X + i * cols, W, C + i * rows, rows, cols, j0, j1, k0, k1);
+        }
+    }
+}
+
+static inline void axpyPanel(const double *a, size_t aStride, const double *B, size_t ldb,
+                             double *c, size_t m, size_t p)
+{
+    size_t j = 0;
+    // 16 列一组，c 的这一段在寄存器里累加完再写回
+    for (; j + 16 <= m; j += 16)
+    {
+        __m256d c0 = _mm256_loadu_pd(c + j);
+        __m256d c1 = _mm256_loadu_pd(c + j + 4);
+        __m256d c2 = _mm256_loadu_pd(c + j + 8);
+        __m256d c3 = _mm256_loadu_pd(c + j + 12);
+        for (size_t q = 0; q < p; q++)
+        {
+            const __m256d s = _mm256_broadcast_sd(a + q * aStride);
+            const double *b = B + q * ldb + j;
+            c0 = _mm256_fmadd_pd(s, _mm256_loadu_pd(b), c0);
+            c1 = _mm256_fmadd_pd(s, _mm256_loadu_pd(b + 4), c1);
+            c2 = _mm256_fmadd_pd(s, _mm256_loadu_pd(b + 8), c2);
+            c3 = _mm256_fmadd_pd(s, _mm256_loadu_pd(b + 12), c3);
+        }
+        _mm256_storeu_pd(c + j, c0);
+        _mm256_storeu_pd(c + j + 4, c1);
+        _mm256_storeu_pd(c + j + 8, c2);
+        _mm256_storeu_pd(c + j + 12, c3);
+    }
+    for (; j + 4 <= m; j += 4)
+    {
+        __m256d c0 = _mm256_loadu_pd(c + j);
+        for (size_t q = 0; q < p; q++)
+        {
+            c0 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + q * aStride), _mm256_loadu_pd(B + q * ldb + j), c0);
+        }
+        _mm256_storeu_pd(c + j, c0);
+    }
+    if (j < m)
+    {
+        axpyPanelScalar(a, aStride, B + j, ldb, c + j, m - j, p);
+    }
+}
+
+// 四个 8 路累加器各自水平求和，结果依次放进一个 128 位向量
+static inline __m128 hsum4(__m256 a0, __m256 a1, __m256 a2, __m256 a3)
+{
+    __m256 s = _mm256_hadd_ps(_mm256_hadd_ps(a0, a1), _mm256_hadd_ps(a2, a3));
+    return _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+}
+
+static inline __m128i hsum4(__m256i a0, __m256i a1, __m256i a2, __m256i a3)
+{
+    __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(a0, a1), _mm256_hadd_epi32(a2, a3));
+    return _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+}
+
+// MR 个样本 x 4 行权重；行数不足 4 时 nr 为实际行数，多出的累加器不写回。
+// float 用 3x4，int8 的符号处理要多占寄存器，用 2x4
+template <size_t MR>
+static inline void gemmF32Micro(const float *X, const float *W, double *C, size_t rows, size_t ld, size_t nr)
+{
+    const float *w[4];
+    for (size_t j = 0; j < 4; j++)
+        w[j] = W + std::min(j, nr - 1) * ld;
+    __m256 acc[MR][4];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; i++)
+#pragma GCC unroll 4
+        for (size_t j = 0; j < 4; j++)
+            acc[i][j] = _mm256_setzero_ps();
+    for (size_t k = 0; k < ld; k += 8)
+    {
+        __m256 xv[MR];
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; i++)
+            xv[i] = _mm256_load_ps(X + i * ld + k);
+#pragma GCC unroll 4
+        for (size_t j = 0; j < 4; j++)
+        {
+            __m256 wv = _mm256_load_ps(w[j] + k);
+#pragma GCC unroll 4
+            for (size_t i = 0; i < MR; i++)
+                acc[i][j] = _mm256_fmadd_ps(wv, xv[i], acc[i][j]);
+        }
+    }
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; i++)
+    {
+        alignas(32) double sum[4];
+        _mm256_store_pd(sum, _mm256_cvtps_pd(hsum4(acc[i][0], acc[i][1], acc[i][2], acc[i][3])));
+        for (size_t j = 0; j < nr; j++)
+            C[i * rows + j] += sum[j];
+    }
+}
+
+void gemmF32(const float *X, const float *W, double *C, size_t n, size_t rows, size_t ld)
+{
+    // 一块权重行在 L1 内被多批样本复用
+    for (size_t j0 = 0; j0 < rows; j0 += GEMM_NC)
+    {
+        size_t j1 = std::min(rows, j0 + GEMM_NC);
+        size_t i = 0;
+        for (; i + 3 <= n; i += 3)
+            for (size_t j = j0; j < j1; j += 4)
+                gemmF32Micro<3>(X + i * ld, W + j * ld, C + i * rows + j, rows, ld, std::min<size_t>(4, j1 - j));
+        for (; i < n; i++)
+            for (size_t j = j0; j < j1; j += 4)
+                gemmF32Micro<1>(X + i * ld, W + j * ld, C + i * rows + j, rows, ld, std::min<size_t>(4, j1 - j));
+    }
+}
+
+// 有符号 int8 点积：maddubs 只接受 无符号 x 有符号，
+// 把 x 的符号挪到 w 上（|x| * sign(x) * w），|x|、|w| <= 127 时相邻两项之和不会溢出 int16
+template <size_t MR>
+static inline void gemmI8Micro(const int8_t *X, const float *xScale, const int8_t *W, const float *wScale,
+                               double *C, size_t rows, size_t ld, size_t nr)
+{
+    const int8_t *w[4];
+    for (size_t j = 0; j < 4; j++)
+        w[j] = W + std::min(j, nr - 1) * ld;
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc[MR][4];
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; i++)
+#pragma GCC unroll 4
+        for (size_t j = 0; j < 4; j++)
+            acc[i][j] = _mm256_setzero_si256();
+    for (size_t k = 0; k < ld; k += 32)
+    {
+        __m256i xv[MR], xa[MR];
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; i++)
+        {
+            xv[i] = _mm256_load_si256(reinterpret_cast<const __m256i *>(X + i * ld + k));
+            xa[i] = _mm256_abs_epi8(xv[i]);
+        }
+#pragma GCC unroll 4
+        for (size_t j = 0; j < 4; j++)
+        {
+            __m256i wv = _mm256_load_si256(reinterpret_cast<const __m256i *>(w[j] + k));
+#pragma GCC unroll 4
+            for (size_t i = 0; i < MR; i++)
+            {
+                __m256i p16 = _mm256_maddubs_epi16(xa[i], _mm256_sign_epi8(wv, xv[i]));
+                acc[i][j] = _mm256_add_epi32(acc[i][j], _mm256_madd_epi16(p16, ones));
+            }
+        }
+    }
+    alignas(16) float s[4] = {};
+    std::copy(wScale, wScale + nr, s);
+    const __m128 ws = _mm_load_ps(s);
+#pragma GCC unroll 4
+    for (size_t i = 0; i < MR; i++)
+    {
+        __m128 dot = _mm_cvtepi32_ps(hsum4(acc[i][0], acc[i][1], acc[i][2], acc[i][3]));
+        __m128 scaled = _mm_mul_ps(dot, _mm_mul_ps(ws, _mm_set1_ps(xScale[i])));
+        alignas(32) double sum[4];
+        _mm256_store_pd(sum, _mm256_cvtps_pd(scaled));
+        for (size_t j = 0; j < nr; j++)
+            C[i * rows + j] += sum[j];
+    }
+}
+
+void gemmI8(const int8_t *X, const float *xScale, const int8_t *W, const float *wScale,
+            double *C, size_t n, size_t rows, size_t ld)
+{
+    for (size_t j0 = 0; j0 < rows; j0 += GEMM_NC)
+    {
+        size_t j1 = std::min(rows, j0 + GEMM_NC);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            for (size_t j = j0; j < j1; j += 4)
+                gemmI8Micro<2>(X + i * ld, xScale + i, W + j * ld, wScale + j, C + i * rows + j, rows, ld,
+                               std::min<size_t>(4, j1 - j));
+        for (; i < n; i++)
+            for (size_t j = j0; j < j1; j += 4)
+                gemmI8Micro<1>(X + i * ld, xScale + i, W + j * ld, wScale + j, C + i * rows + j, rows, ld,
+                               std::min<size_t>(4, j1 - j));
+    }
+}
+
+void addColumns(const double *W, size_t cols, const size_t *idx, const double *delta, size_t count, double *y, size_t rows)
+{
+    // 一次取四行：四行在同一列上的元素用一条 gather 读进来，变化的各列依次累加
+    const __m256i offsets = _mm256_set_epi64x(3 * cols, 2 * cols, cols, 0);
+    size_t r = 0;
+    for (; r + 4 <= rows; r += 4)
+    {
+        const double *w = W + r * cols;
+        __m256d acc = _mm256_loadu_pd(y + r);
+        for (size_t k = 0; k < count; k++)
+            acc = _mm256_fmadd_pd(_mm256_i64gather_pd(w + idx[k], offsets, 8), _mm256_set1_pd(delta[k]), acc);
+        _mm256_storeu_pd(y + r, acc);
+    }
+    addColumnsScalar(W, cols, idx, delta, count, y, r, rows);
+}
+
+void addColumnsT(const double *WT, size_t ldw, const size_t *idx, const double *delta, size_t count, double *y, size_t rows)
+{
+    size_t r0 = 0;
+    // 16 行一组，y 的这一段留在寄存器里，各列依次累加
+    for (; r0 + 16 <= rows; r0 += 16)
+    {
+        __m256d a0 = _mm256_loadu_pd(y + r0);
+        __m256d a1 = _mm256_loadu_pd(y + r0 + 4);
+        __m256d a2 = _mm256_loadu_pd(y + r0 + 8);
+        __m256d a3 = _mm256_loadu_pd(y + r0 + 12);
+        for (size_t k = 0; k < count; k++)
+        {
+            const double *col = WT + idx[k] * ldw + r0;
+            const __m256d d = _mm256_set1_pd(delta[k]);
+            a0 = _mm256_fmadd_pd(_mm256_loadu_pd(col), d, a0);
+            a1 = _mm256_fmadd_pd(_mm256_loadu_pd(col + 4), d, a1);
+            a2 = _mm256_fmadd_pd(_mm256_loadu_pd(col + 8), d, a2);
+            a3 = _mm256_fmadd_pd(_mm256_loadu_pd(col + 12), d, a3);
+        }
+        _mm256_storeu_pd(y + r0, a0);
+        _mm256_storeu_pd(y + r0 + 4, a1);
+        _mm256_storeu_pd(y + r0 + 8, a2);
+        _mm256_storeu_pd(y + r0 + 12, a3);
+    }
+    addColumnsTScalar(WT, ldw, idx, delta, count, y, r0, rows);
+}
+
+void sumSetColumns(const double *WT, size_t ldw, size_t rows, const uint64_t *bits, size_t words, double *Y, size_t n)
+{
+    // 先把每个样本的置位列号展开，内层循环每次取两列，两组累加器交替相加以错开加法延迟
+    thread_local std::vector<uint32_t> idx;
+    thread_local std::vector<size_t> count;
+    if (idx.size() < n * words * 64)
+        idx.resize(n * words * 64);
+    count.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t *p = idx.data() + i * words * 64;
+        for (size_t wi = 0; wi < words; wi++)
+            for (uint64_t w = bits[i * words + wi]; w; w &= w - 1)
+                p[count[i]++] = uint32_t(wi * 64 + std::countr_zero(w));
+    }
+    // 每次取 SC 行的列段（256 列时 32 KB，留在 L1），整批样本都累加完再换下一段
+    constexpr size_t SC = 16;
+    for (size_t s0 = 0; s0 < rows; s0 += SC)
+    {
+        const size_t s1 = std::min(rows, s0 + SC);
+        for (size_t i = 0; i < n; i++)
+        {
+            const uint32_t *p = idx.data() + i * words * 64;
+            const size_t cnt = count[i];
+            double *y = Y + i * rows;
+            size_t r0 = s0;
+            // 16 行一组，y 的这一段留在寄存器里
+            for (; r0 + 16 <= s1; r0 += 16)
+            {
+                __m256d a0 = _mm256_loadu_pd(y + r0);
+                __m256d a1 = _mm256_loadu_pd(y + r0 + 4);
+                __m256d a2 = _mm256_loadu_pd(y + r0 + 8);
+                __m256d a3 = _mm256_loadu_pd(y + r0 + 12);
+                __m256d b0 = _mm256_setzero_pd();
+                __m256d b1 = _mm256_setzero_pd();
+                __m256d b2 = _mm256_setzero_pd();
+                __m256d b3 = _mm256_setzero_pd();
+                size_t k = 0;
+                for (; k + 2 <= cnt; k += 2)
+                {
+                    const double *ca = WT + size_t(p[k]) * ldw + r0;
+                    const double *cb = WT + size_t(p[k + 1]) * ldw + r0;
+                    a0 = _mm256_add_pd(a0, _mm256_loadu_pd(ca));
+                    a1 = _mm256_add_pd(a1, _mm256_loadu_pd(ca + 4));
+                    a2 = _mm256_add_pd(a2, _mm256_loadu_pd(ca + 8));
+                    a3 = _mm256_add_pd(a3, _mm256_loadu_pd(ca + 12));
+                    b0 = _mm256_add_pd(b0, _mm256_loadu_pd(cb));
+                    b1 = _mm256_add_pd(b1, _mm256_loadu_pd(cb + 4));
+                    b2 = _mm256_add_pd(b2, _mm256_loadu_pd(cb + 8));
+                    b3 = _mm256_add_pd(b3, _mm256_loadu_pd(cb + 12));
+                }
+                if (k < cnt)
+                {
+                    const double *ca = WT + size_t(p[k]) * ldw + r0;
+                    a0 = _mm256_add_pd(a0, _mm256_loadu_pd(ca));
+                    a1 = _mm256_add_pd(a1, _mm256_loadu_pd(ca + 4));
+                    a2 = _mm256_add_pd(a2, _mm256_loadu_pd(ca + 8));
+                    a3 = _mm256_add_pd(a3, _mm256_loadu_pd(ca + 12));
+                }
+                _mm256_storeu_pd(y + r0, _mm256_add_pd(a0, b0));
+                _mm256_storeu_pd(y + r0 + 4, _mm256_add_pd(a1, b1));
+                _mm256_storeu_pd(y + r0 + 8, _mm256_add_pd(a2, b2));
+                _mm256_storeu_pd(y + r0 + 12, _mm256_add_pd(a3, b3));
+            }
+            for (size_t k = 0; r0 < s1 && k < cnt; k++)
+            {
+                const double *col = WT + size_t(p[k]) * ldw;
+                for (size_t r = r0; r < s1; r++)
+                    y[r] += col[r];
+            }
+        }
+    }
+}
+
+// MR 个样本 x NR 行输出的融合微内核：点积跨所有段累加，加上偏置后写回 nr 个输出。
+// 行数不足 NR 时多出的行重复读最后一行，结果丢弃；每段不足 4 列的尾部用掩码加载补零，
+// 不另占累加器。3x4 时正好用满 16 个 ymm 寄存器；单个样本用 1x8，同时读 8 行权重
+template <size_t MR, size_t NR>
+[[gnu::always_inline]] static inline void denseMicro(const DenseSegment *segs, size_t count, const double *bias,
+                                                     double *Y, size_t i0, size_t rows, size_t j, size_t nr)
+{
+    __m256d acc[MR][NR];
+#pragma GCC unroll 8
+    for (size_t i = 0; i < MR; i++)
+#pragma GCC unroll 8
+        for (size_t q = 0; q < NR; q++)
+            acc[i][q] = _mm256_setzero_pd();
+    for (size_t s = 0; s < count; s++)
+    {
+        const DenseSegment &seg = segs[s];
+        const size_t cols = seg.cols;
+        const size_t vecCols = cols & ~size_t(3);
+        const double *w[NR];
+        w[0] = seg.W + j * cols;
+#pragma GCC unroll 8
+        for (size_t q = 1; q < NR; q++)
+            w[q] = q < nr ? w[q - 1] + cols : w[q - 1];
+        const double *X = seg.X + i0 * cols;
+        for (size_t k = 0; k < vecCols; k += 4)
+        {
+            __m256d xv[MR];
+#pragma GCC unroll 4
+            for (size_t i = 0; i < MR; i++)
+                xv[i] = _mm256_loadu_pd(X + i * cols + k);
+#pragma GCC unroll 8
+            for (size_t q = 0; q < NR; q++)
+            {
+                __m256d wv = _mm256_loadu_pd(w[q] + k);
+#pragma GCC unroll 4
+                for (size_t i = 0; i < MR; i++)
+                    acc[i][q] = _mm256_fmadd_pd(wv, xv[i], acc[i][q]);
+            }
+        }
+        if (vecCols < cols)
+        {
+            const __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(int64_t(cols - vecCols)),
+                                                    _mm256_set_epi64x(3, 2, 1, 0));
+            __m256d xv[MR];
+#pragma GCC unroll 4
+            for (size_t i = 0; i < MR; i++)
+                xv[i] = _mm256_maskload_pd(X + i * cols + vecCols, mask);
+#pragma GCC unroll 8
+            for (size_t q = 0; q < NR; q++)
+            {
+                __m256d wv = _mm256_maskload_pd(w[q] + vecCols, mask);
+#pragma GCC unroll 4
+                for (size_t i = 0; i < MR; i++)
+                    acc[i][q] = _mm256_fmadd_pd(wv, xv[i], acc[i][q]);
+            }
+        }
+    }
+#pragma GCC unroll 2
+    for (size_t g = 0; g < NR; g += 4)
+    {
+        if (g >= nr)
+            break;
+        const size_t m = std::min<size_t>(4, nr - g);
+        __m256d bv;
+        if (m == 4)
+        {
+            bv = _mm256_loadu_pd(bias + j + g);
+        }
+        else
+        {
+            alignas(32) double b[4] = {};
+            std::copy(bias + j + g, bias + j + g + m, b);
+            bv = _mm256_load_pd(b);
+        }
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; i++)
+        {
+            __m256d z = _mm256_add_pd(hsum4(acc[i][g], acc[i][g + 1], acc[i][g + 2], acc[i][g + 3]), bv);
+            double *y = Y + (i0 + i) * rows + j + g;
+            if (m == 4)
+            {
+                _mm256_storeu_pd(y, z);
+            }
+            else
+            {
+                alignas(32) double out[4];
+                _mm256_store_pd(out, z);
+                std::copy(out, out + m, y);
+            }
+        }
+    }
+}
+
+template <size_t MR, size_t NR>
+static inline void densePanel(const DenseSegment *segs, size_t count, const double *bias, Activation act, double *Y,
+                              size_t i0, size_t rows, size_t j0, size_t j1)
+{
+    size_t j = j0;
+    for (; j + 4 < j1; j += NR)
+        denseMicro<MR, NR>(segs, count, bias, Y, i0, rows, j, std::min<size_t>(NR, j1 - j));
+    // 剩下不超过 4 行时不再按 NR 行重复计算
+    if (j < j1)
+        denseMicro<MR, 4>(segs, count, bias, Y, i0, rows, j, j1 - j);
+    // 刚写出的这一块还在 L1 里，原地激活；放进微内核会挤占累加器的寄存器，且每块的延迟无法掩盖
+    if (act == Activation::Linear)
+        return;
+    double *y = Y + i0 * rows + j0;
+    // 行块覆盖整行时 MR 行是连续的一段，一次处理
+    if (j1 - j0 == rows)
+        return activate(act, y, y, MR, rows);
+    for (size_t i = 0; i < MR; i++)
+        activate(act, y + i * rows, y + i * rows, 1, j1 - j0);
+}
+
+void denseFused(const DenseSegment *segs, size_t count, Activation act, double *Y, size_t n, size_t rows)
+{
+    // 不再按 K 分块（激活要等点积全部累加完），改为按拼接后的总输入长度缩小行块，
+    // 使一块权重行（约 256 KB）留在 L2 里被整批样本复用
+    size_t k = 0;
+    for (size_t s = 0; s < count; s++)
+        k += segs[s].cols;
+    const size_t nc = std::clamp<size_t>((32768 / std::max<size_t>(k, 1)) & ~size_t(3), 4, GEMM_NC);
+    // 多段时偏置先合成一份
+    const double *bias = segs[0].bias;
+    thread_local std::vector<double> biasSum;
+    if (count > 1)
+    {
+        biasSum.assign(bias, bias + rows);
+        for (size_t s = 1; s < count; s++)
+            for (size_t r = 0; r < rows; r++)
+                biasSum[r] += segs[s].bias[r];
+        bias = biasSum.data();
+    }
+    // 整个输出不超过 32 KB 时留在 L1 里，最后一次激活，避免小块激活的调用和延迟开销；
+    // softmax 按行归一化也要等整行算完
+    const Activation panelAct = act == Activation::Softmax || n * rows <= 4096 ? Activation::Linear : act;
+    for (size_t j0 = 0; j0 < rows; j0 += nc)
+    {
+        const size_t j1 = std::min(rows, j0 + nc);
+        size_t i = 0;
+        for (; i + 3 <= n; i += 3)
+            densePanel<3, 4>(segs, count, bias, panelAct, Y, i, rows, j0, j1);
+        for (; i < n; i++)
+            densePanel<1, 8>(segs, count, bias, panelAct, Y, i, rows, j0, j1);
+    }
+    if (panelAct != act)
+        activate(act, Y, Y, n, rows);
+}
+
+// MR 个样本共用一次下标和权重的加载：每次取一行的 4 个非零元，按下标从各样本的输入里 gather
+template <size_t MR>
+static inline void spmmRows(const uint32_t *rowPtr, const uint32_t *colIdx, const double *values, const double *X,
+                            double *Y, size_t rows, size_t cols)
+{
+    // 带掩码的 gather 显式给出源操作数；不带掩码的版本在 GCC 里展开时会报 -Wmaybe-uninitialized
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    for (size_t r = 0; r < rows; r++)
+    {
+        const uint32_t b = rowPtr[r], e = rowPtr[r + 1];
+        __m256d acc[MR];
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; i++)
+            acc[i] = _mm256_setzero_pd();
+        uint32_t k = b;
+        for (; k + 4 <= e; k += 4)
+        {
+            const __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(colIdx + k));
+            const __m256d v = _mm256_loadu_pd(values + k);
+#pragma GCC unroll 4
+            for (size_t i = 0; i < MR; i++)
+                acc[i] = _mm256_fmadd_pd(v, _mm256_mask_i32gather_pd(_mm256_setzero_pd(), X + i * cols, idx, all, 8), acc[i]);
+        }
+#pragma GCC unroll 4
+        for (size_t i = 0; i < MR; i++)
+        {
+            double sum = hsum(acc[i]);
+            for (uint32_t t = k; t < e; t++)
+                sum += values[t] * X[i * cols + colIdx[t]];
+            Y[i * rows + r] += sum;
+        }
+    }
+}
+
+void spmm(const uint32_t *rowPtr, const uint32_t *colIdx, const double *values, const double *X, double *Y,
+          size_t n, size_t rows, size_t cols)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        spmmRows<4>(rowPtr, colIdx, values, X + i * cols, Y + i * rows, rows, cols);
+    for (; i < n; i++)
+        spmmRows<1>(rowPtr, colIdx, values, X + i * cols, Y + i * rows, rows, cols);
+}
+
+#else
+
+void spmm(const uint32_t *rowPtr, const uint32_t *colIdx, const double *values, const double *X, double *Y,
+          size_t n, size_t rows, size_t cols)
+{
+    spmmScalar(rowPtr, colIdx, values, X, Y, n, rows, cols);
+}
+
+void denseFused(const DenseSegment *segs, size_t count, Activation act, double *Y, size_t n, size_t rows)
+{
+    denseFusedScalar(segs, count, act, Y, n, rows);
+}
+
+void sumSetColumns(const double *WT, size_t ldw, size_t rows, const uint64_t *bits, size_t words, double *Y, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        sumSetColumnsScalar(WT, ldw, bits + i * words, words, Y + i * rows, 0, rows);
+}
+
+void gemmF32(const float *X, const float *W, double *C, size_t n, size_t rows, size_t ld)
+{
+    gemmF32Scalar(X, W, C, n, rows, ld);
+}
+
+void gemmI8(const int8_t *X, const float *xScale, const int8_t *W, const float *wScale,
+            double *C, size_t n, size_t rows, size_t ld)
+{
+    gemmI8Scalar(X, xScale, W, wScale, C, n, rows, ld);
+}
+
+void addColumns(const double *W, size_t cols, const size_t *idx, const double *delta, size_t count, double *y, size_t rows)
+{
+    addColumnsScalar(W, cols, idx, delta, count, y, 0, rows);
+}
+
+void addColumnsT(const double *WT, size_t ldw, const size_t *idx, const double *delta, size_t count, double *y, size_t rows)
+{
+    addColumnsTScalar(WT, ldw, idx, delta, count, y, 0, rows);
+}
+
+static inline void axpyPanel(const double *a, size_t aStride, const double *B, size_t ldb,
+                             double *c, size_t m, size_t p)
+{
+    axpyPanelScalar(a, aStride, B, ldb, c, m, p);
+}
+
+void gemv(const double *W, const double *x, double *y, size_t rows, size_t cols)
+{
+    gemvScalar(W, x, y, rows, cols);
+}
+
+void gemm(const double *X, const double *W, double *C, size_t n, size_t rows, size_t cols)
+{
+    gemmScalar(X, W, C, n, rows, cols);
+}
+
+#endif
+
+void gemmNN(const double *A, const double *B, double *C, size_t n, size_t k, size_t m)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        axpyPanel(A + i * k, 1, B, m, C + i * m, m, k);
+    }
+}
+
+void gemmTN(const double *A, const double *B, double *C, size_t n, size_t rows, size_t cols)
+{
+    for (size_t r = 0; r < rows; r++)
+    {
+        axpyPanel(A + r, rows, B, cols, C + r * cols, cols, n);
+    }
+}
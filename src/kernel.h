@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "activation.h"
+
+// y += W * x，W 为行主序 rows x cols
+void gemv(const double *W, const double *x, double *y, size_t rows, size_t cols);
+
+// 无 SIMD 的参考实现，也是不支持 AVX2/FMA 时的回退路径
+void gemvScalar(const double *W, const double *x, double *y, size_t rows, size_t cols);
+
+// C += X * W^T，X 为 n x cols，W 为 rows x cols，C 为 n x rows，均为行主序
+void gemm(const double *X, const double *W, double *C, size_t n, size_t rows, size_t cols);
+
+void gemmScalar(const double *X, const double *W, double *C, size_t n, size_t rows, size_t cols);
+
+// C += A * B，A 为 n x k，B 为 k x m，C 为 n x m（反向传播求上一层梯度）
+void gemmNN(const double *A, const double *B, double *C, size_t n, size_t k, size_t m);
+
+// C += A^T * B，A 为 n x rows，B 为 n x cols，C 为 rows x cols（累加权重梯度）
+void gemmTN(const double *A, const double *B, double *C, size_t n, size_t rows, size_t cols);
+
+// 低精度推理内核：X 为 n 行、W 为 rows 行，每行都按 ld 个元素存放（ld 为 32 的倍数，行尾补零），
+// 结果换算成 double 累加进 n x rows 的 C
+void gemmF32(const float *X, const float *W, double *C, size_t n, size_t rows, size_t ld);
+
+void gemmF32Scalar(const float *X, const float *W, double *C, size_t n, size_t rows, size_t ld);
+
+// C[i][j] += xScale[i] * wScale[j] * dot(X[i], W[j])，X、W 为对称量化到 [-127, 127] 的 int8
+void gemmI8(const int8_t *X, const float *xScale, const int8_t *W, const float *wScale,
+            double *C, size_t n, size_t rows, size_t ld);
+
+void gemmI8Scalar(const int8_t *X, const float *xScale, const int8_t *W, const float *wScale,
+                  double *C, size_t n, size_t rows, size_t ld);
+
+// 对 n 个样本：Y[i][0, rows) += WT 中 bits[i] 置位的那些列之和。WT 按列存放权重，第 c 列从 WT + c * ldw 开始，
+// ldw >= rows，取 2 的幂时各列会落进同一组缓存行，应错开；每个样本的位图为 words 个 64 位字，第 c 位对应第 c 列；
+// Y 为 n x rows
+void sumSetColumns(const double *WT, size_t ldw, size_t rows, const uint64_t *bits, size_t words, double *Y, size_t n);
+
+// 输入只有少数几个分量变了时更新 y = W x：y[0, rows) += sum_k delta[k] * W 的第 idx[k] 列。
+// W 为行主序 rows x cols，按列读是跨行的
+void addColumns(const double *W, size_t cols, const size_t *idx, const double *delta, size_t count, double *y, size_t rows);
+
+// 同上，WT 按列存放，第 c 列从 WT + c * ldw 开始（与 sumSetColumns 相同）
+void addColumnsT(const double *WT, size_t ldw, const size_t *idx, const double *delta, size_t count, double *y, size_t rows);
+
+// 稠密层的一条入链接：W 为 rows x cols 的行主序权重，bias 为 rows 个偏置，X 为 n x cols 的输入
+struct DenseSegment
+{
+    const double *W;
+    const double *bias;
+    const double *X;
+    size_t cols;
+};
+
+// Y = act(sum_s (X_s * W_s^T + bias_s))，Y 为 n x rows。各段权重沿输入方向视作拼成的一个更宽的矩阵，
+// 点积在寄存器里跨段累加，加偏置、激活后每个输出只写一次
+void denseFused(const DenseSegment *segs, size_t count, Activation act, double *Y, size_t n, size_t rows);
+
+void denseFusedScalar(const DenseSegment *segs, size_t count, Activation act, double *Y, size_t n, size_t rows);
+
+// Y += X * A^T，A 为 rows x cols 的 CSR 稀疏矩阵：第 r 行的非零元为 colIdx/values 的 [rowPtr[r], rowPtr[r + 1])。
+// X 为 n x cols，Y 为 n x rows
+void spmm(const uint32_t *rowPtr, const uint32_t *colIdx, const double *values, const double *X, double *Y,
+          size_t n, size_t rows, size_t cols);
+
+void spmmScalar(const uint32_t *rowPtr, const uint32_t *colIdx, const double *values, const double *X, double *Y,
+                size_t n, size_t rows, size_t cols);
@@ -1,6 +1,169 @@
-
 #include "test.h"
-int main()
+#include "bench.h"
+#include "net.h"
+#include "server.h"
+#include "sweep.h"
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
+// 载入模型后按行服务：给了端口时监听 127.0.0.1:port，否则从标准输入读请求、向标准输出写应答；结束时把统计写到标准错误
+static int serve(const std::string &modelPath, int port, const ServerOptions &options)
+{
+    std::unique_ptr<Network> net;
+    try
+    {
+        net = std::make_unique<Network>(modelPath);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    BatchingServer server(*net, options);
+    if (port < 0)
+    {
+        serveLines(server, [](std::string &line)
+                   { return bool(std::getline(std::cin, line)); },
+                   [](const std::string &line)
+                   { return bool(std::cout << line << std::endl); },
+                   options.maxBatch * 2);
+    }
+    else
+    {
+        TcpServer tcp(server);
+        if (!tcp.listen(uint16_t(port)))
+            return 1;
+        std::cerr << "listening on 127.0.0.1:" << tcp.port() << std::endl;
+        tcp.run();
+    }
+    ServerStats s = server.stats();
+    std::cerr << "requests: " << s.requests << ", batches: " << s.batches << ", mean batch: " << s.meanBatch
+              << ", qps: " << s.qps << ", p50: " << s.p50 << " us, p99: " << s.p99 << " us" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
 {
+    std::string mode = argc > 1 ? argv[1] : "";
+    // main convert <in.csv> <out.nlds> <featureSize> <labelSize> [f64|u8|bit]
+    if (mode == "convert" && argc >= 6)
+    {
+        std::string type = argc > 6 ? argv[6] : "f64";
+        SampleType featureType = type == "bit" ? SampleType::Bit : type == "u8" ? SampleType::U8 : SampleType::F64;
+        return convertSamples(argv[2], argv[3], std::stoul(argv[4]), std::stoul(argv[5]), featureType) ? 0 : 1;
+    }
+    // main suite <out.json> [baseline.json] [threshold]，有回归时返回 1
+    if (mode == "suite" && argc >= 3)
+        return benchSuite(argv[2], argc > 3 ? argv[3] : "", argc > 4 ? std::stod(argv[4]) : 0.1) ? 0 : 1;
+    // main serve <model.nll> [port|-] [maxBatch] [maxDelayUs]
+    if (mode == "serve" && argc >= 3)
+    {
+        ServerOptions options;
+        if (argc > 4)
+            options.maxBatch = std::stoul(argv[4]);
+        if (argc > 5)
+            options.maxDelay = std::chrono::microseconds(std::stol(argv[5]));
+        const std::string port = argc > 3 ? argv[3] : "-";
+        return serve(argv[2], port == "-" ? -1 : std::stoi(port), options);
+    }
+    // main loadgen <port> [connections] [requests] [pipeline] [samples.csv]
+    if (mode == "loadgen" && argc >= 3)
+    {
+        SampleSet samples(256, 10);
+        if (!loadSamples(argc > 6 ? argv[6] : "../data/test.csv", samples))
+            return 1;
+        LoadgenResult r = runLoadgen(uint16_t(std::stoi(argv[2])), samples, argc > 3 ? std::stoul(argv[3]) : 8,
+                                     argc > 4 ? std::stoul(argv[4]) : 1000, argc > 5 ? std::stoul(argv[5]) : 1);
+        std::cout << "requests: " << r.requests << ", errors: " << r.errors << ", qps: " << r.qps << ", p50: " << r.p50
+                  << " us, p99: " << r.p99 << " us, max: " << r.max << " us, accuracy: " << r.accuracy << std::endl;
+        std::cout << "server: " << r.serverStats << std::endl;
+        return r.errors ? 1 : 0;
+    }
+    // main sweep [table.csv] [best.nll] [threads] [maxEpochs] [validation.csv]：在 train.csv 上训练默认网格，按验证集准确率排名，
+    // 没给验证文件时从 train.csv 里随机留出 20% 作验证集。test.csv 不参与选择，只报告选中模型的准确率
+    if (mode == "sweep")
+    {
+        SampleSet samples(256, 10), trainSet(256, 10), validationSet(256, 10), testSet(256, 10);
+        if (!loadSamples("../data/train.csv", samples) || !loadSamples("../data/test.csv", testSet))
+            return 1;
+        const SampleSet *train = &trainSet;
+        if (argc > 6)
+        {
+            if (!loadSamples(argv[6], validationSet))
+                return 1;
+            train = &samples;
+        }
+        else if (!splitValidation(samples, 0.2, 1, trainSet, validationSet))
+            return 1;
+        SweepOptions options;
+        options.bestModelPath = argc > 3 ? argv[3] : "sweep_best.nll";
+        if (argc > 4)
+            options.threads = std::stoul(argv[4]);
+        if (argc > 5)
+            options.maxEpochs = std::stoul(argv[5]);
+        std::vector<SweepResult> results = runSweep(*train, validationSet, defaultSweepGrid(), options);
+        printSweepTable(results);
+        if (results.empty() || !results[0].ok)
+            return 1;
+        try
+        {
+            const double testAccuracy = Network(options.bestModelPath).accuracy(testSet);
+            std::cout << "best " << results[0].config.name() << ": validation accuracy " << results[0].bestAccuracy
+                      << ", test accuracy " << testAccuracy << ", saved to " << options.bestModelPath << std::endl;
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cout << e.what() << std::endl;
+            return 1;
+        }
+        return saveSweepTable(argc > 2 ? argv[2] : "sweep.csv", results) ? 0 : 1;
+    }
+    if (mode == "bench")
+    {
+        benchPredict();
+        benchPredictBatch();
+        benchCompile();
+        benchTrain();
+        benchTrainScaling();
+        benchConcurrentPredict();
+        benchSampleStorage();
+        benchLoadSamples();
+        benchBinarySamples();
+        benchModelLoad();
+        benchPrecision();
+        benchBinaryInput();
+        benchActivation();
+        benchFusion();
+        benchSparse();
+        benchConv();
+        benchPrefetch();
+        benchServer();
+        benchPredictInto();
+        benchStaticNetwork();
+        benchIncrementalPredict();
+        benchSweep();
+        return 0;
+    }
     testPredict();
+    testPredictBatch();
+    testTrain();
+    testConcurrentPredict();
+    testBinarySamples();
+    testSavingModel();
+    testPrecision();
+    testBinaryInput();
+    testActivation();
+    testFusion();
+    testSparseLink();
+    testGrowLink();
+    testConvLink();
+    testProfile();
+    testPrefetch();
+    testStreaming();
+    testServer();
+    testAllocations();
+    testStaticNetwork();
+    testIncrementalPredict();
+    testSweep();
 }
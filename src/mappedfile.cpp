@@ -0,0 +1,116 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if (m_data)
+        munmap(m_data, m_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool MappedFile::open(const std::string &path, bool copyOnWrite)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+    m_file = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        close();
+        return 0;
+    }
+    m_size = size_t(size.QuadPart);
+    if (m_size == 0)
+        return 1;
+    m_mapping = CreateFileMappingA(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        close();
+        return 0;
+    }
+    m_data = static_cast<char *>(MapViewOfFile(m_mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+        close();
+        return 0;
+    }
+#else
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        close();
+        return 0;
+    }
+    m_size = size_t(st.st_size);
+    if (m_size == 0)
+        return 1;
+    void *p = mmap(nullptr, m_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (p == MAP_FAILED)
+    {
+        m_data = nullptr;
+        close();
+        return 0;
+    }
+    m_data = static_cast<char *>(p);
+#endif
+    return 1;
+}
+
+bool MappedFile::isOpen() const
+{
+#ifdef _WIN32
+    return m_file != nullptr;
+#else
+    return m_fd >= 0;
+#endif
+}
+
+char *MappedFile::data()
+{
+    return m_data;
+}
+
+const char *MappedFile::data() const
+{
+    return m_data;
+}
+
+size_t MappedFile::size() const
+{
+    return m_size;
+}
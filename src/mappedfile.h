@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// 只读（或写时复制）映射整个文件，析构时解除映射
+class MappedFile
+{
+    char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+    void close();
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    // copyOnWrite 为真时映射页可写，修改只对本进程可见，不会写回文件
+    bool open(const std::string &path, bool copyOnWrite = 0);
+    bool isOpen() const;
+    char *data();
+    const char *data() const;
+    size_t size() const;
+};
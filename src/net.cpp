@@ -1,9 +1,33 @@
 #include "net.h"
+#include "prefetch.h"
+#include "kernel.h"
+#include "threadpool.h"
+#include "mappedfile.h"
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <numeric>
+#include <cmath>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+SampleSet::Permutation::Permutation(const SampleSet &set, std::span<const size_t> order) : m_set(&set), m_order(order)
+{
+}
+
+size_t SampleSet::Permutation::size() const
+{
+    return m_order.size();
+}
+
+SampleView SampleSet::Permutation::operator[](size_t i) const
+{
+    return m_set->at(m_order[i]);
+}
 
 SampleSet::SampleSet(size_t featureSize_, size_t labelSize_) : featureSize(featureSize_), labelSize(labelSize_)
 {
@@ -11,24 +35,47 @@ SampleSet::SampleSet(size_t featureSize_, size_t labelSize_) : featureSize(featu
 
 SampleSet::SampleSet(size_t featureSize_, size_t labelSize_, size_t sampleSize) : featureSize(featureSize_), labelSize(labelSize_)
 {
-    samples.resize(sampleSize);
+    resize(sampleSize);
+}
+
+void SampleSet::detach()
+{
+    if (!m_mapping)
+        return;
+    m_features.assign(m_featureView, m_featureView + m_size * featureSize);
+    m_labels.assign(m_labelView, m_labelView + m_size * labelSize);
+    m_mapping.reset();
+    m_featureView = m_labelView = nullptr;
 }
 
 void SampleSet::resize(size_t size)
 {
-    samples.resize(size);
+    detach();
+    m_bits.clear();
+    m_features.resize(size * featureSize);
+    m_labels.resize(size * labelSize);
+    m_size = size;
 }
 
-size_t SampleSet::size()
+size_t SampleSet::size() const
 {
-    return samples.size();
+    return m_size;
 }
 
-bool SampleSet::push_back(Sample sample_)
+bool SampleSet::push_back(const Sample &sample_)
 {
-    if (sample_.features.size() == featureSize && sample_.labels.size() == labelSize)
+    return push_back(sample_.features, sample_.labels);
+}
+
+bool SampleSet::push_back(std::span<const double> features, std::span<const double> labels)
+{
+    if (features.size() == featureSize && labels.size() == labelSize)
     {
-        samples.push_back(sample_);
+        detach();
+        m_bits.clear();
+        m_features.insert(m_features.end(), features.begin(), features.end());
+        m_labels.insert(m_labels.end(), labels.begin(), labels.end());
+        m_size++;
         return 1;
     }
     else
@@ -40,27 +87,119 @@ bool SampleSet::push_back(Sample sample_)
 
 void SampleSet::clear()
 {
-    samples.clear();
+    m_mapping.reset();
+    m_featureView = m_labelView = nullptr;
+    m_bits.clear();
+    m_features.clear();
+    m_labels.clear();
+    m_size = 0;
 }
 
 void SampleSet::reserve(size_t size)
 {
-    samples.reserve(size);
+    detach();
+    m_features.reserve(size * featureSize);
+    m_labels.reserve(size * labelSize);
 }
 
-const Sample SampleSet::at(size_t size)
+SampleView SampleSet::at(size_t size) const
 {
-    if (size >= samples.size())
+    if (size >= m_size)
     {
-        std::cout << "Sample.at Error: " << "out of limit size: " << samples.size();
-        return Sample();
+        std::cout << "Sample.at Error: " << "out of limit size: " << m_size;
+        return SampleView();
+    }
+    return {std::span<const double>(featureData() + size * featureSize, featureSize),
+            std::span<const double>(labelData() + size * labelSize, labelSize)};
+}
+
+SampleBatch SampleSet::batch(size_t begin, size_t count) const
+{
+    if (begin >= m_size)
+        return SampleBatch();
+    count = std::min(count, m_size - begin);
+    return {std::span<const double>(featureData() + begin * featureSize, count * featureSize),
+            std::span<const double>(labelData() + begin * labelSize, count * labelSize), count};
+}
+
+SampleSet::Permutation SampleSet::permute(std::span<const size_t> order) const
+{
+    return Permutation(*this, order);
+}
+
+const double *SampleSet::featureData() const
+{
+    return m_mapping ? m_featureView : m_features.data();
+}
+
+const double *SampleSet::labelData() const
+{
+    return m_mapping ? m_labelView : m_labels.data();
+}
+
+double *SampleSet::featureData()
+{
+    detach();
+    m_bits.clear();
+    return m_features.data();
+}
+
+bool packBits(const double *x, size_t n, size_t cols, uint64_t *bits)
+{
+    const size_t words = (cols + 63) / 64;
+    for (size_t i = 0; i < n; i++)
+    {
+        const double *row = x + i * cols;
+        uint64_t *b = bits + i * words;
+        std::fill(b, b + words, 0);
+        for (size_t c = 0; c < cols; c++)
+        {
+            if (row[c] == 1)
+                b[c / 64] |= uint64_t(1) << (c % 64);
+            else if (row[c] != 0)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+bool SampleSet::packFeatureBits()
+{
+    m_bits.resize(m_size * bitWords());
+    if (!packBits(std::as_const(*this).featureData(), m_size, featureSize, m_bits.data()))
+    {
+        m_bits.clear();
+        return 0;
     }
-    return samples.at(size);
+    return 1;
+}
+
+const uint64_t *SampleSet::featureBits() const
+{
+    return m_bits.empty() ? nullptr : m_bits.data();
+}
+
+size_t SampleSet::bitWords() const
+{
+    return (featureSize + 63) / 64;
+}
+
+double *SampleSet::labelData()
+{
+    detach();
+    return m_labels.data();
 }
 
-std::vector<Sample> SampleSet::getSamples()
+std::vector<Sample> SampleSet::getSamples() const
 {
-    return samples;
+    std::vector<Sample> rtr(m_size);
+    for (size_t i = 0; i < m_size; i++)
+    {
+        SampleView v = at(i);
+        rtr[i].features.assign(v.features.begin(), v.features.end());
+        rtr[i].labels.assign(v.labels.begin(), v.labels.end());
+    }
+    return rtr;
 }
 
 void Network::Layer::initStrides()
@@ -80,20 +219,30 @@ Network::Layer::Layer(std::vector<size_t> shape, std::string activate) : m_activ
     initStrides();
     size_t nr_sz = std::accumulate(m_shape.begin(), m_shape.end(), 1ULL, [](size_t a, size_t b)
                                    { return a * b; });
-    m_neurons.resize(nr_sz);
+    m_size = nr_sz;
 }
 
-const size_t &Network::Layer::size()
+size_t Network::Layer::size() const
 {
-    return m_neurons.size();
+    return m_size;
 }
 
-const std::vector<size_t> &Network::Layer::shape()
+const std::vector<size_t> &Network::Layer::shape() const
 {
     return m_shape;
 }
 
-Network::Link::Link(size_t source, size_t target) : m_source(source), m_target(target)
+const std::vector<size_t> &Network::Layer::strides() const
+{
+    return m_strides;
+}
+
+const std::string &Network::Layer::activate() const
+{
+    return m_activate;
+}
+
+Network::Link::Link(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target) : m_source(source), m_target(target)
 {
 }
 
@@ -105,467 +254,3206 @@ void Network::Link::initSynapses()
 {
 }
 
-const size_t &Network::Link::source()
+const std::shared_ptr<Network::Layer> &Network::Link::source() const
 {
     return m_source;
 }
 
-const size_t &Network::Link::target()
+const std::shared_ptr<Network::Layer> &Network::Link::target() const
 {
     return m_target;
 }
 
-Network::DenseLink::DenseLink(size_t source, size_t target) : Link(source, target)
+// 参数版本的全局计数，网络和链接共用，编号越大改动越晚
+static uint64_t nextParameterVersion()
 {
-    initSynapses();
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
 }
 
-void Network::DenseLink::initSynapses()
+void Network::Link::touchParameters()
+{
+    m_paramVersion = nextParameterVersion();
+}
+
+bool Network::Link::addSynapse(size_t fromIdx, size_t toIdx, double weight)
 {
-    size_t sy_sz = m_layers.at
-                       m_synapses.resize(sy_sz);
-    for (size_t j = 0; j < targetLayer->size(); j++)
+    touchParameters();
+    if (fromIdx >= m_source->size() || toIdx >= m_target->size())
     {
-        for (size_t i = 0; i < sourceLayer->size(); i++)
-        {
-            m_synapses.at(j * sourceLayer->size() + i).fromIdx = i;
-            m_synapses.at(j * sourceLayer->size() + i).toIdx = j;
-        }
+        std::cout << "addSynapse Error: index out of layer size" << std::endl;
+        return 0;
     }
+    m_synapses.push_back({fromIdx, toIdx});
+    m_weights.push_back(weight);
+    return 1;
 }
 
-void Network::DenseLink::normalInitSynapses()
+void Network::Link::normalInitSynapses(std::optional<unsigned> seed)
 {
-    normalInitSynapses(m_synapses);
+    touchParameters();
+    static std::random_device rd;
+    static std::mt19937 shared(rd());
+    std::mt19937 seeded(seed.value_or(0));
+    std::mt19937 &gen = seed ? seeded : shared;
+    std::normal_distribution<double> dist(0.0, 1.0);
+
+    for (auto &w : m_weights)
+    { // ✅ 引用！
+        w = dist(gen);
+    }
 }
 
-void Network::DenseLink::valueInitSynapses(double value)
+void Network::Link::valueInitSynapses(double value)
 {
-    ::valueInitSynapses(m_synapses, value);
+    touchParameters();
+    std::fill(m_weights.begin(), m_weights.end(), value);
 }
 
-Network::Network(std::shared_ptr<Layer> input, std::shared_ptr<Layer> output)
+void Network::Link::forward(const double *in, double *out) const
 {
-    layers.resize(2);
-    layers.at(0) = input;
-    layers.at(1) = output;
+    for (size_t k = 0; k < m_synapses.size(); k++)
+    {
+        out[m_synapses[k].toIdx] += in[m_synapses[k].fromIdx] * m_weights[k];
+    }
 }
 
-bool Network::addLayer(std::shared_ptr<Layer> layer)
+void Network::Link::forwardBatch(const double *in, double *out, size_t n) const
 {
-    auto it = std::find(layers.begin(), layers.end(), layer);
-    if (it != layers.end())
+    for (size_t i = 0; i < n; i++)
     {
-        std::cout << "Repeatedly adding the same element" << std::endl;
-        return 0;
+        forward(in + i * m_source->size(), out + i * m_target->size());
     }
-    it = layers.end() - 1;
-    layers.insert(it, layer);
-    return 1;
 }
 
-bool Network::addLink(std::shared_ptr<Link> link)
+void Network::Link::backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const
 {
-    auto it = std::find(links.begin(), links.end(), link);
-    if (it != links.end())
+    const size_t src = m_source->size();
+    const size_t tgt = m_target->size();
+    for (size_t i = 0; i < n; i++)
     {
-        std::cout << "Repeatedly adding the same element" << std::endl;
-        return 0;
+        for (size_t k = 0; k < m_synapses.size(); k++)
+        {
+            const Synapse &s = m_synapses[k];
+            const double d = dOut[i * tgt + s.toIdx];
+            grad[k] += d * in[i * src + s.fromIdx];
+            if (dIn)
+                dIn[i * src + s.fromIdx] += d * m_weights[k];
+        }
     }
-    auto sourceIt = std::find(layers.begin(), layers.end(), link->source());
-    auto targetIt = std::find(layers.begin(), layers.end(), link->target());
-    if (sourceIt == layers.end() || targetIt == layers.end())
-    {
-        std::cout << "linking layer not obtained" << std::endl;
+}
+
+bool Network::Link::bindParameters(std::shared_ptr<AlignedVector<double>>, double *)
+{
+    return 0;
+}
+
+std::span<double> Network::Link::parameters()
+{
+    touchParameters();
+    return std::span<double>(m_weights.data(), m_weights.size());
+}
+
+size_t Network::Link::paramCount() const
+{
+    return m_synapses.size();
+}
+
+double Network::Link::flopsPerSample() const
+{
+    return 2.0 * m_synapses.size();
+}
+
+std::string Network::Link::type() const
+{
+    return "Synapse";
+}
+
+void Network::Link::setPrecision(Precision)
+{
+}
+
+void Network::Link::setBinaryInput(bool)
+{
+}
+
+bool Network::Link::forwardBits(const uint64_t *, size_t, double *, size_t) const
+{
+    return 0;
+}
+
+Network::DenseLink::DenseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target) : Link(source, target)
+{
+    initSynapses();
+}
+
+Network::DenseLink::DenseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::shared_ptr<MappedFile> mapping, double *params)
+    : Link(source, target), m_mapping(std::move(mapping)), m_rows(target->size()), m_cols(source->size())
+{
+    m_weights = params;
+    m_bias = params + storageSize(m_rows, m_cols) - m_rows;
+}
+
+size_t Network::DenseLink::storageSize(size_t rows, size_t cols)
+{
+    // 偏置段起点向上取整到 8 个 double（64 字节）
+    return ((rows * cols + 7) & ~size_t(7)) + rows;
+}
+
+void Network::DenseLink::initSynapses()
+{
+    m_rows = m_target->size();
+    m_cols = m_source->size();
+    m_block.reset();
+    m_storage.assign(storageSize(m_rows, m_cols), 0.0);
+    m_weights = m_storage.data();
+    m_bias = m_storage.data() + m_storage.size() - m_rows;
+}
+
+bool Network::DenseLink::bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params)
+{
+    if (m_mapping)
         return 0;
-    }
-    links.push_back(link);
+    std::span<double> p = parameters();
+    std::copy(p.begin(), p.end(), params);
+    m_weights = params;
+    m_bias = params + p.size() - m_rows;
+    m_storage = AlignedVector<double>();
+    m_block = std::move(block);
     return 1;
 }
 
-void Network::updateForwardCache()
+void Network::DenseLink::normalInitSynapses(std::optional<unsigned> seed)
 {
-    std::unordered_map<std::shared_ptr<Layer>, size_t> layersIndex;
-    for (size_t i = 0; i < layers.size(); i++)
-    {
-        layersIndex.insert({layers.at(i), i});
-    }
-    forwardCache.resize(layers.size());
-    for (const auto &l : links)
+    touchParameters();
+    static std::random_device rd;
+    static std::mt19937 shared(rd());
+    std::mt19937 seeded(seed.value_or(0));
+    std::mt19937 &gen = seed ? seeded : shared;
+    // 按扇入缩放，避免宽输入层把 sigmoid 推进饱和区
+    std::normal_distribution<double> dist(0.0, 1.0 / std::sqrt(double(std::max<size_t>(m_cols, 1))));
+
+    for (size_t i = 0; i < m_rows * m_cols; i++)
     {
-        auto it = layersIndex.find(l->source());
-        size_t idx = it->second;
-        forwardCache.at(idx).push_back(l);
+        m_weights[i] = dist(gen);
     }
 }
 
-void Network::updateBackwardCache()
+void Network::DenseLink::valueInitSynapses(double value)
 {
-    std::unordered_map<std::shared_ptr<Layer>, size_t> layersIndex;
-    for (size_t i = 0; i < layers.size(); i++)
-    {
-        layersIndex.insert({layers.at(i), i});
-    }
-    backwardCache.resize(layers.size());
-    for (const auto &l : links)
+    touchParameters();
+    std::fill(m_weights, m_weights + m_rows * m_cols, value);
+}
+
+void Network::DenseLink::forward(const double *in, double *out) const
+{
+    if (m_precision != Precision::Double)
+        return forwardBatch(in, out, 1);
+    for (size_t j = 0; j < m_rows; j++)
     {
-        auto it = layersIndex.find(l->target());
-        size_t idx = it->second;
-        backwardCache.at(idx).push_back(l);
+        out[j] += m_bias[j];
     }
+    gemv(m_weights, in, out, m_rows, m_cols);
 }
 
-Sample Network::predict(const Sample &sample)
+void Network::DenseLink::forwardBatch(const double *in, double *out, size_t n) const
 {
-    if (sample.features.size() != layers.front()->size())
+    for (size_t i = 0; i < n; i++)
     {
-        std::cout << "predict Error: size don't match" << std::endl;
-        return Sample();
+        double *o = out + i * m_rows;
+        for (size_t j = 0; j < m_rows; j++)
+        {
+            o[j] += m_bias[j];
+        }
     }
-    updateForwardCache();
-    updateBackwardCache();
-    std::unordered_map<std::shared_ptr<Layer>, size_t> layersIndex;
-    std::vector<size_t> totalInputSize;
-    totalInputSize.resize(layers.size());
-    for (size_t i = 0; i < layers.size(); i++)
+    if (m_precision == Precision::Double)
+        return gemm(in, m_weights, out, n, m_rows, m_cols);
+
+    // 输入按权重的行距转换，行尾补零；缓冲每线程一份，predict 仍可并发
+    if (m_precision == Precision::Float32)
     {
-        layersIndex.insert({layers.at(i), i});
-        totalInputSize.at(i) = backwardCache.at(i).size();
+        thread_local AlignedVector<float> x;
+        x.assign(n * m_ld, 0.0f);
+        for (size_t i = 0; i < n; i++)
+            std::copy(in + i * m_cols, in + (i + 1) * m_cols, x.begin() + i * m_ld);
+        return gemmF32(x.data(), m_weightsF32.data(), out, n, m_rows, m_ld);
     }
-    std::vector<size_t> currentInputSize;
-    currentInputSize.resize(totalInputSize.size());
-    Layer &input(*layers.at(0));
-    for (int i = 0; i < input.size(); i++)
+    thread_local AlignedVector<int8_t> x;
+    thread_local AlignedVector<float> scales;
+    x.assign(n * m_ld, 0);
+    scales.resize(n);
+    for (size_t i = 0; i < n; i++)
     {
-        input.neurons.at(i).output = sample.features.at(i);
+        const double *row = in + i * m_cols;
+        double maxAbs = 0;
+        for (size_t c = 0; c < m_cols; c++)
+            maxAbs = std::max(maxAbs, std::abs(row[c]));
+        scales[i] = float(maxAbs / 127);
+        const double inv = maxAbs > 0 ? 127 / maxAbs : 0;
+        for (size_t c = 0; c < m_cols; c++)
+            x[i * m_ld + c] = int8_t(std::nearbyint(row[c] * inv));
     }
-    bool complete = 0;
-    std::vector<bool> doneForward;
-    doneForward.resize(totalInputSize.size());
-    while (!complete)
+    gemmI8(x.data(), scales.data(), m_weightsI8.data(), m_scales.data(), out, n, m_rows, m_ld);
+}
+
+void Network::DenseLink::backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const
+{
+    double *gradW = grad;
+    double *gradB = grad + (m_bias - m_weights);
+    for (size_t i = 0; i < n; i++)
     {
-        for (int i = 0; i < currentInputSize.size() - 1; i++)
+        const double *d = dOut + i * m_rows;
+        for (size_t j = 0; j < m_rows; j++)
         {
-            if (doneForward.at(i))
-                continue;
-            if (currentInputSize.at(i) != totalInputSize.at(i))
-                continue;
-            if (currentInputSize.at(i) == totalInputSize.at(i))
-            {
-                for (const auto &l : forwardCache.at(i))
-                {
-                    currentInputSize.at(layersIndex.find(l->target())->second) += 1;
-                    bool targetDoneInput = 0;
-                    if (currentInputSize.at(layersIndex.find(l->target())->second) == totalInputSize.at(layersIndex.find(l->target())->second))
-                        targetDoneInput = 1;
-                    for (const auto &s : l->synapses())
-                    {
-                        l->target()->neurons.at(s.toIdx).input += (l->source()->neurons.at(s.fromIdx).output) * (s.weight);
-                    }
-                    if (targetDoneInput)
-                        for (auto &n : l->target()->neurons)
-                        {
-                            n.output = activateFunc.find(l->target()->m_activate)->second(n.input + n.bias);
-                        }
-                }
-                doneForward.at(i) = 1;
-            }
+            gradB[j] += d[j];
         }
-
-        if (currentInputSize == totalInputSize)
-            complete = 1;
-    }
-    Sample rtr = sample;
-    for (int j = 0; j < layers.back()->size(); j++)
-    {
-        rtr.labels.at(j) = layers.back()->neurons.at(j).output;
     }
-    return rtr;
+    gemmTN(dOut, in, gradW, n, m_rows, m_cols);
+    if (dIn)
+        gemmNN(dOut, m_weights, dIn, n, m_rows, m_cols);
 }
 
-bool Network::train(const SampleSet &sampleSet)
+std::span<double> Network::DenseLink::parameters()
 {
-    if (sampleSet.featureSize != layers.front()->size() || sampleSet.labelSize != layers.back()->size())
-    {
-        std::cout << "sampleSet size does't match the network" << std::endl;
-        return 0;
-    }
-    updateForwardCache();
-    updateBackwardCache();
+    touchParameters();
+    return std::span<double>(m_weights, (m_bias - m_weights) + m_rows);
+}
+
+size_t Network::DenseLink::paramCount() const
+{
+    return m_rows * m_cols + m_rows;
+}
+
+double Network::DenseLink::flopsPerSample() const
+{
+    return 2.0 * m_rows * m_cols + m_rows;
+}
+
+std::string Network::DenseLink::type() const
+{
+    return "Dense";
 }
 
-//
-//
-//
-//
-//
-//
-//
-/*void Network::saveModel(const std::string &filename)
+void Network::DenseLink::setPrecision(Precision precision)
 {
-    // 1. 处理文件名：确保以.nll结尾
-    std::string final_filename = filename;
-    if (final_filename.find(".nll") == std::string::npos)
+    m_precision = precision;
+    m_ld = (m_cols + 31) & ~size_t(31);
+    m_weightsF32 = AlignedVector<float>();
+    m_weightsI8 = AlignedVector<int8_t>();
+    m_scales = AlignedVector<float>();
+    if (precision == Precision::Float32)
     {
-        final_filename += ".nll"; // 自动添加.nll后缀
+        m_weightsF32.assign(m_rows * m_ld, 0.0f);
+        for (size_t j = 0; j < m_rows; j++)
+            std::copy(m_weights + j * m_cols, m_weights + (j + 1) * m_cols, m_weightsF32.begin() + j * m_ld);
     }
-
-    // 2. 打开文件（二进制模式 + 截断）
-    std::ofstream ofs(final_filename, std::ios::binary | std::ios::trunc);
-    if (!ofs)
+    else if (precision == Precision::Int8)
     {
-        throw std::runtime_error("无法打开文件写入: " + final_filename);
+        m_weightsI8.assign(m_rows * m_ld, 0);
+        m_scales.resize(m_rows);
+        for (size_t j = 0; j < m_rows; j++)
+        {
+            const double *w = m_weights + j * m_cols;
+            double maxAbs = 0;
+            for (size_t c = 0; c < m_cols; c++)
+                maxAbs = std::max(maxAbs, std::abs(w[c]));
+            m_scales[j] = float(maxAbs / 127);
+            const double inv = maxAbs > 0 ? 127 / maxAbs : 0;
+            for (size_t c = 0; c < m_cols; c++)
+                m_weightsI8[j * m_ld + c] = int8_t(std::nearbyint(w[c] * inv));
+        }
     }
+}
 
-    // 3. 写入文件头（魔数+版本+数量）
-    FileHeader header{};
-    header.magic = 0x20041022; // 自定义魔数（标识.nll文件）
-    header.version = 1;        // 版本号
-    header.num_layers = layers.size();
-    header.num_links = links.size();
+Precision Network::DenseLink::precision() const
+{
+    return m_precision;
+}
 
-    // 写入文件头（转为char*，避免对齐问题）
-    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+void Network::DenseLink::setBinaryInput(bool enable)
+{
+    m_columns = AlignedVector<double>();
+    if (!enable)
+        return;
+    // 列距按 64 字节取整后再错开一行缓存，避免列距为 2 的幂时各列挤进同一组缓存
+    m_columnStride = ((m_rows + 7) & ~size_t(7)) + 8;
+    m_columns.assign(m_cols * m_columnStride, 0.0);
+    for (size_t j = 0; j < m_rows; j++)
+        for (size_t c = 0; c < m_cols; c++)
+            m_columns[c * m_columnStride + j] = m_weights[j * m_cols + c];
+}
 
-    // 4. 写入所有层信息（名称+形状）
-    for (const auto &lyr: layers)
+bool Network::DenseLink::forwardBits(const uint64_t *bits, size_t words, double *out, size_t n) const
+{
+    if (m_columns.empty())
+        return 0;
+    for (size_t i = 0; i < n; i++)
     {
-        // 写入层名称（长度+内容）
-        uint32_t name_len = static_cast<uint32_t>(name.size());
-        ofs.write(reinterpret_cast<const char *>(&name_len), sizeof(name_len));
-        ofs.write(name.c_str(), name_len);
-
-        // 写入层形状（长度+维度数组）
-        const auto &shape = lyr->getShape();
-        uint32_t shape_len = static_cast<uint32_t>(shape.size());
-        ofs.write(reinterpret_cast<const char *>(&shape_len), sizeof(shape_len));
-        for (size_t dim : shape)
+        double *o = out + i * m_rows;
+        for (size_t j = 0; j < m_rows; j++)
         {
-            ofs.write(reinterpret_cast<const char *>(&dim), sizeof(dim));
+            o[j] += m_bias[j];
         }
     }
+    sumSetColumns(m_columns.data(), m_columnStride, m_rows, bits, words, out, n);
+    return 1;
+}
 
-    // 5. 写入所有链接信息（直接记录突触原始信息，不转换为矩阵）
-    for (size_t i = 0; i < links.size(); i++)
+size_t Network::DenseLink::weightBytes() const
+{
+    switch (m_precision)
     {
-        // 写入链接头部（原逻辑不变：源/目标/激活函数）
-        ofs << "[Link:src=" << *layers.find_key(links[i]->source()) << ",tgt=" << *layers.find_key(links[i]->target())
-            << ",activation="
-            << links[i]->activate()
-            << "]\n";
-        ofs
-            << "Type=Dense\n"; // 标记为全连接层（原逻辑不变）
-
-        // --------------------------
-        // 核心修改：写入突触原始信息（替换原矩阵/向量逻辑）
-        // --------------------------
-        ofs
-            << "Synapses=  // 标记突触列表开始\n";
-        // 遍历每个突触，写入原始字段（fromIdx、toIdx、weight、bias）
-        for (const auto &syn : links[i]->synapses())
-        {
-            ofs << syn.fromIdx << "," // 源神经元索引
-                << syn.toIdx << ","   // 目标神经元索引
-                << syn.weight << ","  // 权重
-                << syn.bias << "\n";  // 偏置
-        }
-        ofs
-            << "EndSynapses  // 标记突触列表结束\n";
-        ofs
-            << "\n"; // 链接部分结束，留空行分隔下一个链接
+    case Precision::Float32:
+        return m_weightsF32.size() * sizeof(float);
+    case Precision::Int8:
+        return m_weightsI8.size() + m_scales.size() * sizeof(float);
+    default:
+        return m_rows * m_cols * sizeof(double);
     }
-    // 6. 关闭文件
-    ofs.close();
-    std::cout << "模型已保存到: " << final_filename << std::endl;
 }
 
-*/
+size_t Network::DenseLink::rows() const
+{
+    return m_rows;
+}
 
-void Network::normalInitSynapses(std::vector<Synapse> &synapses)
+size_t Network::DenseLink::cols() const
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::normal_distribution<double> dist(0.0, 1.0);
+    return m_cols;
+}
 
-    for (auto &s : synapses)
-    { // ✅ 引用！
-        s.weight = dist(gen);
-    }
+double *Network::DenseLink::weights()
+{
+    touchParameters();
+    return m_weights;
 }
 
-void Network::valueInitSynapses(std::vector<Synapse> &synapses, double value)
+const double *Network::DenseLink::weights() const
 {
-    for (auto &s : synapses)
-    {
-        s.weight = value;
-    }
+    return m_weights;
+}
+
+double *Network::DenseLink::bias()
+{
+    touchParameters();
+    return m_bias;
+}
+
+const double *Network::DenseLink::bias() const
+{
+    return m_bias;
+}
+
+Network::SparseLink::SparseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target) : Link(source, target)
+{
+    build({}, {}, {});
+}
+
+Network::SparseLink::SparseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target,
+                                const std::vector<std::pair<size_t, size_t>> &connections)
+    : SparseLink(source, target)
+{
+    setConnections(connections);
+}
+
+Network::SparseLink::SparseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::shared_ptr<MappedFile> mapping,
+                                double *params, std::vector<Synapse> synapses)
+    : Link(source, target), m_mapping(std::move(mapping)), m_rows(target->size()), m_cols(source->size())
+{
+    m_synapses = std::move(synapses);
+    indexSynapses();
+    m_values = params;
+    m_bias = params + storageSize(m_synapses.size(), m_rows) - m_rows;
+}
+
+size_t Network::SparseLink::storageSize(size_t nnz, size_t rows)
+{
+    return ((nnz + 7) & ~size_t(7)) + rows;
 }
 
-bool loadSamples(std::string path, SampleSet &samples)
+void Network::SparseLink::indexSynapses()
 {
-    std::fstream file(path);
-    if (!file.is_open())
+    m_rowPtr.assign(m_rows + 1, 0);
+    m_colIdx.clear();
+    m_colIdx.reserve(m_synapses.size());
+    for (const Synapse &s : m_synapses)
     {
-        std::cout << "loadingSamplesError: " << "couldn't open file " << path << std::endl;
-        return 0;
+        m_colIdx.push_back(uint32_t(s.fromIdx));
+        m_rowPtr[s.toIdx + 1]++;
     }
-    samples.clear();
-    std::string line;
-    while (std::getline(file, line))
+    std::partial_sum(m_rowPtr.begin(), m_rowPtr.end(), m_rowPtr.begin());
+}
+
+void Network::SparseLink::build(std::vector<Synapse> synapses, std::vector<double> weights, std::vector<double> bias)
+{
+    m_rows = m_target->size();
+    m_cols = m_source->size();
+    weights.resize(synapses.size(), 0.0);
+    std::vector<size_t> order(synapses.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return std::pair(synapses[a].toIdx, synapses[a].fromIdx) < std::pair(synapses[b].toIdx, synapses[b].fromIdx); });
+    m_synapses.clear();
+    std::vector<double> values;
+    for (size_t k : order)
     {
-        if (line.empty())
+        const Synapse &syn = synapses[k];
+        if (syn.fromIdx >= m_cols || syn.toIdx >= m_rows)
             continue;
-        std::stringstream ss(line);
-        std::vector<std::string> tokens;
-        std::string token;
-        while (ss >> token)
+        // 重复的连接保留后加入的权重
+        if (!m_synapses.empty() && m_synapses.back().fromIdx == syn.fromIdx && m_synapses.back().toIdx == syn.toIdx)
         {
-            tokens.push_back(token);
-        }
-        if (tokens.size() != samples.featureSize + samples.labelSize)
+            values.back() = weights[k];
             continue;
-        std::vector<double> numTokens;
-        {
-            bool errorFlag = 0;
-            for (int i = 0; i < samples.featureSize + samples.labelSize; i++)
-            {
-                try
-                {
-                    numTokens.push_back(std::stod(tokens.at(i)));
-                }
-                catch (const std::invalid_argument &e)
-                {
-                    std::cerr << "无效参数: " << e.what() << std::endl;
-                    errorFlag = 1;
-                    break;
-                }
-                catch (const std::out_of_range &e)
-                {
-                    std::cerr << "超出范围: " << e.what() << std::endl;
-                    errorFlag = 1;
-                    break;
-                }
-            }
-            if (errorFlag)
-                continue;
         }
-        Sample sp;
-        sp.features = std::vector<double>(numTokens.begin(), numTokens.begin() + samples.featureSize);
-        sp.labels = std::vector<double>(numTokens.begin() + samples.featureSize, numTokens.end());
-        samples.push_back(sp);
+        m_synapses.push_back(syn);
+        values.push_back(weights[k]);
     }
-    if (samples.size())
-        return 1;
-    else
+    indexSynapses();
+    m_mapping.reset();
+    m_block.reset();
+    m_storage.assign(storageSize(values.size(), m_rows), 0.0);
+    m_values = m_storage.data();
+    m_bias = m_storage.data() + m_storage.size() - m_rows;
+    std::copy(values.begin(), values.end(), m_values);
+    if (bias.size() == m_rows)
+        std::copy(bias.begin(), bias.end(), m_bias);
+}
+
+void Network::SparseLink::setConnections(const std::vector<std::pair<size_t, size_t>> &connections)
+{
+    std::vector<Synapse> synapses;
+    synapses.reserve(connections.size());
+    for (auto [from, to] : connections)
+        synapses.push_back({from, to});
+    build(std::move(synapses), {}, {});
+}
+
+bool Network::SparseLink::addSynapse(size_t fromIdx, size_t toIdx, double weight)
+{
+    touchParameters();
+    if (fromIdx >= m_source->size() || toIdx >= m_target->size())
     {
-        std::cout << "file: " << path << " has no line match sample" << std::endl;
+        std::cout << "addSynapse Error: index out of layer size" << std::endl;
         return 0;
     }
+    std::vector<Synapse> synapses = m_synapses;
+    std::vector<double> weights(m_values, m_values + m_synapses.size());
+    synapses.push_back({fromIdx, toIdx});
+    weights.push_back(weight);
+    build(std::move(synapses), std::move(weights), std::vector<double>(m_bias, m_bias + m_rows));
+    return 1;
+}
+
+void Network::SparseLink::normalInitSynapses(std::optional<unsigned> seed)
+{
+    touchParameters();
+    static std::random_device rd;
+    static std::mt19937 shared(rd());
+    std::mt19937 seeded(seed.value_or(0));
+    std::mt19937 &gen = seed ? seeded : shared;
+    for (size_t r = 0; r < m_rows; r++)
+    {
+        const size_t fanIn = m_rowPtr[r + 1] - m_rowPtr[r];
+        std::normal_distribution<double> dist(0.0, 1.0 / std::sqrt(double(std::max<size_t>(fanIn, 1))));
+        for (uint32_t k = m_rowPtr[r]; k < m_rowPtr[r + 1]; k++)
+            m_values[k] = dist(gen);
+    }
+}
+
+void Network::SparseLink::valueInitSynapses(double value)
+{
+    touchParameters();
+    std::fill(m_values, m_values + m_synapses.size(), value);
+}
+
+void Network::SparseLink::forward(const double *in, double *out) const
+{
+    for (size_t r = 0; r < m_rows; r++)
+    {
+        out[r] += m_bias[r];
+    }
+    spmm(m_rowPtr.data(), m_colIdx.data(), m_values, in, out, 1, m_rows, m_cols);
 }
 
-void printSampleSet(SampleSet sampleSet)
+void Network::SparseLink::forwardBatch(const double *in, double *out, size_t n) const
 {
-    if (sampleSet.size() <= 20)
-        for (int i = 0; i < sampleSet.size(); i++)
+    for (size_t i = 0; i < n; i++)
+    {
+        double *o = out + i * m_rows;
+        for (size_t r = 0; r < m_rows; r++)
         {
-            if (sampleSet.featureSize > 30)
-            {
-                std::cout << "features: ";
-                for (int j = 0; j < 30; j++)
-                {
-                    std::cout << sampleSet.at(i).features.at(j) << " ";
-                }
-                std::cout << "... ";
-            }
-            else
+            o[r] += m_bias[r];
+        }
+    }
+    spmm(m_rowPtr.data(), m_colIdx.data(), m_values, in, out, n, m_rows, m_cols);
+}
+
+void Network::SparseLink::backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const
+{
+    double *gradV = grad;
+    double *gradB = grad + (m_bias - m_values);
+    for (size_t i = 0; i < n; i++)
+    {
+        const double *d = dOut + i * m_rows;
+        const double *x = in + i * m_cols;
+        double *dx = dIn ? dIn + i * m_cols : nullptr;
+        for (size_t r = 0; r < m_rows; r++)
+        {
+            const double dr = d[r];
+            gradB[r] += dr;
+            for (uint32_t k = m_rowPtr[r]; k < m_rowPtr[r + 1]; k++)
             {
-                std::cout << "features: ";
-                for (int j = 0; j < sampleSet.featureSize; j++)
-                {
-                    std::cout << sampleSet.at(i).features.at(j) << " ";
-                }
+                gradV[k] += dr * x[m_colIdx[k]];
+                if (dx)
+                    dx[m_colIdx[k]] += dr * m_values[k];
             }
-            if (sampleSet.labelSize > 10)
+        }
+    }
+}
+
+bool Network::SparseLink::bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params)
+{
+    if (m_mapping)
+        return 0;
+    std::span<double> p = parameters();
+    std::copy(p.begin(), p.end(), params);
+    m_values = params;
+    m_bias = params + p.size() - m_rows;
+    m_storage = AlignedVector<double>();
+    m_block = std::move(block);
+    return 1;
+}
+
+std::span<double> Network::SparseLink::parameters()
+{
+    touchParameters();
+    return std::span<double>(m_values, storageSize(m_synapses.size(), m_rows));
+}
+
+size_t Network::SparseLink::paramCount() const
+{
+    return m_synapses.size() + m_rows;
+}
+
+double Network::SparseLink::flopsPerSample() const
+{
+    return 2.0 * m_synapses.size() + m_rows;
+}
+
+std::string Network::SparseLink::type() const
+{
+    return "Sparse";
+}
+
+size_t Network::SparseLink::rows() const
+{
+    return m_rows;
+}
+
+size_t Network::SparseLink::cols() const
+{
+    return m_cols;
+}
+
+size_t Network::SparseLink::nnz() const
+{
+    return m_synapses.size();
+}
+
+double *Network::SparseLink::values()
+{
+    touchParameters();
+    return m_values;
+}
+
+const double *Network::SparseLink::values() const
+{
+    return m_values;
+}
+
+double *Network::SparseLink::bias()
+{
+    touchParameters();
+    return m_bias;
+}
+
+const double *Network::SparseLink::bias() const
+{
+    return m_bias;
+}
+
+// 空间层的形状：{C, H, W}，或单通道的 {H, W}
+static bool spatialShape(const std::vector<size_t> &shape, size_t &c, size_t &h, size_t &w)
+{
+    if (shape.size() == 2)
+    {
+        c = 1;
+        h = shape[0];
+        w = shape[1];
+        return 1;
+    }
+    if (shape.size() == 3)
+    {
+        c = shape[0];
+        h = shape[1];
+        w = shape[2];
+        return 1;
+    }
+    return 0;
+}
+
+Network::ConvLink::ConvLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::vector<size_t> kernel,
+                            std::vector<size_t> stride, std::vector<size_t> padding)
+    : Link(source, target)
+{
+    initGeometry(kernel, stride, padding);
+    m_storage.assign(storageSize(m_outC, patchSize()), 0.0);
+    m_weights = m_storage.data();
+    m_bias = m_storage.data() + m_storage.size() - m_outC;
+}
+
+Network::ConvLink::ConvLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, const std::vector<size_t> &kernel,
+                            const std::vector<size_t> &stride, const std::vector<size_t> &padding,
+                            std::shared_ptr<MappedFile> mapping, double *params)
+    : Link(source, target), m_mapping(std::move(mapping))
+{
+    initGeometry(kernel, stride, padding);
+    m_weights = params;
+    m_bias = params + storageSize(m_outC, patchSize()) - m_outC;
+}
+
+bool Network::ConvLink::initGeometry(const std::vector<size_t> &kernel, const std::vector<size_t> &stride,
+                                     const std::vector<size_t> &padding)
+{
+    m_outC = 0;
+    size_t outC = 0;
+    if (kernel.size() != 2 || (!stride.empty() && stride.size() != 2) || (!padding.empty() && padding.size() != 2) ||
+        !spatialShape(m_source->shape(), m_inC, m_inH, m_inW) || !spatialShape(m_target->shape(), outC, m_outH, m_outW))
+    {
+        std::cout << "ConvLink Error: layers must be {C, H, W} or {H, W}, kernel/stride/padding need two entries" << std::endl;
+        return 0;
+    }
+    m_kh = kernel[0];
+    m_kw = kernel[1];
+    m_sh = stride.empty() ? 1 : stride[0];
+    m_sw = stride.empty() ? 1 : stride[1];
+    m_ph = padding.empty() ? 0 : padding[0];
+    m_pw = padding.empty() ? 0 : padding[1];
+    bool fits = m_kh && m_kw && m_sh && m_sw && m_inH + 2 * m_ph >= m_kh && m_inW + 2 * m_pw >= m_kw &&
+                (m_inH + 2 * m_ph - m_kh) / m_sh + 1 == m_outH && (m_inW + 2 * m_pw - m_kw) / m_sw + 1 == m_outW;
+    if (!fits)
+    {
+        std::cout << "ConvLink Error: target shape doesn't match kernel, stride and padding" << std::endl;
+        return 0;
+    }
+    m_outC = outC;
+    return 1;
+}
+
+size_t Network::ConvLink::storageSize(size_t outC, size_t patch)
+{
+    return ((outC * patch + 7) & ~size_t(7)) + outC;
+}
+
+// 卷积核的第 j 列在一行输出里落在输入内的区间 [lo, hi)，其余位置对着补零区
+static void validColumns(size_t j, size_t stride, size_t pad, size_t inW, size_t outW, size_t &lo, size_t &hi)
+{
+    lo = j < pad ? (pad - j + stride - 1) / stride : 0;
+    hi = inW + pad > j ? std::min(outW, (inW + pad - j + stride - 1) / stride) : 0;
+    lo = std::min(lo, hi);
+}
+
+void Network::ConvLink::im2col(const double *in, double *col) const
+{
+    // 几何参数取到局部变量，否则写 col / in 时编译器要假设成员可能被改写，内层循环无法向量化
+    const size_t inC = m_inC, inH = m_inH, inW = m_inW, outH = m_outH, outW = m_outW, kh = m_kh, kw = m_kw;
+    const size_t sh = m_sh, sw = m_sw, ph = m_ph, pw = m_pw;
+    const size_t positions = outH * outW;
+    for (size_t c = 0; c < inC; c++)
+    {
+        for (size_t i = 0; i < kh; i++)
+        {
+            for (size_t j = 0; j < kw; j++, col += positions)
             {
-                std::cout << "labels: ";
-                for (int j = 0; j < 10; j++)
+                size_t lo, hi;
+                validColumns(j, sw, pw, inW, outW, lo, hi);
+                for (size_t oh = 0; oh < outH; oh++)
                 {
-                    std::cout << sampleSet.at(i).labels.at(j) << " ";
+                    double *dst = col + oh * outW;
+                    // 减去补零宽度后可能为负，用有符号坐标判断整行是否落在补零区
+                    const ptrdiff_t ih = ptrdiff_t(oh * sh + i) - ptrdiff_t(ph);
+                    if (ih < 0 || ih >= ptrdiff_t(inH))
+                    {
+                        std::fill(dst, dst + outW, 0.0);
+                        continue;
+                    }
+                    const double *row = in + (c * inH + size_t(ih)) * inW;
+                    std::fill(dst, dst + lo, 0.0);
+                    if (sw == 1 && lo < hi)
+                        // ow >= lo 时 ow + j >= pw，起点不会变负
+                        std::copy(row + (lo + j - pw), row + (hi + j - pw), dst + lo);
+                    else
+                        for (size_t ow = lo; ow < hi; ow++)
+                        {
+                            // 列坐标同样按有符号数计算并检查，不依赖无符号回绕
+                            const ptrdiff_t iw = ptrdiff_t(ow * sw + j) - ptrdiff_t(pw);
+                            dst[ow] = iw >= 0 && iw < ptrdiff_t(inW) ? row[iw] : 0.0;
+                        }
+                    std::fill(dst + hi, dst + outW, 0.0);
                 }
-                std::cout << "... ";
             }
-            else
+        }
+    }
+}
+
+void Network::ConvLink::col2im(const double *col, double *in) const
+{
+    const size_t inC = m_inC, inH = m_inH, inW = m_inW, outH = m_outH, outW = m_outW, kh = m_kh, kw = m_kw;
+    const size_t sh = m_sh, sw = m_sw, ph = m_ph, pw = m_pw;
+    const size_t positions = outH * outW;
+    for (size_t c = 0; c < inC; c++)
+    {
+        for (size_t i = 0; i < kh; i++)
+        {
+            for (size_t j = 0; j < kw; j++, col += positions)
             {
-                std::cout << "labels: ";
-                for (int j = 0; j < sampleSet.labelSize; j++)
+                size_t lo, hi;
+                validColumns(j, sw, pw, inW, outW, lo, hi);
+                for (size_t oh = 0; oh < outH; oh++)
                 {
-                    std::cout << sampleSet.at(i).labels.at(j) << " ";
+                    const ptrdiff_t ih = ptrdiff_t(oh * sh + i) - ptrdiff_t(ph);
+                    if (ih < 0 || ih >= ptrdiff_t(inH))
+                        continue;
+                    const double *src = col + oh * outW;
+                    double *row = in + (c * inH + size_t(ih)) * inW;
+                    if (sw == 1 && lo < hi)
+                    {
+                        double *dst = row + (lo + j - pw);
+                        for (size_t ow = lo; ow < hi; ow++)
+                            dst[ow - lo] += src[ow];
+                    }
+                    else
+                        for (size_t ow = lo; ow < hi; ow++)
+                        {
+                            const ptrdiff_t iw = ptrdiff_t(ow * sw + j) - ptrdiff_t(pw);
+                            if (iw >= 0 && iw < ptrdiff_t(inW))
+                                row[iw] += src[ow];
+                        }
                 }
             }
-            std::cout << std::endl;
         }
-    else
+    }
+}
+
+void Network::ConvLink::normalInitSynapses(std::optional<unsigned> seed)
+{
+    touchParameters();
+    static std::random_device rd;
+    static std::mt19937 shared(rd());
+    std::mt19937 seeded(seed.value_or(0));
+    std::mt19937 &gen = seed ? seeded : shared;
+    std::normal_distribution<double> dist(0.0, 1.0 / std::sqrt(double(std::max<size_t>(patchSize(), 1))));
+    for (size_t i = 0; i < m_outC * patchSize(); i++)
+    {
+        m_weights[i] = dist(gen);
+    }
+}
+
+void Network::ConvLink::valueInitSynapses(double value)
+{
+    touchParameters();
+    std::fill(m_weights, m_weights + m_outC * patchSize(), value);
+}
+
+void Network::ConvLink::forward(const double *in, double *out) const
+{
+    forwardBatch(in, out, 1);
+}
+
+void Network::ConvLink::forwardBatch(const double *in, double *out, size_t n) const
+{
+    if (!m_outC)
+        return;
+    const size_t positions = m_outH * m_outW;
+    const size_t patch = patchSize();
+    // 展开缓冲每线程一份，predict 仍可并发
+    thread_local AlignedVector<double> col;
+    col.resize(positions * patch);
+    for (size_t i = 0; i < n; i++)
     {
-        for (int i = 0; i < 20; i++)
+        double *o = out + i * m_target->size();
+        for (size_t k = 0; k < m_outC; k++)
         {
-            if (sampleSet.featureSize > 30)
+            for (size_t p = 0; p < positions; p++)
             {
-                std::cout << "features: ";
-                for (int j = 0; j < 30; j++)
-                {
-                    std::cout << sampleSet.at(i).features.at(j) << " ";
-                }
-                std::cout << "... ";
+                o[k * positions + p] += m_bias[k];
             }
-            else
+        }
+        im2col(in + i * m_source->size(), col.data());
+        // out (outC x positions) += W (outC x patch) * col (patch x positions)
+        gemmNN(m_weights, col.data(), o, m_outC, patch, positions);
+    }
+}
+
+void Network::ConvLink::backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const
+{
+    if (!m_outC)
+        return;
+    const size_t positions = m_outH * m_outW;
+    const size_t patch = patchSize();
+    double *gradW = grad;
+    double *gradB = grad + (m_bias - m_weights);
+    thread_local AlignedVector<double> col, dCol;
+    col.resize(positions * patch);
+    for (size_t i = 0; i < n; i++)
+    {
+        const double *d = dOut + i * m_target->size();
+        for (size_t k = 0; k < m_outC; k++)
+        {
+            for (size_t p = 0; p < positions; p++)
             {
-                std::cout << "features: ";
-                for (int j = 0; j < sampleSet.featureSize; j++)
-                {
-                    std::cout << sampleSet.at(i).features.at(j) << " ";
-                }
+                gradB[k] += d[k * positions + p];
             }
-            if (sampleSet.labelSize > 10)
+        }
+        im2col(in + i * m_source->size(), col.data());
+        // gradW (outC x patch) += d (outC x positions) * col^T
+        gemm(d, col.data(), gradW, m_outC, patch, positions);
+        if (dIn)
+        {
+            // dCol (patch x positions) = W^T * d，再按展开的方式累加回输入
+            dCol.assign(patch * positions, 0.0);
+            gemmTN(m_weights, d, dCol.data(), m_outC, patch, positions);
+            col2im(dCol.data(), dIn + i * m_source->size());
+        }
+    }
+}
+
+bool Network::ConvLink::bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params)
+{
+    if (m_mapping)
+        return 0;
+    std::span<double> p = parameters();
+    std::copy(p.begin(), p.end(), params);
+    m_weights = params;
+    m_bias = params + p.size() - m_outC;
+    m_storage = AlignedVector<double>();
+    m_block = std::move(block);
+    return 1;
+}
+
+std::span<double> Network::ConvLink::parameters()
+{
+    touchParameters();
+    return std::span<double>(m_weights, storageSize(m_outC, patchSize()));
+}
+
+size_t Network::ConvLink::paramCount() const
+{
+    return m_outC * patchSize() + m_outC;
+}
+
+double Network::ConvLink::flopsPerSample() const
+{
+    return (2.0 * patchSize() + 1) * m_outC * m_outH * m_outW;
+}
+
+std::string Network::ConvLink::type() const
+{
+    return "Conv";
+}
+
+size_t Network::ConvLink::patchSize() const
+{
+    return m_inC * m_kh * m_kw;
+}
+
+size_t Network::ConvLink::outChannels() const
+{
+    return m_outC;
+}
+
+double *Network::ConvLink::weights()
+{
+    touchParameters();
+    return m_weights;
+}
+
+const double *Network::ConvLink::weights() const
+{
+    return m_weights;
+}
+
+double *Network::ConvLink::bias()
+{
+    touchParameters();
+    return m_bias;
+}
+
+const double *Network::ConvLink::bias() const
+{
+    return m_bias;
+}
+
+Network::PoolLink::PoolLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::vector<size_t> window,
+                            Pooling mode, std::vector<size_t> stride)
+    : Link(source, target), m_mode(mode)
+{
+    size_t targetC = 0;
+    if (window.size() != 2 || (!stride.empty() && stride.size() != 2) ||
+        !spatialShape(source->shape(), m_c, m_inH, m_inW) || !spatialShape(target->shape(), targetC, m_outH, m_outW))
+    {
+        std::cout << "PoolLink Error: layers must be {C, H, W} or {H, W}, window/stride need two entries" << std::endl;
+        m_c = 0;
+        return;
+    }
+    m_wh = window[0];
+    m_ww = window[1];
+    m_sh = stride.empty() ? m_wh : stride[0];
+    m_sw = stride.empty() ? m_ww : stride[1];
+    bool fits = m_wh && m_ww && m_sh && m_sw && m_inH >= m_wh && m_inW >= m_ww && targetC == m_c &&
+                (m_inH - m_wh) / m_sh + 1 == m_outH && (m_inW - m_ww) / m_sw + 1 == m_outW;
+    if (!fits)
+    {
+        std::cout << "PoolLink Error: target shape doesn't match window and stride" << std::endl;
+        m_c = 0;
+    }
+}
+
+void Network::PoolLink::forward(const double *in, double *out) const
+{
+    forwardBatch(in, out, 1);
+}
+
+void Network::PoolLink::forwardBatch(const double *in, double *out, size_t n) const
+{
+    const size_t inH = m_inH, inW = m_inW, outH = m_outH, outW = m_outW, wh = m_wh, ww = m_ww, sh = m_sh, sw = m_sw;
+    const double inv = 1.0 / double(wh * ww);
+    // 按模式分成两份循环，内层不再判断
+    auto pool = [&](auto reduce, bool average)
+    {
+        for (size_t i = 0; i < n * m_c; i++)
+        {
+            // 样本与通道连续存放，可以合成一维遍历
+            const double *x = in + i * inH * inW;
+            double *o = out + i * outH * outW;
+            for (size_t oh = 0; oh < outH; oh++)
             {
-                std::cout << "labels: ";
-                for (int j = 0; j < 10; j++)
+                for (size_t ow = 0; ow < outW; ow++)
                 {
-                    std::cout << sampleSet.at(i).labels.at(j) << " ";
+                    const double *w = x + oh * sh * inW + ow * sw;
+                    double v = average ? 0.0 : w[0];
+                    for (size_t a = 0; a < wh; a++)
+                        for (size_t b = 0; b < ww; b++)
+                            v = reduce(v, w[a * inW + b]);
+                    o[oh * outW + ow] += average ? v * inv : v;
                 }
-                std::cout << "... ";
             }
-            else
+        }
+    };
+    if (m_mode == Pooling::Max)
+        pool([](double v, double e)
+             { return std::max(v, e); }, 0);
+    else
+        pool(std::plus<double>(), 1);
+}
+
+void Network::PoolLink::backwardBatch(const double *in, const double *dOut, double *dIn, double *, size_t n) const
+{
+    if (!dIn)
+        return;
+    const double inv = 1.0 / double(m_wh * m_ww);
+    for (size_t i = 0; i < n * m_c; i++)
+    {
+        const double *x = in + i * m_inH * m_inW;
+        const double *d = dOut + i * m_outH * m_outW;
+        double *dx = dIn + i * m_inH * m_inW;
+        for (size_t oh = 0; oh < m_outH; oh++)
+        {
+            for (size_t ow = 0; ow < m_outW; ow++)
             {
-                std::cout << "labels: ";
-                for (int j = 0; j < sampleSet.labelSize; j++)
+                const size_t origin = oh * m_sh * m_inW + ow * m_sw;
+                const double g = d[oh * m_outW + ow];
+                if (m_mode == Pooling::Average)
                 {
-                    std::cout << sampleSet.at(i).labels.at(j) << " ";
+                    for (size_t a = 0; a < m_wh; a++)
+                        for (size_t b = 0; b < m_ww; b++)
+                            dx[origin + a * m_inW + b] += g * inv;
+                    continue;
                 }
+                // 前向取的是第一个最大值，这里按同样的顺序找回它
+                size_t best = origin;
+                for (size_t a = 0; a < m_wh; a++)
+                    for (size_t b = 0; b < m_ww; b++)
+                        if (x[origin + a * m_inW + b] > x[best])
+                            best = origin + a * m_inW + b;
+                dx[best] += g;
             }
-            std::cout << std::endl;
         }
-        std::cout << std::endl;
-        for (int k = 0; k < 3; k++)
-            std::cout << '.' << std::endl;
     }
 }
 
-double Network::sigmoid(double x)
+std::span<double> Network::PoolLink::parameters()
 {
-    return 1.0 / (1.0 + std::exp(-x));
+    return {};
 }
 
-double Network::sigmoidDeri(double x)
+size_t Network::PoolLink::paramCount() const
 {
-    return x * (1.0 - 1.0 / (1.0 + std::exp(-x)));
+    return 0;
 }
 
-double Network::linear(double x)
+double Network::PoolLink::flopsPerSample() const
 {
-    return x;
+    return double(m_c * m_outH * m_outW * m_wh * m_ww);
 }
 
-double Network::linearDeri(double x)
+std::string Network::PoolLink::type() const
 {
-    return 0;
+    return "Pool";
+}
+
+Pooling Network::PoolLink::mode() const
+{
+    return m_mode;
+}
+
+Network::LocalLink::LocalLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::vector<size_t> field,
+                              std::vector<size_t> stride)
+    : SparseLink(source, target)
+{
+    const std::vector<size_t> &src = source->shape();
+    const std::vector<size_t> &tgt = target->shape();
+    const size_t dims = src.size();
+    if (stride.empty())
+        stride.assign(dims, 1);
+    if ((tgt.size() != dims && tgt.size() != dims + 1) || field.size() != dims || stride.size() != dims)
+    {
+        std::cout << "LocalLink Error: field and stride need one entry per source dimension, "
+                  << "target may only add a leading channel dimension" << std::endl;
+        return;
+    }
+    // 目标层的空间网格（去掉通道维）
+    const std::vector<size_t> grid(tgt.end() - dims, tgt.end());
+    const size_t channels = tgt.size() > dims ? tgt.front() : 1;
+    size_t positions = 1;
+    for (size_t g : grid)
+        positions *= g;
+    const std::vector<size_t> &srcStrides = source->strides();
+    std::vector<std::pair<size_t, size_t>> connections;
+    std::vector<size_t> lo(dims), hi(dims), q(dims);
+    for (size_t pos = 0; pos < positions; pos++)
+    {
+        bool empty = 0;
+        for (size_t d = dims, rest = pos; d-- > 0; rest /= grid[d])
+        {
+            lo[d] = (rest % grid[d]) * stride[d];
+            hi[d] = std::min(lo[d] + field[d], src[d]);
+            empty |= lo[d] >= hi[d];
+        }
+        if (empty)
+            continue;
+        // 逐个遍历感受野内的源坐标，最后一维变化最快
+        q = lo;
+        for (;;)
+        {
+            size_t from = 0;
+            for (size_t d = 0; d < dims; d++)
+                from += q[d] * srcStrides[d];
+            for (size_t c = 0; c < channels; c++)
+                connections.push_back({from, c * positions + pos});
+            size_t d = dims;
+            while (d > 0 && ++q[d - 1] == hi[d - 1])
+            {
+                q[d - 1] = lo[d - 1];
+                d--;
+            }
+            if (d == 0)
+                break;
+        }
+    }
+    setConnections(connections);
+}
+
+Network::Network(std::shared_ptr<Layer> input, std::shared_ptr<Layer> output)
+{
+    m_layers.resize(2);
+    m_layers.at(0) = input;
+    m_layers.at(1) = output;
+    compile();
+}
+
+bool Network::addLayer(std::shared_ptr<Layer> layer)
+{
+    auto it = std::find(m_layers.begin(), m_layers.end(), layer);
+    if (it != m_layers.end())
+    {
+        std::cout << "Repeatedly adding the same element" << std::endl;
+        return 0;
+    }
+    it = m_layers.end() - 1;
+    m_layers.insert(it, layer);
+    compile();
+    return 1;
+}
+
+bool Network::addLink(std::shared_ptr<Link> link)
+{
+    auto it = std::find(m_links.begin(), m_links.end(), link);
+    if (it != m_links.end())
+    {
+        std::cout << "Repeatedly adding the same element" << std::endl;
+        return 0;
+    }
+    auto sourceIt = std::find(m_layers.begin(), m_layers.end(), link->source());
+    auto targetIt = std::find(m_layers.begin(), m_layers.end(), link->target());
+    if (sourceIt == m_layers.end() || targetIt == m_layers.end())
+    {
+        std::cout << "linking layer not obtained" << std::endl;
+        return 0;
+    }
+    m_links.push_back(link);
+    link->setPrecision(m_precision);
+    link->setBinaryInput(m_binaryInput && link->source() == m_layers.front());
+    compile();
+    return 1;
+}
+
+void Network::updateForwardCache()
+{
+    clearForwardCache();
+    std::unordered_map<std::shared_ptr<Layer>, size_t> layersIndex;
+    for (size_t i = 0; i < m_layers.size(); i++)
+    {
+        layersIndex.insert({m_layers.at(i), i});
+    }
+    m_forwardCache.resize(m_layers.size());
+    for (size_t k = 0; k < m_links.size(); k++)
+    {
+        auto it = layersIndex.find(m_links.at(k)->source());
+        size_t idx = it->second;
+        m_forwardCache.at(idx).push_back(k);
+    }
+}
+
+void Network::clearForwardCache()
+{
+    m_forwardCache.clear();
+}
+
+void Network::updateBackwardCache()
+{
+    clearBackwardCache();
+    std::unordered_map<std::shared_ptr<Layer>, size_t> layersIndex;
+    for (size_t i = 0; i < m_layers.size(); i++)
+    {
+        layersIndex.insert({m_layers.at(i), i});
+    }
+    m_backwardCache.resize(m_layers.size());
+    for (size_t k = 0; k < m_links.size(); k++)
+    {
+        auto it = layersIndex.find(m_links.at(k)->target());
+        size_t idx = it->second;
+        m_backwardCache.at(idx).push_back(k);
+    }
+}
+
+void Network::clearBackwardCache()
+{
+    m_backwardCache.clear();
+}
+
+bool Network::planStale() const
+{
+    for (const Step &step : m_plan)
+        if (step.link->parameters().size() != step.paramCount)
+            return 1;
+    return 0;
+}
+
+bool Network::compile()
+{
+    m_compiled = 0;
+    updateForwardCache();
+    updateBackwardCache();
+    std::unordered_map<std::shared_ptr<Layer>, size_t> layersIndex;
+    for (size_t i = 0; i < m_layers.size(); i++)
+    {
+        layersIndex.insert({m_layers.at(i), i});
+    }
+    // 激活函数名在这里解析一次，前向/反向只按枚举分派
+    std::vector<Activation> activations(m_layers.size());
+    for (size_t i = 0; i < m_layers.size(); i++)
+    {
+        if (!parseActivation(m_layers.at(i)->m_activate, activations.at(i)))
+        {
+            std::cout << "compile Error: unknown activation " << m_layers.at(i)->m_activate << std::endl;
+            return 0;
+        }
+    }
+    m_outputActivation = activations.back();
+    // Kahn 拓扑排序：层的入链接全部执行完后才展开它的出链接
+    std::vector<size_t> remaining(m_layers.size());
+    std::vector<size_t> ready;
+    m_zeroLayers.clear();
+    for (size_t i = 0; i < m_layers.size(); i++)
+    {
+        remaining.at(i) = m_backwardCache.at(i).size();
+        if (remaining.at(i) == 0)
+            ready.push_back(i);
+        else
+            m_zeroLayers.push_back(i);
+    }
+    m_plan.clear();
+    m_paramTotal = 0;
+    for (size_t r = 0; r < ready.size(); r++)
+    {
+        size_t s = ready.at(r);
+        for (size_t k : m_forwardCache.at(s))
+        {
+            const auto &l = m_links.at(k);
+            size_t t = layersIndex.find(l->target())->second;
+            bool first = remaining.at(t) == m_backwardCache.at(t).size();
+            Step step{l.get(), s, t, first, 0, activations.at(t), !m_backwardCache.at(s).empty(), m_paramTotal,
+                      l->parameters().size(), k};
+            if (--remaining.at(t) == 0)
+            {
+                step.activates = 1;
+                ready.push_back(t);
+            }
+            // 每段按 8 个 double 对齐
+            m_paramTotal += (l->parameters().size() + 7) & ~size_t(7);
+            m_plan.push_back(step);
+        }
+    }
+    if (ready.size() != m_layers.size())
+    {
+        std::cout << "compile Error: layer graph has a cycle" << std::endl;
+        m_plan.clear();
+        return 0;
+    }
+    // 自有存储的链接把参数搬进同一块对齐内存，布局与梯度区相同；映射自模型文件的链接保持零拷贝
+    auto block = std::make_shared<AlignedVector<double>>(m_paramTotal, 0.0);
+    bool bound = 0;
+    for (const Step &step : m_plan)
+        bound |= step.link->bindParameters(block, block->data() + step.paramOffset);
+    m_params = bound ? std::move(block) : nullptr;
+    // 入链接全是 DenseLink 的层可以融合；链接的精度、二值输入在前向时再检查
+    m_fused.assign(m_layers.size(), FusedLayer());
+    for (size_t t = 0; t < m_layers.size(); t++)
+    {
+        FusedLayer fused;
+        for (size_t k : m_backwardCache.at(t))
+        {
+            const auto &l = m_links.at(k);
+            if (l->type() != "Dense")
+            {
+                fused.links.clear();
+                break;
+            }
+            fused.links.push_back(static_cast<const DenseLink *>(l.get()));
+            fused.sources.push_back(layersIndex.find(l->source())->second);
+        }
+        m_fused.at(t) = std::move(fused);
+    }
+    m_workspaces.clear();
+    static std::atomic<uint64_t> planCounter{0};
+    m_planId = ++planCounter;
+    m_compiled = 1;
+    return 1;
+}
+
+// 每层 batchSize 行的缓冲依次切自 block，每段起点按 8 个 double（64 字节）对齐
+static void carveLayers(AlignedVector<double> &block, std::vector<std::vector<Network::LayerBuffer> *> views,
+                        const std::vector<size_t> &sizes, size_t batchSize)
+{
+    size_t total = 0;
+    for (size_t v = 0; v < views.size(); v++)
+        for (size_t cols : sizes)
+            total += (batchSize * cols + 7) & ~size_t(7);
+    block.assign(total, 0.0);
+    double *p = block.data();
+    for (std::vector<Network::LayerBuffer> *view : views)
+    {
+        view->resize(sizes.size());
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            (*view)[i] = {p, sizes[i]};
+            p += (batchSize * sizes[i] + 7) & ~size_t(7);
+        }
+    }
+}
+
+void Network::reserveContext(InferenceContext &ctx, size_t batchSize) const
+{
+    if (ctx.m_planId == m_planId && batchSize <= ctx.m_capacity)
+        return;
+    std::vector<size_t> sizes(m_layers.size());
+    for (size_t i = 0; i < m_layers.size(); i++)
+        sizes[i] = m_layers[i]->size();
+    carveLayers(ctx.m_block, {&ctx.m_inputs, &ctx.m_outputs}, sizes, batchSize);
+    ctx.m_bits.resize(batchSize * ((m_layers.front()->size() + 63) / 64));
+    ctx.m_capacity = batchSize;
+    ctx.m_planId = m_planId;
+}
+
+void Network::reserveWorkspace(Workspace &ws, size_t batchSize)
+{
+    if (ws.act.m_planId == m_planId && batchSize <= ws.act.m_capacity)
+        return;
+    reserveContext(ws.act, batchSize);
+    std::vector<size_t> sizes(m_layers.size());
+    for (size_t i = 0; i < m_layers.size(); i++)
+        sizes[i] = m_layers[i]->size();
+    carveLayers(ws.block, {&ws.deltas}, sizes, batchSize);
+}
+
+void Network::setPrecision(Precision precision)
+{
+    m_precision = precision;
+    for (auto &link : m_links)
+        link->setPrecision(precision);
+}
+
+Precision Network::precision() const
+{
+    return m_precision;
+}
+
+void Network::setBinaryInput(bool enable)
+{
+    m_binaryInput = enable;
+    for (auto &link : m_links)
+        link->setBinaryInput(enable && link->source() == m_layers.front());
+}
+
+bool Network::binaryInput() const
+{
+    return m_binaryInput;
+}
+
+void Network::setFusion(bool enable)
+{
+    m_fusion = enable;
+}
+
+bool Network::fusion() const
+{
+    return m_fusion;
+}
+
+Network::InferenceContext Network::makeContext(size_t batchSize) const
+{
+    InferenceContext ctx;
+    reserveContext(ctx, std::max<size_t>(batchSize, 1));
+    return ctx;
+}
+
+size_t Network::inputSize() const
+{
+    return m_layers.front()->size();
+}
+
+size_t Network::outputSize() const
+{
+    return m_layers.back()->size();
+}
+
+const std::vector<std::shared_ptr<Network::Layer>> &Network::layers() const
+{
+    return m_layers;
+}
+
+const std::vector<std::shared_ptr<Network::Link>> &Network::links() const
+{
+    return m_links;
+}
+
+#ifdef NN_PROFILE
+// 计时点：未开启计数时 profiler 为空，不读时钟，也不计算代价；每个块里只能用一次
+#define PROFILE_SCOPE(kind, index, n, flops, bytes)                                                     \
+    Profiler *profiler_ = m_profiling ? m_profiler.get() : nullptr;                                 \
+    ProfileScope profileScope_(profiler_, Profiler::Kind::kind, index, n, profiler_ ? double(flops) : 0.0, \
+                               profiler_ ? double(bytes) : 0.0)
+
+// 访存量按 double 估算：参数读一遍，源层输出读，目标层输入读写
+static double linkForwardBytes(const Network::Link &l, size_t n)
+{
+    return 8.0 * (l.paramCount() + n * (l.source()->size() + 2 * l.target()->size()));
+}
+
+// 反向：参数读、梯度读写，dOut 和源层输出读，回传时 dIn 再读写一遍
+static double linkBackwardBytes(const Network::Link &l, size_t n, bool backprop)
+{
+    return 8.0 * (3 * l.paramCount() + n * (l.target()->size() + l.source()->size() * (backprop ? 3 : 1)));
+}
+
+// 融合层：各链接的乘加和偏置，加上激活；目标层输出只写一次
+static double fusedFlops(const std::vector<const Network::DenseLink *> &links, size_t n, size_t cols)
+{
+    double flops = double(n) * cols;
+    for (const Network::DenseLink *l : links)
+        flops += n * l->flopsPerSample();
+    return flops;
+}
+
+static double fusedBytes(const std::vector<const Network::DenseLink *> &links, size_t n, size_t cols)
+{
+    double bytes = 8.0 * n * cols;
+    for (const Network::DenseLink *l : links)
+        bytes += 8.0 * (l->paramCount() + n * l->source()->size());
+    return bytes;
+}
+#else
+#define PROFILE_SCOPE(kind, index, n, flops, bytes)
+#endif
+
+bool Network::canFuse(const FusedLayer &fused, const uint64_t *bits) const
+{
+    if (!m_fusion || fused.links.empty())
+        return 0;
+    for (size_t k = 0; k < fused.links.size(); k++)
+    {
+        const DenseLink *l = fused.links[k];
+        if (l->m_precision != Precision::Double)
+            return 0;
+        // 二值输入时读输入层的链接走 forwardBits 更快
+        if (bits && fused.sources[k] == 0 && !l->m_columns.empty())
+            return 0;
+    }
+    return 1;
+}
+
+void Network::forwardFused(InferenceContext &ctx, const FusedLayer &fused, const Step &step, const double *input, size_t n) const
+{
+    thread_local std::vector<DenseSegment> segs;
+    segs.resize(fused.links.size());
+    for (size_t k = 0; k < fused.links.size(); k++)
+    {
+        const DenseLink *l = fused.links[k];
+        const size_t s = fused.sources[k];
+        segs[k] = {l->m_weights, l->m_bias, s ? ctx.m_outputs[s].data : input, l->m_cols};
+    }
+    const LayerBuffer &out = ctx.m_outputs[step.target];
+    denseFused(segs.data(), segs.size(), step.activation, out.data, n, out.cols);
+}
+
+void Network::forward(InferenceContext &ctx, const double *input, const uint64_t *bits) const
+{
+    forwardBatch(ctx, input, 1, bits);
+}
+
+void Network::forwardBatch(InferenceContext &ctx, const double *input, size_t n, const uint64_t *bits) const
+{
+    const size_t words = (m_layers.front()->size() + 63) / 64;
+    for (const Step &step : m_plan)
+    {
+        // 融合的层在最后一条入链接处一次算完，前面的步骤跳过
+        if (canFuse(m_fused[step.target], bits))
+        {
+            if (step.activates)
+            {
+                PROFILE_SCOPE(LayerForward, step.target, n, fusedFlops(m_fused[step.target].links, n, ctx.m_outputs[step.target].cols),
+                              fusedBytes(m_fused[step.target].links, n, ctx.m_outputs[step.target].cols));
+                forwardFused(ctx, m_fused[step.target], step, input, n);
+            }
+            continue;
+        }
+        const LayerBuffer &z = ctx.m_inputs[step.target];
+        double *zi = z.data;
+        if (step.first)
+            std::fill(zi, zi + n * z.cols, 0.0);
+        const double *in = step.source ? ctx.m_outputs[step.source].data : input;
+        {
+            PROFILE_SCOPE(LinkForward, step.index, n, n * step.link->flopsPerSample(), linkForwardBytes(*step.link, n));
+            if (step.source || !bits || !step.link->forwardBits(bits, words, zi, n))
+            {
+                if (n == 1)
+                    step.link->forward(in, zi);
+                else
+                    step.link->forwardBatch(in, zi, n);
+            }
+        }
+        if (step.activates)
+        {
+            PROFILE_SCOPE(LayerForward, step.target, n, n * z.cols, 16.0 * n * z.cols);
+            activate(step.activation, zi, ctx.m_outputs[step.target].data, n, z.cols);
+        }
+    }
+}
+
+bool Network::predict(std::span<const double> features, std::span<double> outputs, InferenceContext &ctx) const
+{
+    if (features.size() != m_layers.front()->size() || outputs.size() != m_layers.back()->size())
+    {
+        std::cout << "predict Error: size don't match" << std::endl;
+        return 0;
+    }
+    if (!m_compiled)
+    {
+        std::cout << "predict Error: network is not compiled" << std::endl;
+        return 0;
+    }
+    reserveContext(ctx, 1);
+    bool binary = m_binaryInput && packBits(features.data(), 1, features.size(), ctx.m_bits.data());
+    forward(ctx, features.data(), binary ? ctx.m_bits.data() : nullptr);
+    const double *out = ctx.m_outputs.back().data;
+    std::copy(out, out + outputs.size(), outputs.begin());
+    return 1;
+}
+
+bool Network::predict(std::span<const double> features, std::span<double> outputs) const
+{
+    thread_local InferenceContext ctx;
+    return predict(features, outputs, ctx);
+}
+
+// 增量更新的浮点误差会累积，每隔这么多次做一次完整计算
+static constexpr size_t incrementalRefresh = 1024;
+
+bool Network::canUpdateIncrementally() const
+{
+    for (const Step &step : m_plan)
+    {
+        if (step.source)
+            continue;
+        if (step.link->type() != "Dense" || static_cast<const DenseLink *>(step.link)->m_precision != Precision::Double)
+            return 0;
+    }
+    return 1;
+}
+
+uint64_t Network::parameterVersion() const
+{
+    uint64_t version = m_paramVersion;
+    for (const Step &step : m_plan)
+        if (!step.source)
+            version = std::max(version, step.link->m_paramVersion);
+    return version;
+}
+
+void Network::forwardIncremental(InferenceContext &ctx, const double *input, std::span<const size_t> changed) const
+{
+    const size_t inputs = m_layers.front()->size();
+    // 按列更新每个变化要读 rows 个跨行的权重，变化多到一定程度时不如整段重算
+    const uint64_t version = parameterVersion();
+    bool rebuild = ctx.m_partialPlanId != m_planId || ctx.m_partialVersion != version || ctx.m_updates >= incrementalRefresh ||
+                   changed.size() * 8 > inputs;
+    if (ctx.m_partialPlanId != m_planId)
+    {
+        std::vector<size_t> sizes(m_layers.size(), 0);
+        for (const Step &step : m_plan)
+            if (!step.source)
+                sizes[step.target] = m_layers[step.target]->size();
+        carveLayers(ctx.m_partialBlock, {&ctx.m_partial}, sizes, 1);
+        for (size_t i = 0; i < sizes.size(); i++)
+            if (!sizes[i])
+                ctx.m_partial[i].data = nullptr;
+        ctx.m_lastInput.assign(inputs, 0.0);
+        ctx.m_partialPlanId = m_planId;
+    }
+    if (rebuild)
+    {
+        std::fill(ctx.m_partialBlock.begin(), ctx.m_partialBlock.end(), 0.0);
+        for (const Step &step : m_plan)
+        {
+            if (step.source)
+                continue;
+            PROFILE_SCOPE(LinkForward, step.index, 1, step.link->flopsPerSample(), linkForwardBytes(*step.link, 1));
+            step.link->forward(input, ctx.m_partial[step.target].data);
+        }
+        std::copy(input, input + inputs, ctx.m_lastInput.begin());
+        ctx.m_updates = 0;
+        ctx.m_partialVersion = version;
+    }
+    else
+    {
+        ctx.m_changedIdx.clear();
+        ctx.m_changedDelta.clear();
+        for (size_t i : changed)
+        {
+            const double delta = input[i] - ctx.m_lastInput[i];
+            if (delta == 0)
+                continue;
+            ctx.m_lastInput[i] = input[i];
+            ctx.m_changedIdx.push_back(i);
+            ctx.m_changedDelta.push_back(delta);
+        }
+        const size_t count = ctx.m_changedIdx.size();
+        for (const Step &step : m_plan)
+        {
+            if (step.source || !count)
+                continue;
+            const DenseLink *l = static_cast<const DenseLink *>(step.link);
+            double *p = ctx.m_partial[step.target].data;
+            // setBinaryInput 生成过按列存放的权重时读连续的列，否则从行主序权重里跨行取
+            if (!l->m_columns.empty())
+                addColumnsT(l->m_columns.data(), l->m_columnStride, ctx.m_changedIdx.data(), ctx.m_changedDelta.data(), count, p,
+                            l->m_rows);
+            else
+                addColumns(l->m_weights, l->m_cols, ctx.m_changedIdx.data(), ctx.m_changedDelta.data(), count, p, l->m_rows);
+        }
+        ctx.m_updates++;
+    }
+    // 输入层的步骤排在计划最前面（它是第一个入度为 0 的层），各层的第一步若来自输入层，就从累加起步
+    for (const Step &step : m_plan)
+    {
+        const size_t t = step.target;
+        const LayerBuffer &z = ctx.m_inputs[t];
+        if (!step.source)
+        {
+            if (step.first)
+                std::copy(ctx.m_partial[t].data, ctx.m_partial[t].data + z.cols, z.data);
+        }
+        else if (!ctx.m_partial[t].data && canFuse(m_fused[t], nullptr))
+        {
+            if (step.activates)
+            {
+                PROFILE_SCOPE(LayerForward, t, 1, fusedFlops(m_fused[t].links, 1, z.cols), fusedBytes(m_fused[t].links, 1, z.cols));
+                forwardFused(ctx, m_fused[t], step, input, 1);
+            }
+            continue;
+        }
+        else
+        {
+            if (step.first)
+                std::fill(z.data, z.data + z.cols, 0.0);
+            PROFILE_SCOPE(LinkForward, step.index, 1, step.link->flopsPerSample(), linkForwardBytes(*step.link, 1));
+            step.link->forward(ctx.m_outputs[step.source].data, z.data);
+        }
+        if (step.activates)
+        {
+            PROFILE_SCOPE(LayerForward, t, 1, z.cols, 16.0 * z.cols);
+            activate(step.activation, z.data, ctx.m_outputs[t].data, 1, z.cols);
+        }
+    }
+}
+
+bool Network::predictIncremental(std::span<const double> features, std::span<const size_t> changed, std::span<double> outputs,
+                                 InferenceContext &ctx) const
+{
+    if (features.size() != m_layers.front()->size() || outputs.size() != m_layers.back()->size())
+    {
+        std::cout << "predictIncremental Error: size don't match" << std::endl;
+        return 0;
+    }
+    if (!m_compiled)
+    {
+        std::cout << "predictIncremental Error: network is not compiled" << std::endl;
+        return 0;
+    }
+    for (size_t i : changed)
+    {
+        if (i >= features.size())
+        {
+            std::cout << "predictIncremental Error: feature index " << i << " out of range" << std::endl;
+            return 0;
+        }
+    }
+    if (!canUpdateIncrementally())
+        return predict(features, outputs, ctx);
+    reserveContext(ctx, 1);
+    forwardIncremental(ctx, features.data(), changed);
+    const double *out = ctx.m_outputs.back().data;
+    std::copy(out, out + outputs.size(), outputs.begin());
+    return 1;
+}
+
+Sample Network::predict(std::span<const double> features, InferenceContext &ctx) const
+{
+    Sample rtr;
+    rtr.labels.resize(m_layers.back()->size());
+    if (!predict(features, rtr.labels, ctx))
+        return Sample();
+    rtr.features.assign(features.begin(), features.end());
+    return rtr;
+}
+
+Sample Network::predict(std::span<const double> features) const
+{
+    thread_local InferenceContext ctx;
+    return predict(features, ctx);
+}
+
+Sample Network::predict(const Sample &sample, InferenceContext &ctx) const
+{
+    return predict(std::span<const double>(sample.features), ctx);
+}
+
+Sample Network::predict(const Sample &sample) const
+{
+    return predict(std::span<const double>(sample.features));
+}
+
+Matrix Network::predictBatch(const SampleSet &sampleSet, size_t batchSize, InferenceContext &ctx) const
+{
+    if (sampleSet.featureSize != m_layers.front()->size())
+    {
+        std::cout << "predictBatch Error: size don't match" << std::endl;
+        return Matrix();
+    }
+    if (!m_compiled)
+    {
+        std::cout << "predictBatch Error: network is not compiled" << std::endl;
+        return Matrix();
+    }
+    if (batchSize == 0)
+        batchSize = 1;
+    const size_t total = sampleSet.size();
+    batchSize = std::min(batchSize, std::max<size_t>(total, 1));
+    reserveContext(ctx, batchSize);
+    Matrix rtr(total, m_layers.back()->size());
+    for (size_t begin = 0; begin < total; begin += batchSize)
+    {
+        // 样本本身按行连续存放，直接作为输入层的输出，不再拷贝
+        SampleBatch b = sampleSet.batch(begin, batchSize);
+        size_t n = b.rows;
+        // 二值输入优先用样本集打好的位图，没有时按批现打包
+        const uint64_t *bits = nullptr;
+        if (m_binaryInput && sampleSet.featureBits())
+            bits = sampleSet.featureBits() + begin * sampleSet.bitWords();
+        else if (m_binaryInput && packBits(b.features.data(), n, sampleSet.featureSize, ctx.m_bits.data()))
+            bits = ctx.m_bits.data();
+        forwardBatch(ctx, b.features.data(), n, bits);
+        const double *out = ctx.m_outputs.back().data;
+        std::copy(out, out + n * rtr.cols, rtr.row(begin));
+    }
+    return rtr;
+}
+
+Matrix Network::predictBatch(const SampleSet &sampleSet, size_t batchSize) const
+{
+    thread_local InferenceContext ctx;
+    return predictBatch(sampleSet, batchSize, ctx);
+}
+
+bool Network::predictBatch(std::span<const double> features, size_t rows, std::span<double> outputs, InferenceContext &ctx) const
+{
+    const size_t fs = m_layers.front()->size(), os = m_layers.back()->size();
+    if (features.size() < rows * fs || outputs.size() < rows * os)
+    {
+        std::cout << "predictBatch Error: size don't match" << std::endl;
+        return 0;
+    }
+    if (!m_compiled)
+    {
+        std::cout << "predictBatch Error: network is not compiled" << std::endl;
+        return 0;
+    }
+    if (rows == 0)
+        return 1;
+    reserveContext(ctx, rows);
+    bool binary = m_binaryInput && packBits(features.data(), rows, fs, ctx.m_bits.data());
+    forwardBatch(ctx, features.data(), rows, binary ? ctx.m_bits.data() : nullptr);
+    const double *out = ctx.m_outputs.back().data;
+    std::copy(out, out + rows * os, outputs.begin());
+    return 1;
+}
+
+double Network::backwardBatch(Workspace &ws, const double *input, const double *targets, size_t n, double *grad, double scale)
+{
+    // 输出层默认使用均方误差 L = 1/(2N) * sum ||y - t||^2，N 为整个批的大小；
+    // 输出层为 softmax 时使用交叉熵 L = -1/N * sum t * log(y)，两者合并求导，
+    // dL/dz = (y - t) / N 直接写入 delta，跳过 softmax 的雅可比
+    const size_t last = m_layers.size() - 1;
+    const double *y = ws.act.m_outputs[last].data;
+    const double *t = targets;
+    double *dOut = ws.deltas[last].data;
+    const bool crossEntropy = m_outputActivation == Activation::Softmax;
+    double loss = 0;
+    for (size_t e = 0; e < n * m_layers.back()->size(); e++)
+    {
+        double diff = y[e] - t[e];
+        if (crossEntropy)
+            loss -= t[e] > 0 ? t[e] * std::log(std::max(y[e], 1e-300)) : 0;
+        else
+            loss += diff * diff / 2;
+        dOut[e] = diff * scale;
+    }
+    for (size_t i : m_zeroLayers)
+    {
+        if (i == last)
+            continue;
+        const LayerBuffer &m = ws.deltas[i];
+        std::fill(m.data, m.data + n * m.cols, 0.0);
+    }
+    // 逆序遍历计划：某层的出链接都在它的入链接之前完成反向，
+    // 所以遇到带激活的那一步时，该层的 dL/d(输出) 已经收齐
+    for (auto it = m_plan.rbegin(); it != m_plan.rend(); ++it)
+    {
+        const Step &step = *it;
+        double *d = ws.deltas[step.target].data;
+        if (step.activates && !(crossEntropy && step.target == last))
+        {
+            const size_t cols = ws.deltas[step.target].cols;
+            PROFILE_SCOPE(LayerBackward, step.target, n, 2.0 * n * cols, 24.0 * n * cols);
+            activateDeri(step.activation, ws.act.m_outputs[step.target].data, d, n, cols);
+        }
+        PROFILE_SCOPE(LinkBackward, step.index, n, (step.backprop ? 2.0 : 1.0) * n * step.link->flopsPerSample(),
+                      linkBackwardBytes(*step.link, n, step.backprop));
+        step.link->backwardBatch(step.source ? ws.act.m_outputs[step.source].data : input, d,
+                                 step.backprop ? ws.deltas[step.source].data : nullptr,
+                                 grad + step.paramOffset, n);
+    }
+    return loss;
+}
+
+void Network::initArena(const TrainOptions &options, size_t shards)
+{
+    size_t regions = shards;
+    if (options.optimizer == Optimizer::Momentum)
+        regions += 1;
+    else if (options.optimizer == Optimizer::Adam)
+        regions += 2;
+    m_shards = shards;
+    m_arena.assign(regions * m_paramTotal, 0.0);
+}
+
+void Network::reduceShards(ThreadPool &pool)
+{
+    // 两两树形归约到分片 0：每层的各对分片、各参数块互不重叠，无需加锁；
+    // 归约顺序只取决于分片数，所以结果可复现
+    const size_t chunk = 4096;
+    const size_t chunks = (m_paramTotal + chunk - 1) / chunk;
+    for (size_t stride = 1; stride < m_shards; stride *= 2)
+    {
+        const size_t pairs = (m_shards - stride + 2 * stride - 1) / (2 * stride);
+        pool.parallelFor(pairs * chunks, [&](size_t task)
+                         {
+            size_t dst = (task / chunks) * 2 * stride;
+            size_t src = dst + stride;
+            if (src >= m_shards)
+                return;
+            size_t begin = (task % chunks) * chunk;
+            size_t end = std::min(m_paramTotal, begin + chunk);
+            double *d = m_arena.data() + dst * m_paramTotal;
+            const double *s = m_arena.data() + src * m_paramTotal;
+            for (size_t i = begin; i < end; i++)
+                d[i] += s[i]; });
+    }
+}
+
+void Network::applyGradients(const TrainOptions &options, size_t step)
+{
+    const double lr = options.learningRate;
+    // Adam 的偏差修正项
+    const double c1 = 1.0 - std::pow(options.beta1, double(step));
+    const double c2 = 1.0 - std::pow(options.beta2, double(step));
+    double *moments = m_arena.data() + m_shards * m_paramTotal;
+    for (const Step &s : m_plan)
+    {
+        std::span<double> p = s.link->parameters();
+        double *g = m_arena.data() + s.paramOffset;
+        double *m = moments + s.paramOffset;
+        double *v = m + m_paramTotal;
+        switch (options.optimizer)
+        {
+        case Optimizer::SGD:
+            for (size_t i = 0; i < p.size(); i++)
+                p[i] -= lr * g[i];
+            break;
+        case Optimizer::Momentum:
+            for (size_t i = 0; i < p.size(); i++)
+            {
+                m[i] = options.momentum * m[i] + g[i];
+                p[i] -= lr * m[i];
+            }
+            break;
+        case Optimizer::Adam:
+            for (size_t i = 0; i < p.size(); i++)
+            {
+                m[i] = options.beta1 * m[i] + (1 - options.beta1) * g[i];
+                v[i] = options.beta2 * v[i] + (1 - options.beta2) * g[i] * g[i];
+                p[i] -= lr * (m[i] / c1) / (std::sqrt(v[i] / c2) + options.epsilon);
+            }
+            break;
+        }
+    }
+}
+
+bool Network::train(const SampleSet &sampleSet, const TrainOptions &options)
+{
+    if (sampleSet.featureSize != m_layers.front()->size() || sampleSet.labelSize != m_layers.back()->size())
+    {
+        std::cout << "sampleSet size does't match the network" << std::endl;
+        return 0;
+    }
+    if ((!m_compiled || planStale()) && !compile())
+        return 0;
+    const size_t total = sampleSet.size();
+    if (total == 0 || options.batchSize == 0)
+    {
+        std::cout << "train Error: empty sampleSet or batchSize" << std::endl;
+        return 0;
+    }
+    const size_t batchSize = std::min(options.batchSize, total);
+    // 打乱、收集和增强交给预取器，prefetch > 0 时与前向/反向重叠
+    BatchPrefetcher batches(sampleSet, batchSize, options.epochs, options.seed, options.prefetch, options.augment);
+    return trainBatches(batches, batchSize, options);
+}
+
+bool Network::train(SampleStream &stream, const TrainOptions &options)
+{
+    if (stream.featureSize != m_layers.front()->size() || stream.labelSize != m_layers.back()->size())
+    {
+        std::cout << "stream size does't match the network" << std::endl;
+        return 0;
+    }
+    if ((!m_compiled || planStale()) && !compile())
+        return 0;
+    if (!stream.start(options.batchSize, options.epochs, options.seed, options.augment))
+        return 0;
+    if (!trainBatches(stream, options.batchSize, options))
+        return 0;
+    if (stream.failed())
+    {
+        std::cout << "train Error: stream stopped early" << std::endl;
+        return 0;
+    }
+    return 1;
+}
+
+bool Network::trainBatches(BatchSource &batches, size_t batchSize, const TrainOptions &options)
+{
+    const size_t fs = m_layers.front()->size(), ls = m_layers.back()->size();
+    ThreadPool pool(options.threads);
+    // 分片数等于线程数，每个分片对应批内固定的一段样本
+    const size_t shards = std::min(pool.size(), batchSize);
+    if (m_workspaces.size() < shards)
+        m_workspaces.resize(shards);
+    for (size_t w = 0; w < shards; w++)
+    {
+        reserveWorkspace(m_workspaces[w], (batchSize + shards - 1) / shards);
+    }
+    initArena(options, shards);
+    // 参数即将被改写，之前建立的增量前向状态随之作废
+    m_paramVersion = nextParameterVersion();
+    // 前向和反向都要用 double 权重；二值输入的按列权重随训练过期，先丢掉，结束时重新生成
+    for (auto &link : m_links)
+    {
+        link->setPrecision(Precision::Double);
+        link->setBinaryInput(false);
+    }
+    std::vector<double> shardLoss(shards);
+    size_t step = 0, seen = 0;
+    double loss = 0;
+    while (const Minibatch *batch = batches.next())
+    {
+        const size_t n = batch->rows;
+        pool.parallelFor(shards, [&](size_t w)
+                         {
+            // 分片 w 取批内固定的一段连续行，直接作为输入层的输出
+            size_t lo = n * w / shards;
+            size_t hi = n * (w + 1) / shards;
+            double *grad = m_arena.data() + w * m_paramTotal;
+            std::fill(grad, grad + m_paramTotal, 0.0);
+            shardLoss[w] = 0;
+            if (lo == hi)
+                return;
+            const double *input = batch->features.data() + lo * fs;
+            const double *targets = batch->labels.data() + lo * ls;
+            forwardBatch(m_workspaces[w].act, input, hi - lo);
+            shardLoss[w] = backwardBatch(m_workspaces[w], input, targets, hi - lo, grad, 1.0 / n); });
+        reduceShards(pool);
+        for (double l : shardLoss)
+            loss += l;
+        seen += n;
+        applyGradients(options, ++step);
+        if (batch->last)
+        {
+            if (options.verbose)
+                std::cout << "epoch " << batch->epoch + 1 << " loss: " << loss / seen << std::endl;
+            const bool proceed = !options.onEpoch || options.onEpoch(batch->epoch, loss / seen);
+            loss = 0;
+            seen = 0;
+            if (!proceed)
+                break;
+        }
+    }
+    setPrecision(m_precision);
+    setBinaryInput(m_binaryInput);
+    return 1;
+}
+
+double Network::accuracy(const SampleSet &sampleSet) const
+{
+    if (sampleSet.labelSize != m_layers.back()->size())
+    {
+        std::cout << "accuracy Error: size don't match" << std::endl;
+        return 0;
+    }
+    Matrix out = predictBatch(sampleSet, 128);
+    if (out.rows == 0)
+        return 0;
+    size_t correct = 0;
+    for (size_t i = 0; i < out.rows; i++)
+    {
+        std::span<const double> labels = sampleSet.at(i).labels;
+        size_t predicted = std::max_element(out.row(i), out.row(i) + out.cols) - out.row(i);
+        size_t expected = std::max_element(labels.begin(), labels.end()) - labels.begin();
+        correct += predicted == expected;
+    }
+    return double(correct) / out.rows;
+}
+
+bool Network::setProfiling(bool enable, bool trace)
+{
+#ifdef NN_PROFILE
+    if (enable)
+    {
+        if (!m_profiler)
+            m_profiler = std::make_unique<Profiler>();
+        m_profiler->reset(m_layers.size(), m_links.size(), trace);
+    }
+    m_profiling = enable;
+    return 1;
+#else
+    (void)trace;
+    if (enable)
+    {
+        std::cout << "setProfiling Error: built without NN_PROFILE" << std::endl;
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+bool Network::profiling() const
+{
+    return m_profiling;
+}
+
+NetworkProfile Network::profile() const
+{
+    return m_profiler ? m_profiler->snapshot() : NetworkProfile();
+}
+
+bool Network::saveTrace(const std::string &path) const
+{
+    if (!m_profiler)
+    {
+        std::cout << "saveTrace Error: profiling was never enabled" << std::endl;
+        return 0;
+    }
+    std::vector<std::string> layerNames, linkNames;
+    for (size_t i = 0; i < m_layers.size(); i++)
+        layerNames.push_back("Layer " + std::to_string(i) + " " + m_layers[i]->comment + " " + m_layers[i]->activate());
+    for (size_t k = 0; k < m_links.size(); k++)
+    {
+        const Link &l(*m_links[k]);
+        size_t src = std::find(m_layers.begin(), m_layers.end(), l.source()) - m_layers.begin();
+        size_t tgt = std::find(m_layers.begin(), m_layers.end(), l.target()) - m_layers.begin();
+        linkNames.push_back("Link " + std::to_string(k) + " " + l.type() + " " + std::to_string(src) + " -> " + std::to_string(tgt));
+    }
+    if (!m_profiler->writeTrace(path, layerNames, linkNames))
+    {
+        std::cout << "saveTrace Error: couldn't write " << path << std::endl;
+        return 0;
+    }
+    return 1;
+}
+
+// 一行计数：调用次数、样本数、总时间、按估算换算的 GFLOP/s 和 GB/s
+static void printCounter(const char *what, const ProfileCounter &c)
+{
+    if (!c.calls)
+        return;
+    std::cout << "    " << what << ": calls " << c.calls << " samples " << c.samples << " time " << c.seconds * 1e3
+              << " ms " << c.flops / c.seconds * 1e-9 << " GFLOP/s " << c.bytes / c.seconds * 1e-9 << " GB/s" << std::endl;
+}
+
+void Network::printLayersInfo()
+{
+    NetworkProfile p = profile();
+    for (size_t i = 0; i < m_layers.size(); i++)
+    {
+        const Layer &l(*m_layers.at(i));
+        std::cout << "Layer " << i << " " << l.comment << " shape: [";
+        for (size_t j = 0; j < l.shape().size(); j++)
+        {
+            std::cout << (j ? "," : "") << l.shape().at(j);
+        }
+        std::cout << "] size: " << l.size() << " activate: " << l.activate() << std::endl;
+        if (i < p.layerForward.size())
+        {
+            printCounter("forward", p.layerForward[i]);
+            printCounter("backward", p.layerBackward[i]);
+        }
+    }
+}
+
+void Network::printLinksInfo()
+{
+    NetworkProfile p = profile();
+    for (size_t k = 0; k < m_links.size(); k++)
+    {
+        const Link &l(*m_links.at(k));
+        size_t src = std::find(m_layers.begin(), m_layers.end(), l.source()) - m_layers.begin();
+        size_t tgt = std::find(m_layers.begin(), m_layers.end(), l.target()) - m_layers.begin();
+        std::cout << "Link " << k << " " << l.type() << " " << src << " -> " << tgt
+                  << " params: " << l.paramCount() << std::endl;
+        if (k < p.linkForward.size())
+        {
+            printCounter("forward", p.linkForward[k]);
+            printCounter("backward", p.linkBackward[k]);
+        }
+    }
+}
+
+static const uint32_t modelMagic = 0x20041022;
+
+#pragma pack(push, 1)
+// v2 的链接记录，前面是 u32 长度 + 类型名；偏移都从文件头算起并按 64 字节对齐
+struct LinkRecord
+{
+    uint32_t source;        // 源层在层表中的下标
+    uint32_t target;        // 目标层下标
+    uint64_t paramOffset;   // parameters() 的原样拷贝
+    uint64_t paramCount;
+    uint64_t synapseOffset; // u64 对：Synapse / Sparse 为 (from, to)；Conv 为 (kh, kw) (sh, sw) (ph, pw)，Pool 为 (wh, ww) (sh, sw) (mode, 0)
+    uint64_t synapseCount;
+};
+#pragma pack(pop)
+
+static void writeString(std::ostream &os, const std::string &s)
+{
+    uint32_t len = static_cast<uint32_t>(s.size());
+    os.write(reinterpret_cast<const char *>(&len), sizeof(len));
+    os.write(s.data(), len);
+}
+
+// 在 [p, end) 内按顺序读取，越界时抛出
+struct ModelReader
+{
+    const char *p;
+    const char *end;
+    template <typename T>
+    T read()
+    {
+        T v;
+        need(sizeof(T));
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+    std::string readString()
+    {
+        uint32_t len = read<uint32_t>();
+        need(len);
+        std::string s(p, len);
+        p += len;
+        return s;
+    }
+    void need(size_t n)
+    {
+        if (size_t(end - p) < n)
+            throw std::runtime_error("model file is truncated");
+    }
+};
+
+bool Network::saveModel(const std::string &path) const
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+    {
+        std::cout << "savingModelError: " << "couldn't open file " << path << std::endl;
+        return 0;
+    }
+    FileHeader header{};
+    header.magic = modelMagic;
+    header.version = 2;
+    header.num_layers = static_cast<uint32_t>(m_layers.size());
+    header.num_links = static_cast<uint32_t>(m_links.size());
+
+    // 先把元数据写进内存，算出数据区的起点后再写链接记录里的偏移
+    std::ostringstream meta;
+    meta.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeString(meta, comment);
+    // 层表顺序即 m_layers 的顺序：第一层是输入层，最后一层是输出层
+    for (const auto &layer : m_layers)
+    {
+        writeString(meta, layer->comment);
+        writeString(meta, layer->activate());
+        uint32_t shapeLen = static_cast<uint32_t>(layer->shape().size());
+        meta.write(reinterpret_cast<const char *>(&shapeLen), sizeof(shapeLen));
+        for (size_t dim : layer->shape())
+        {
+            uint64_t d = dim;
+            meta.write(reinterpret_cast<const char *>(&d), sizeof(d));
+        }
+    }
+    size_t metaSize = size_t(meta.tellp());
+    for (const auto &link : m_links)
+        metaSize += sizeof(uint32_t) + link->type().size() + sizeof(LinkRecord);
+
+    auto alignTo64 = [](uint64_t n)
+    { return (n + 63) & ~uint64_t(63); };
+    // 每个链接附加块里的 u64 对，Dense 没有附加块
+    auto extraPairs = [](const Link &link)
+    {
+        std::vector<uint64_t> pairs;
+        if (link.type() == "Conv")
+        {
+            const auto &c = static_cast<const ConvLink &>(link);
+            pairs = {c.m_kh, c.m_kw, c.m_sh, c.m_sw, c.m_ph, c.m_pw};
+        }
+        else if (link.type() == "Pool")
+        {
+            const auto &p = static_cast<const PoolLink &>(link);
+            pairs = {p.m_wh, p.m_ww, p.m_sh, p.m_sw, uint64_t(p.m_mode), 0};
+        }
+        else if (link.type() != "Dense")
+        {
+            for (const Link::Synapse &s : link.m_synapses)
+            {
+                pairs.push_back(s.fromIdx);
+                pairs.push_back(s.toIdx);
+            }
+        }
+        return pairs;
+    };
+    std::vector<LinkRecord> records(m_links.size());
+    std::vector<std::vector<uint64_t>> extras(m_links.size());
+    uint64_t offset = alignTo64(metaSize);
+    for (size_t k = 0; k < m_links.size(); k++)
+    {
+        Link &link = *m_links[k];
+        LinkRecord &r = records[k];
+        r.source = uint32_t(std::find(m_layers.begin(), m_layers.end(), link.source()) - m_layers.begin());
+        r.target = uint32_t(std::find(m_layers.begin(), m_layers.end(), link.target()) - m_layers.begin());
+        r.paramOffset = offset;
+        r.paramCount = link.parameters().size();
+        offset = alignTo64(offset + r.paramCount * sizeof(double));
+        extras[k] = extraPairs(link);
+        r.synapseCount = extras[k].size() / 2;
+        r.synapseOffset = r.synapseCount ? offset : 0;
+        offset = alignTo64(offset + r.synapseCount * 2 * sizeof(uint64_t));
+        writeString(meta, link.type());
+        meta.write(reinterpret_cast<const char *>(&r), sizeof(r));
+    }
+
+    static const char zeros[64] = {};
+    std::string metaBytes = meta.str();
+    ofs.write(metaBytes.data(), metaBytes.size());
+    uint64_t written = metaBytes.size();
+    auto padTo = [&](uint64_t pos)
+    {
+        ofs.write(zeros, pos - written);
+        written = pos;
+    };
+    for (size_t k = 0; k < m_links.size(); k++)
+    {
+        Link &link = *m_links[k];
+        const LinkRecord &r = records[k];
+        padTo(r.paramOffset);
+        std::span<double> params = link.parameters();
+        ofs.write(reinterpret_cast<const char *>(params.data()), params.size_bytes());
+        written += params.size_bytes();
+        if (r.synapseCount)
+        {
+            padTo(r.synapseOffset);
+            ofs.write(reinterpret_cast<const char *>(extras[k].data()), extras[k].size() * sizeof(uint64_t));
+            written += r.synapseCount * sizeof(uint64_t) * 2;
+        }
+    }
+    padTo(offset);
+    return bool(ofs);
+}
+
+Network::Network(std::string path)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path, 1))
+        throw std::runtime_error("couldn't open model file " + path);
+    FileHeader header;
+    if (file->size() < sizeof(header))
+        throw std::runtime_error(path + " is too small for a model header");
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.magic != modelMagic)
+        throw std::runtime_error(path + " is not a .nll model");
+    if (header.version == 1)
+        loadModelV1(file->data(), file->size());
+    else if (header.version == 2)
+        loadModelV2(file);
+    else
+        throw std::runtime_error(path + " has unsupported model version " + std::to_string(header.version));
+    compile();
+}
+
+void Network::loadModelV2(std::shared_ptr<MappedFile> file)
+{
+    ModelReader in{file->data(), file->data() + file->size()};
+    FileHeader header = in.read<FileHeader>();
+    if (header.num_layers < 2)
+        throw std::runtime_error("model needs at least an input and an output layer");
+    comment = in.readString();
+    for (uint32_t i = 0; i < header.num_layers; i++)
+    {
+        std::string name = in.readString();
+        std::string activate = in.readString();
+        Activation parsed;
+        if (!parseActivation(activate, parsed))
+            throw std::runtime_error("unknown activation " + activate);
+        std::vector<size_t> shape(in.read<uint32_t>());
+        for (size_t &dim : shape)
+            dim = in.read<uint64_t>();
+        m_layers.push_back(std::make_shared<Layer>(shape, activate));
+        m_layers.back()->comment = name;
+    }
+    for (uint32_t k = 0; k < header.num_links; k++)
+    {
+        std::string type = in.readString();
+        LinkRecord r = in.read<LinkRecord>();
+        if (r.source >= m_layers.size() || r.target >= m_layers.size())
+            throw std::runtime_error("link refers to a missing layer");
+        const auto &source = m_layers[r.source];
+        const auto &target = m_layers[r.target];
+        ModelReader block{file->data(), file->data() + file->size()};
+        if (r.paramOffset % 64 || r.paramOffset > file->size())
+            throw std::runtime_error("link parameters are misaligned or out of the file");
+        block.p += r.paramOffset;
+        block.need(r.paramCount * sizeof(double));
+        double *params = reinterpret_cast<double *>(file->data() + r.paramOffset);
+        if (type == "Dense")
+        {
+            if (r.paramCount != DenseLink::storageSize(target->size(), source->size()))
+                throw std::runtime_error("dense link size doesn't match its layers");
+            m_links.push_back(std::shared_ptr<DenseLink>(new DenseLink(source, target, file, params)));
+        }
+        else if (type == "Sparse")
+        {
+            if (r.paramCount != SparseLink::storageSize(r.synapseCount, target->size()))
+                throw std::runtime_error("sparse link size doesn't match its connections");
+            ModelReader syn{file->data() + std::min<uint64_t>(r.synapseOffset, file->size()), file->data() + file->size()};
+            std::vector<Link::Synapse> synapses(r.synapseCount);
+            for (uint64_t s = 0; s < r.synapseCount; s++)
+            {
+                uint64_t from = syn.read<uint64_t>(), to = syn.read<uint64_t>();
+                // 按 (目标, 源) 严格递增才能直接作为 CSR 使用
+                bool ordered = s == 0 || std::pair(to, from) > std::pair<uint64_t, uint64_t>(synapses[s - 1].toIdx, synapses[s - 1].fromIdx);
+                if (from >= source->size() || to >= target->size() || !ordered)
+                    throw std::runtime_error("sparse link connections are out of range or out of order");
+                synapses[s] = {size_t(from), size_t(to)};
+            }
+            m_links.push_back(std::shared_ptr<SparseLink>(new SparseLink(source, target, file, params, std::move(synapses))));
+        }
+        else if (type == "Conv" || type == "Pool")
+        {
+            if (r.synapseCount != 3)
+                throw std::runtime_error(type + " link is missing its geometry");
+            ModelReader geo{file->data() + std::min<uint64_t>(r.synapseOffset, file->size()), file->data() + file->size()};
+            size_t g[6];
+            for (size_t &v : g)
+                v = size_t(geo.read<uint64_t>());
+            if (type == "Conv")
+            {
+                auto link = std::shared_ptr<ConvLink>(new ConvLink(source, target, {g[0], g[1]}, {g[2], g[3]}, {g[4], g[5]}, file, params));
+                if (!link->outChannels() || r.paramCount != ConvLink::storageSize(link->outChannels(), link->patchSize()))
+                    throw std::runtime_error("conv link doesn't match its layers");
+                m_links.push_back(link);
+            }
+            else
+            {
+                if (g[4] > size_t(Pooling::Average) || r.paramCount)
+                    throw std::runtime_error("pool link has an unknown mode or stray parameters");
+                auto link = std::make_shared<PoolLink>(source, target, std::vector<size_t>{g[0], g[1]}, Pooling(g[4]), std::vector<size_t>{g[2], g[3]});
+                if (!link->m_c)
+                    throw std::runtime_error("pool link doesn't match its layers");
+                m_links.push_back(link);
+            }
+        }
+        else if (type == "Synapse")
+        {
+            if (r.paramCount != r.synapseCount)
+                throw std::runtime_error("synapse link has mismatched weight count");
+            ModelReader syn{file->data() + std::min<uint64_t>(r.synapseOffset, file->size()), file->data() + file->size()};
+            auto link = std::make_shared<Link>(source, target);
+            for (uint64_t s = 0; s < r.synapseCount; s++)
+            {
+                uint64_t from = syn.read<uint64_t>(), to = syn.read<uint64_t>();
+                if (!link->addSynapse(from, to, params[s]))
+                    throw std::runtime_error("synapse index out of layer size");
+            }
+            m_links.push_back(link);
+        }
+        else
+            throw std::runtime_error("unknown link type " + type);
+    }
+}
+
+// v1：二进制的文件头和层表（层名 + 形状），之后每个链接一段文本：
+// [Link:src=名,tgt=名,activation=...] / Type=Dense / Synapses= / "from,to,weight,bias" 每行一个突触 / EndSynapses
+void Network::loadModelV1(const char *data, size_t size)
+{
+    ModelReader in{data, data + size};
+    FileHeader header = in.read<FileHeader>();
+    std::unordered_map<std::string, std::shared_ptr<Layer>> byName;
+    std::vector<std::shared_ptr<Layer>> layers;
+    for (uint32_t i = 0; i < header.num_layers; i++)
+    {
+        std::string name = in.readString();
+        std::vector<size_t> shape(in.read<uint32_t>());
+        for (size_t &dim : shape)
+            dim = in.read<uint64_t>();
+        layers.push_back(std::make_shared<Layer>(shape));
+        layers.back()->comment = name;
+        byName[name] = layers.back();
+    }
+
+    std::istringstream text(std::string(in.p, in.end));
+    std::string line;
+    std::vector<std::shared_ptr<Link>> links;
+    for (uint32_t k = 0; k < header.num_links; k++)
+    {
+        while (std::getline(text, line) && line.rfind("[Link:", 0) != 0)
+            ;
+        if (!text)
+            throw std::runtime_error("model file has fewer links than its header says");
+        auto field = [&](const std::string &key)
+        {
+            size_t b = line.find(key + "=");
+            if (b == std::string::npos)
+                return std::string();
+            b += key.size() + 1;
+            return line.substr(b, line.find_first_of(",]", b) - b);
+        };
+        auto source = byName[field("src")];
+        auto target = byName[field("tgt")];
+        if (!source || !target)
+            throw std::runtime_error("link refers to a missing layer: " + line);
+        std::string activate = field("activation");
+        if (!activate.empty())
+        {
+            Activation parsed;
+            if (!parseActivation(activate, parsed))
+                throw std::runtime_error("unknown activation " + activate);
+            target->m_activate = activate;
+        }
+
+        std::string type = "Dense";
+        struct Entry
+        {
+            size_t a, b;
+            double weight, bias;
+        };
+        std::vector<Entry> entries;
+        while (std::getline(text, line) && line.rfind("EndSynapses", 0) != 0)
+        {
+            if (line.rfind("Type=", 0) == 0)
+                type = line.substr(5);
+            Entry e;
+            char c1, c2, c3;
+            std::istringstream ls(line);
+            if (ls >> e.a >> c1 >> e.b >> c2 >> e.weight >> c3 >> e.bias && c1 == ',' && c2 == ',' && c3 == ',')
+                entries.push_back(e);
+        }
+
+        // 旧版写出的 from/to 有时互换，按层大小判断哪种解释成立
+        const size_t src = source->size(), tgt = target->size();
+        bool fits = 1, fitsSwapped = 1;
+        for (const Entry &e : entries)
+        {
+            fits = fits && e.a < src && e.b < tgt;
+            fitsSwapped = fitsSwapped && e.b < src && e.a < tgt;
+        }
+        if (!fits && !fitsSwapped)
+            throw std::runtime_error("synapse index out of layer size");
+        auto fromTo = [&](const Entry &e)
+        { return fits ? std::pair{e.a, e.b} : std::pair{e.b, e.a}; };
+
+        if (type == "Dense")
+        {
+            auto link = std::make_shared<DenseLink>(source, target);
+            // v1 每个突触带一个偏置，前向时对目标神经元的贡献是它们的和
+            for (const Entry &e : entries)
+            {
+                auto [from, to] = fromTo(e);
+                link->weights()[to * src + from] = e.weight;
+                link->bias()[to] += e.bias;
+            }
+            links.push_back(link);
+        }
+        else
+        {
+            auto link = std::make_shared<Link>(source, target);
+            for (const Entry &e : entries)
+            {
+                auto [from, to] = fromTo(e);
+                link->addSynapse(from, to, e.weight);
+            }
+            links.push_back(link);
+        }
+    }
+
+    // v1 按名字存层，输入/输出层优先认 inputLayer/outputLayer，否则取没有入链接/出链接的层
+    auto input = byName["inputLayer"], output = byName["outputLayer"];
+    for (const auto &layer : layers)
+    {
+        bool hasIn = 0, hasOut = 0;
+        for (const auto &link : links)
+        {
+            hasIn = hasIn || link->target() == layer;
+            hasOut = hasOut || link->source() == layer;
+        }
+        if (!input && !hasIn)
+            input = layer;
+        if (!output && !hasOut)
+            output = layer;
+    }
+    if (!input || !output)
+        throw std::runtime_error("couldn't tell the input and output layers apart");
+    m_layers.push_back(input);
+    for (const auto &layer : layers)
+        if (layer != input && layer != output)
+            m_layers.push_back(layer);
+    m_layers.push_back(output);
+    m_links = std::move(links);
+}
+
+static const double pow10Table[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// 解析 [p, end) 开头的一个数字。"0.0000" 这类不超过 15 位有效数字的定点小数直接按整数尾数 / 10^k 计算，
+// 两个操作数都精确可表示，结果与 from_chars 一致；其余格式（指数等）交给 from_chars
+static inline const char *parseNumber(const char *p, const char *end, double &value)
+{
+    const char *s = p;
+    bool neg = 0;
+    if (s < end && *s == '-')
+    {
+        neg = 1;
+        s++;
+    }
+    uint64_t mant = 0;
+    int digits = 0;
+    int frac = 0;
+    while (s < end && unsigned(*s - '0') < 10)
+    {
+        mant = mant * 10 + unsigned(*s - '0');
+        s++;
+        digits++;
+    }
+    if (s < end && *s == '.')
+    {
+        s++;
+        while (s < end && unsigned(*s - '0') < 10)
+        {
+            mant = mant * 10 + unsigned(*s - '0');
+            s++;
+            digits++;
+            frac++;
+        }
+    }
+    if (digits > 0 && digits <= 15 && (s == end || isBlank(*s) || *s == '\n'))
+    {
+        double v = double(mant) / pow10Table[frac];
+        value = neg ? -v : v;
+        return s;
+    }
+    auto [q, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc() || (q != end && !isBlank(*q) && *q != '\n'))
+        return nullptr;
+    return q;
+}
+
+// 解析一行，特征与标签直接写进目标行；列数不对或有非法数字时返回 false
+static bool parseSampleLine(const char *p, const char *end, double *features, size_t featureSize,
+                            double *labels, size_t labelSize, bool &badNumber)
+{
+    const size_t total = featureSize + labelSize;
+    size_t count = 0;
+    while (1)
+    {
+        while (p < end && isBlank(*p))
+            p++;
+        if (p == end)
+            break;
+        if (count == total)
+            return 0;
+        double &dst = count < featureSize ? features[count] : labels[count - featureSize];
+        p = parseNumber(p, end, dst);
+        if (!p)
+        {
+            badNumber = 1;
+            return 0;
+        }
+        count++;
+    }
+    return count == total;
+}
+
+bool loadSamples(std::string path, SampleSet &samples, size_t threads)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        std::cout << "loadingSamplesError: " << "couldn't open file " << path << std::endl;
+        return 0;
+    }
+    samples.clear();
+    const char *data = file.data();
+    const size_t size = file.size();
+    ThreadPool pool(threads);
+
+    // 切成若干块，每块的起点都挪到行首
+    const size_t chunkCount = std::max<size_t>(1, std::min(pool.size() * 4, size / (1 << 16)));
+    std::vector<size_t> bounds(chunkCount + 1, size);
+    bounds[0] = 0;
+    for (size_t c = 1; c < chunkCount; c++)
+    {
+        size_t pos = std::max(bounds[c - 1], size * c / chunkCount);
+        const void *nl = pos < size ? std::memchr(data + pos, '\n', size - pos) : nullptr;
+        bounds[c] = nl ? static_cast<const char *>(nl) - data + 1 : size;
+    }
+
+    // 第一遍：数每块的行数，得到每块在 SampleSet 里的起始行
+    std::vector<size_t> lines(chunkCount), offsets(chunkCount + 1), valid(chunkCount);
+    pool.parallelFor(chunkCount, [&](size_t c)
+                     {
+        const char *b = data + bounds[c], *e = data + bounds[c + 1];
+        lines[c] = std::count(b, e, '\n') + (e > b && e[-1] != '\n'); });
+    for (size_t c = 0; c < chunkCount; c++)
+        offsets[c + 1] = offsets[c] + lines[c];
+    samples.resize(offsets[chunkCount]);
+
+    // 第二遍：各块并行解析，合法行紧凑地写到本块区间的开头
+    const size_t fs = samples.featureSize, ls = samples.labelSize;
+    double *features = samples.featureData();
+    double *labels = samples.labelData();
+    std::vector<char> badNumbers(chunkCount);
+    pool.parallelFor(chunkCount, [&](size_t c)
+                     {
+        const char *p = data + bounds[c], *e = data + bounds[c + 1];
+        size_t row = offsets[c];
+        bool bad = 0;
+        while (p < e)
+        {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', e - p));
+            const char *le = nl ? nl : e;
+            if (parseSampleLine(p, le, features + row * fs, fs, labels + row * ls, ls, bad))
+                row++;
+            p = nl ? nl + 1 : e;
+        }
+        valid[c] = row - offsets[c];
+        badNumbers[c] = bad; });
+
+    // 第三遍：把各块的合法行依次前移，去掉被跳过的行留下的空位
+    size_t rows = 0;
+    for (size_t c = 0; c < chunkCount; c++)
+    {
+        if (rows != offsets[c] && valid[c])
+        {
+            std::memmove(features + rows * fs, features + offsets[c] * fs, valid[c] * fs * sizeof(double));
+            std::memmove(labels + rows * ls, labels + offsets[c] * ls, valid[c] * ls * sizeof(double));
+        }
+        rows += valid[c];
+    }
+    samples.resize(rows);
+    if (std::find(badNumbers.begin(), badNumbers.end(), 1) != badNumbers.end())
+        std::cerr << "无效参数: " << path << " 中含非法数字的行已跳过" << std::endl;
+    if (samples.size())
+        return 1;
+    else
+    {
+        std::cout << "file: " << path << " has no line match sample" << std::endl;
+        return 0;
+    }
+}
+
+static const uint32_t datasetMagic = 0x4E4C4453;
+
+static uint64_t alignTo64(uint64_t n)
+{
+    return (n + 63) & ~uint64_t(63);
+}
+
+// 每行特征在文件中占的字节数
+static size_t featureRowBytes(SampleType type, size_t featureSize)
+{
+    switch (type)
+    {
+    case SampleType::U8:
+        return featureSize;
+    case SampleType::Bit:
+        return (featureSize + 7) / 8;
+    default:
+        return featureSize * sizeof(double);
+    }
+}
+
+// 检查文件头与文件大小是否自洽、尺寸是否与期望一致；loadSamplesBinary 和 SampleStream 共用
+static bool checkDatasetHeader(const DatasetHeader &header, uint64_t fileSize, size_t featureSize, size_t labelSize,
+                               const std::string &path)
+{
+    if (header.magic != datasetMagic || header.version != 1 || header.featureType > SampleType::Bit)
+    {
+        std::cout << "loadingSamplesError: " << path << " is not a version 1 dataset" << std::endl;
+        return 0;
+    }
+    if (header.featureSize != featureSize || header.labelSize != labelSize)
+    {
+        std::cout << "loadingSamplesError: " << path << " holds " << header.featureSize << "/" << header.labelSize
+                  << " features/labels, set expects " << featureSize << "/" << labelSize << std::endl;
+        return 0;
+    }
+    const uint64_t rows = header.rows;
+    const size_t rowBytes = featureRowBytes(header.featureType, featureSize);
+    if (header.featureOffset % 64 || header.labelOffset % 64 || header.featureOffset < sizeof(header) ||
+        header.labelOffset < header.featureOffset + rows * rowBytes ||
+        fileSize < header.labelOffset + rows * labelSize * sizeof(double))
+    {
+        std::cout << "loadingSamplesError: " << path << " is truncated or corrupt" << std::endl;
+        return 0;
+    }
+    return 1;
+}
+
+// 把 rows 行 u8 / bit 格式的特征解码成 double
+static void decodeFeatureRows(SampleType type, const uint8_t *src, size_t rows, size_t featureSize, double *features)
+{
+    const size_t rowBytes = featureRowBytes(type, featureSize);
+    for (size_t r = 0; r < rows; r++, src += rowBytes, features += featureSize)
+    {
+        if (type == SampleType::U8)
+            for (size_t i = 0; i < featureSize; i++)
+                features[i] = src[i];
+        else
+            for (size_t i = 0; i < featureSize; i++)
+                features[i] = (src[i / 8] >> (i % 8)) & 1;
+    }
+}
+
+bool saveSamplesBinary(std::string path, const SampleSet &samples, SampleType featureType)
+{
+    const size_t fs = samples.featureSize, ls = samples.labelSize, rows = samples.size();
+    const size_t rowBytes = featureRowBytes(featureType, fs);
+    const double *features = samples.featureData();
+    std::vector<char> block(featureType == SampleType::F64 ? 0 : rows * rowBytes);
+    for (size_t i = 0; featureType != SampleType::F64 && i < rows * fs; i++)
+    {
+        double v = features[i];
+        bool exact = featureType == SampleType::U8 ? (v >= 0 && v <= 255 && v == std::floor(v)) : (v == 0 || v == 1);
+        if (!exact)
+        {
+            std::cout << "savingSamplesError: " << "feature " << v << " can't be stored exactly as "
+                      << (featureType == SampleType::U8 ? "u8" : "bit") << std::endl;
+            return 0;
+        }
+        if (featureType == SampleType::U8)
+            block[i] = static_cast<char>(static_cast<uint8_t>(v));
+        else if (v == 1)
+            block[i / fs * rowBytes + i % fs / 8] |= char(1 << (i % fs % 8));
+    }
+
+    DatasetHeader header{};
+    header.magic = datasetMagic;
+    header.version = 1;
+    header.featureType = featureType;
+    header.rows = rows;
+    header.featureSize = static_cast<uint32_t>(fs);
+    header.labelSize = static_cast<uint32_t>(ls);
+    header.featureOffset = alignTo64(sizeof(DatasetHeader));
+    header.labelOffset = alignTo64(header.featureOffset + rows * rowBytes);
+
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+    {
+        std::cout << "savingSamplesError: " << "couldn't open file " << path << std::endl;
+        return 0;
+    }
+    static const char zeros[64] = {};
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(zeros, header.featureOffset - sizeof(header));
+    if (featureType == SampleType::F64)
+        ofs.write(reinterpret_cast<const char *>(features), rows * rowBytes);
+    else
+        ofs.write(block.data(), block.size());
+    ofs.write(zeros, header.labelOffset - header.featureOffset - rows * rowBytes);
+    ofs.write(reinterpret_cast<const char *>(samples.labelData()), rows * ls * sizeof(double));
+    return bool(ofs);
+}
+
+bool loadSamplesBinary(std::string path, SampleSet &samples)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path))
+    {
+        std::cout << "loadingSamplesError: " << "couldn't open file " << path << std::endl;
+        return 0;
+    }
+    DatasetHeader header;
+    if (file->size() < sizeof(header))
+    {
+        std::cout << "loadingSamplesError: " << path << " is too small for a dataset header" << std::endl;
+        return 0;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (!checkDatasetHeader(header, file->size(), samples.featureSize, samples.labelSize, path))
+        return 0;
+    const size_t ls = header.labelSize, rows = header.rows;
+
+    samples.clear();
+    const char *base = file->data();
+    if (header.featureType == SampleType::F64)
+    {
+        samples.m_size = rows;
+        samples.m_featureView = reinterpret_cast<const double *>(base + header.featureOffset);
+        samples.m_labelView = reinterpret_cast<const double *>(base + header.labelOffset);
+        samples.m_mapping = std::move(file);
+        return 1;
+    }
+
+    // 压缩格式没法原地使用，解码到自有缓冲区
+    samples.resize(rows);
+    decodeFeatureRows(header.featureType, reinterpret_cast<const uint8_t *>(base + header.featureOffset), rows,
+                      samples.featureSize, samples.featureData());
+    std::memcpy(samples.labelData(), base + header.labelOffset, rows * ls * sizeof(double));
+    if (header.featureType == SampleType::Bit)
+        samples.packFeatureBits();
+    return 1;
+}
+
+bool convertSamples(std::string csvPath, std::string binPath, size_t featureSize, size_t labelSize, SampleType featureType)
+{
+    SampleSet samples(featureSize, labelSize);
+    if (!loadSamples(csvPath, samples))
+        return 0;
+    return saveSamplesBinary(binPath, samples, featureType);
+}
+
+SampleStream::SampleStream(size_t featureSize_, size_t labelSize_, StreamOptions options)
+    : m_options(options), featureSize(featureSize_), labelSize(labelSize_)
+{
+    m_options.shardBytes = std::max<size_t>(m_options.shardBytes, 1);
+    m_options.shuffleRows = std::max<size_t>(m_options.shuffleRows, 1);
+}
+
+SampleStream::~SampleStream()
+{
+    if (m_loading.valid())
+        m_loading.wait();
+}
+
+bool SampleStream::open(const std::string &path)
+{
+    if (m_loading.valid())
+        m_loading.wait();
+    m_loading = std::future<void>();
+    m_path.clear();
+    m_epochs = m_epoch = 0;
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    if (!ifs)
+    {
+        std::cout << "SampleStream Error: couldn't open file " << path << std::endl;
+        return 0;
+    }
+    m_fileSize = static_cast<uint64_t>(ifs.tellg());
+    ifs.seekg(0);
+    DatasetHeader header{};
+    m_binary = m_fileSize >= sizeof(header) && ifs.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+               header.magic == datasetMagic;
+    if (m_binary)
+    {
+        if (!checkDatasetHeader(header, m_fileSize, featureSize, labelSize, path))
+            return 0;
+        m_header = header;
+        m_rowBytes = featureRowBytes(header.featureType, featureSize);
+        // 分片按整行切，特征和标签合起来不超过 shardBytes
+        m_shardRows = std::max<size_t>(1, m_options.shardBytes / (m_rowBytes + labelSize * sizeof(double)));
+        m_shardCount = (header.rows + m_shardRows - 1) / m_shardRows;
+    }
+    else
+        m_shardCount = (m_fileSize + m_options.shardBytes - 1) / m_options.shardBytes;
+    m_path = path;
+    return 1;
+}
+
+// 在后台线程里调用，只读成员里打开后不再变化的部分，写 out
+bool SampleStream::loadShard(size_t shard, Shard &out) const
+{
+    std::ifstream ifs(m_path, std::ios::binary);
+    if (!ifs)
+        return 0;
+    const size_t fs = featureSize, ls = labelSize;
+    out.rows = 0;
+    out.badNumber = 0;
+    if (m_binary)
+    {
+        const uint64_t begin = uint64_t(shard) * m_shardRows;
+        const size_t rows = std::min<uint64_t>(m_shardRows, m_header.rows - begin);
+        out.features.resize(rows * fs);
+        out.labels.resize(rows * ls);
+        ifs.seekg(m_header.featureOffset + begin * m_rowBytes);
+        if (m_header.featureType == SampleType::F64)
+            ifs.read(reinterpret_cast<char *>(out.features.data()), rows * m_rowBytes);
+        else
+        {
+            out.raw.resize(rows * m_rowBytes);
+            ifs.read(out.raw.data(), out.raw.size());
+            decodeFeatureRows(m_header.featureType, reinterpret_cast<const uint8_t *>(out.raw.data()), rows, fs,
+                              out.features.data());
+        }
+        ifs.seekg(m_header.labelOffset + begin * ls * sizeof(double));
+        ifs.read(reinterpret_cast<char *>(out.labels.data()), rows * ls * sizeof(double));
+        if (!ifs)
+            return 0;
+        out.rows = rows;
+        return 1;
+    }
+
+    // CSV 分片 k 负责起点落在 [k*S, (k+1)*S) 的行：从前一个字节读起以判断行首，最后一行读到换行为止
+    const uint64_t begin = uint64_t(shard) * m_options.shardBytes;
+    const uint64_t end = std::min<uint64_t>(begin + m_options.shardBytes, m_fileSize);
+    const uint64_t from = begin ? begin - 1 : 0;
+    out.raw.resize(end - from);
+    ifs.seekg(from);
+    if (!ifs.read(out.raw.data(), out.raw.size()))
+        return 0;
+    size_t start = 0;
+    if (begin)
+    {
+        const void *nl = std::memchr(out.raw.data(), '\n', out.raw.size());
+        if (!nl)
+            return 1; // 整个分片都在上一个分片的最后一行里
+        start = static_cast<const char *>(nl) - out.raw.data() + 1;
+    }
+    if (start == out.raw.size())
+        return 1;
+    for (uint64_t pos = end; out.raw.back() != '\n' && pos < m_fileSize;)
+    {
+        const size_t more = std::min<uint64_t>(4096, m_fileSize - pos);
+        const size_t old = out.raw.size();
+        out.raw.resize(old + more);
+        if (!ifs.read(out.raw.data() + old, more))
+            return 0;
+        const void *nl = std::memchr(out.raw.data() + old, '\n', more);
+        if (nl)
+            out.raw.resize(static_cast<const char *>(nl) - out.raw.data() + 1);
+        pos += more;
+    }
+    const char *p = out.raw.data() + start, *e = out.raw.data() + out.raw.size();
+    const size_t lines = std::count(p, e, '\n') + (e[-1] != '\n');
+    out.features.resize(lines * fs);
+    out.labels.resize(lines * ls);
+    size_t row = 0;
+    bool bad = 0;
+    while (p < e)
+    {
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', e - p));
+        const char *le = nl ? nl : e;
+        if (parseSampleLine(p, le, out.features.data() + row * fs, fs, out.labels.data() + row * ls, ls, bad))
+            row++;
+        p = nl ? nl + 1 : e;
+    }
+    out.badNumber = bad;
+    out.rows = row;
+    return 1;
+}
+
+bool SampleStream::advanceShard()
+{
+    for (;;)
+    {
+        // 有预读就等它完成，否则在当前线程读
+        if (m_loading.valid())
+        {
+            m_loading.get();
+            std::swap(m_current, m_pending);
+        }
+        else if (m_nextShard < m_order.size())
+            m_current.ok = loadShard(m_order[m_nextShard++], m_current);
+        else
+            return 0;
+        m_currentPos = 0;
+        if (!m_current.ok)
+        {
+            std::cout << "SampleStream Error: couldn't read " << m_path << std::endl;
+            m_error = 1;
+            return 0;
+        }
+        if (m_current.badNumber && !m_warned)
+        {
+            std::cerr << "无效参数: " << m_path << " 中含非法数字的行已跳过" << std::endl;
+            m_warned = 1;
+        }
+        if (m_options.readAhead && m_nextShard < m_order.size())
+        {
+            const size_t shard = m_order[m_nextShard++];
+            m_loading = std::async(std::launch::async, [this, shard]
+                                   { m_pending.ok = loadShard(shard, m_pending); });
+        }
+        if (m_current.rows)
+            return 1;
+    }
+}
+
+void SampleStream::startEpoch()
+{
+    m_order.resize(m_shardCount);
+    std::iota(m_order.begin(), m_order.end(), 0);
+    std::shuffle(m_order.begin(), m_order.end(), m_gen);
+    m_nextShard = 0;
+    m_current.rows = m_currentPos = 0;
+}
+
+bool SampleStream::start(size_t batchSize, size_t epochs, unsigned seed, Augment augment)
+{
+    if (m_path.empty())
+    {
+        std::cout << "SampleStream Error: no file opened" << std::endl;
+        return 0;
+    }
+    if (batchSize == 0)
+    {
+        std::cout << "SampleStream Error: batchSize is 0" << std::endl;
+        return 0;
+    }
+    if (m_loading.valid())
+        m_loading.wait();
+    m_loading = std::future<void>();
+    m_batchSize = batchSize;
+    m_epochs = epochs;
+    m_epoch = 0;
+    m_augment = std::move(augment);
+    m_gen.seed(seed);
+    std::seed_seq augmentSeed{seed, 1u};
+    m_augmentGen.seed(augmentSeed);
+    m_bufferFeatures.resize(m_options.shuffleRows * featureSize);
+    m_bufferLabels.resize(m_options.shuffleRows * labelSize);
+    m_bufferRows = 0;
+    m_batch.features.resize(batchSize * featureSize);
+    m_batch.labels.resize(batchSize * labelSize);
+    m_batch.indices.clear();
+    m_error = 0;
+    m_warned = 0;
+    startEpoch();
+    return 1;
+}
+
+const Minibatch *SampleStream::next()
+{
+    const size_t fs = featureSize, ls = labelSize, capacity = m_options.shuffleRows;
+    if (m_epoch >= m_epochs || m_error)
+        return nullptr;
+    std::uniform_int_distribution<size_t> pick;
+    size_t n = 0;
+    for (;;)
+    {
+        // 洗牌缓冲没满就从分片顺序补行；补满或本轮的行已读完后才取，保证 last 判断准确
+        while (m_bufferRows < capacity && (m_currentPos < m_current.rows || advanceShard()))
+        {
+            const size_t r = m_currentPos++;
+            std::copy_n(m_current.features.data() + r * fs, fs, m_bufferFeatures.data() + m_bufferRows * fs);
+            std::copy_n(m_current.labels.data() + r * ls, ls, m_bufferLabels.data() + m_bufferRows * ls);
+            m_bufferRows++;
+        }
+        if (m_error)
+            return nullptr;
+        if (m_bufferRows == 0 || n == m_batchSize)
+            break;
+        // 随机取出一行，用缓冲末尾的行填上空位
+        const size_t j = pick(m_gen, decltype(pick)::param_type(0, m_bufferRows - 1));
+        const size_t tail = --m_bufferRows;
+        std::copy_n(m_bufferFeatures.data() + j * fs, fs, m_batch.features.data() + n * fs);
+        std::copy_n(m_bufferLabels.data() + j * ls, ls, m_batch.labels.data() + n * ls);
+        std::copy_n(m_bufferFeatures.data() + tail * fs, fs, m_bufferFeatures.data() + j * fs);
+        std::copy_n(m_bufferLabels.data() + tail * ls, ls, m_bufferLabels.data() + j * ls);
+        n++;
+    }
+    if (n == 0)
+    {
+        // 文件里没有合法的行
+        m_epoch = m_epochs;
+        return nullptr;
+    }
+    m_batch.rows = n;
+    m_batch.epoch = m_epoch;
+    m_batch.last = m_bufferRows == 0;
+    if (m_batch.last && ++m_epoch < m_epochs)
+        startEpoch();
+    if (m_augment)
+        m_augment(m_batch.features.data(), n, fs, m_augmentGen);
+    return &m_batch;
+}
+
+bool SampleStream::failed() const
+{
+    return m_error;
+}
+
+size_t SampleStream::shardCount() const
+{
+    return m_shardCount;
+}
+
+size_t SampleStream::bufferBytes() const
+{
+    // 预读中的分片正在被后台线程改写，等它完成再统计
+    if (m_loading.valid())
+        m_loading.wait();
+    auto shardBytes = [](const Shard &s)
+    {
+        return s.raw.capacity() + (s.features.capacity() + s.labels.capacity()) * sizeof(double);
+    };
+    return shardBytes(m_current) + shardBytes(m_pending) +
+           (m_bufferFeatures.capacity() + m_bufferLabels.capacity() + m_batch.features.capacity() +
+            m_batch.labels.capacity()) * sizeof(double);
+}
+
+void printSampleSet(const SampleSet &sampleSet)
+{
+    const size_t rows = std::min<size_t>(sampleSet.size(), 20);
+    const size_t features = std::min<size_t>(sampleSet.featureSize, 30);
+    const size_t labels = std::min<size_t>(sampleSet.labelSize, 10);
+    for (size_t i = 0; i < rows; i++)
+    {
+        SampleView v = sampleSet.at(i);
+        std::cout << "features: ";
+        for (size_t j = 0; j < features; j++)
+        {
+            std::cout << v.features[j] << " ";
+        }
+        if (sampleSet.featureSize > features)
+            std::cout << "... ";
+        std::cout << "labels: ";
+        for (size_t j = 0; j < labels; j++)
+        {
+            std::cout << v.labels[j] << " ";
+        }
+        if (sampleSet.labelSize > labels)
+            std::cout << "... ";
+        std::cout << std::endl;
+    }
+    if (sampleSet.size() > rows)
+    {
+        std::cout << std::endl;
+        for (int k = 0; k < 3; k++)
+            std::cout << '.' << std::endl;
+    }
+}
+
+double sigmoid(double x)
+{
+    return 1.0 / (1.0 + std::exp(-x));
+}
+
+double sigmoidDeri(double x)
+{
+    double s = sigmoid(x);
+    return s * (1.0 - s);
+}
+
+double linear(double x)
+{
+    return x;
+}
+
+double linearDeri(double x)
+{
+    return 1;
 }
@@ -8,6 +8,13 @@
 #include <memory>
 #include <immintrin.h>
 #include <optional>
+#include <unordered_map>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <future>
+#include "activation.h"
+#include "profile.h"
 
 #pragma pack(push, 1)
 struct FileHeader
@@ -19,134 +26,791 @@ struct FileHeader
 };
 #pragma pack(pop) // 恢复默认对齐
 
+// 二进制数据集里特征的存放格式；标签总是 f64
+enum class SampleType : uint8_t
+{
+    F64, // 原样存放，加载时直接映射使用
+    U8,  // 每个特征一个字节，只能存 0~255 的整数
+    Bit  // 每个特征一位，每行按字节补齐，只能存 0/1
+};
+
+#pragma pack(push, 1)
+struct DatasetHeader
+{
+    uint32_t magic;          // 魔数：0x4E4C4453（"NLDS"）
+    uint16_t version;        // 版本号：1
+    SampleType featureType;  // 特征的存放格式
+    uint8_t reserved;
+    uint64_t rows;           // 样本数
+    uint32_t featureSize;
+    uint32_t labelSize;
+    uint64_t featureOffset;  // 特征块、标签块相对文件头的偏移，均按 64 字节对齐
+    uint64_t labelOffset;
+};
+#pragma pack(pop)
+
+// 按 Alignment 字节对齐的分配器，供 SIMD 内核使用
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T *p, size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
 struct Sample
 {
     std::vector<double> features;
     std::vector<double> labels;
 };
 
-class SampleSet
+// 连续存放的行主序矩阵，predictBatch 的输出格式
+struct Matrix
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    AlignedVector<double> data;
+    Matrix() = default;
+    Matrix(size_t rows_, size_t cols_) : rows(rows_), cols(cols_), data(rows_ * cols_) {}
+    double *row(size_t r) { return data.data() + r * cols; }
+    const double *row(size_t r) const { return data.data() + r * cols; }
+};
+
+class Network;
+
+class ThreadPool;
+class MappedFile;
+
+// 一行样本的只读视图，指向 SampleSet 内部的连续存储，不拷贝
+struct SampleView
+{
+    std::span<const double> features;
+    std::span<const double> labels;
+};
+
+// 连续若干行样本，features 为 rows x featureSize、labels 为 rows x labelSize 的行主序矩阵
+struct SampleBatch
 {
+    std::span<const double> features;
+    std::span<const double> labels;
+    size_t rows = 0;
+};
 
-    std::vector<Sample> samples;
+class SampleSet
+{
+    // 所有样本的特征、标签各放在一块连续的行主序矩阵里
+    AlignedVector<double> m_features;
+    AlignedVector<double> m_labels;
+    size_t m_size = 0;
+    // 从 f64 二进制数据集加载时直接引用映射的页，不拷贝；任何修改前先拷贝成自有缓冲区
+    std::shared_ptr<const MappedFile> m_mapping;
+    const double *m_featureView = nullptr;
+    const double *m_labelView = nullptr;
+    AlignedVector<uint64_t> m_bits; // packFeatureBits 生成的位图，修改样本后清空
+    void detach();
     friend Network;
+    friend bool loadSamplesBinary(std::string path, SampleSet &samples);
 
 public:
+    // 按给定下标顺序访问样本的视图，只引用下标数组，不拷贝样本
+    class Permutation
+    {
+        const SampleSet *m_set;
+        std::span<const size_t> m_order;
+
+    public:
+        Permutation(const SampleSet &set, std::span<const size_t> order);
+        size_t size() const;
+        SampleView operator[](size_t i) const;
+    };
+
     SampleSet(size_t featureSize_, size_t labelSize_);
     SampleSet(size_t featureSize_, size_t labelSize_, size_t sampleSize);
     void resize(size_t size_);
-    size_t size();
-    bool push_back(Sample sample);
+    size_t size() const;
+    bool push_back(const Sample &sample);
+    bool push_back(std::span<const double> features, std::span<const double> labels);
     void clear();
     void reserve(size_t size);
-    const Sample at(size_t);
+    SampleView at(size_t) const;
+    SampleBatch batch(size_t begin, size_t count) const;
+    Permutation permute(std::span<const size_t> order) const;
+    const double *featureData() const;
+    const double *labelData() const;
+    double *featureData();
+    double *labelData();
+    // 特征全是 0/1 时额外存一份按行打包的位图，每行 bitWords() 个 64 位字；有其他取值时返回 false。
+    // 修改样本后位图作废，需要重新打包
+    bool packFeatureBits();
+    const uint64_t *featureBits() const;
+    size_t bitWords() const;
     const size_t featureSize;
     const size_t labelSize;
-    std::vector<Sample> getSamples();
+    // 拷贝出旧的逐样本格式
+    std::vector<Sample> getSamples() const;
 };
 
-class Network
+// 把 n 行 0/1 特征打包成位图，每行 (cols + 63) / 64 个字，第 c 个特征为第 c 位；出现其他取值时返回 false
+bool packBits(const double *x, size_t n, size_t cols, uint64_t *bits);
+
+// 映射整个文件，按行边界切块后多线程解析；threads 为 0 时使用全部硬件线程。
+// 列数不对或含非法数字的行会被跳过
+bool loadSamples(std::string path, SampleSet &samples, size_t threads = 0);
+
+// 写成二进制数据集；特征无法用 featureType 精确表示时返回 false
+bool saveSamplesBinary(std::string path, const SampleSet &samples, SampleType featureType = SampleType::F64);
+// f64 数据集映射后原地使用，与样本数无关；U8 / Bit 格式解码到自有缓冲区
+bool loadSamplesBinary(std::string path, SampleSet &samples);
+// 文本样本转成二进制数据集
+bool convertSamples(std::string csvPath, std::string binPath, size_t featureSize, size_t labelSize,
+                    SampleType featureType = SampleType::F64);
+
+void printSampleSet(const SampleSet &sampleSet);
+
+// 训练用的一个小批：特征、标签按行连续存放，可以直接作为输入层的输出
+struct Minibatch
+{
+    AlignedVector<double> features; // rows x featureSize
+    AlignedVector<double> labels;   // rows x labelSize
+    std::vector<size_t> indices;    // 各行在 SampleSet 中的下标；SampleStream 不填
+    size_t rows = 0;
+    size_t epoch = 0;
+    bool last = 0; // 本轮的最后一批
+};
+
+// 原地修改 rows x featureSize 的特征做数据增强，gen 由训练种子派生
+using Augment = std::function<void(double *features, size_t rows, size_t featureSize, std::mt19937 &gen)>;
+
+// Network::train 消费的批序列，按轮次依次给出
+class BatchSource
+{
+public:
+    // 取下一批，全部轮次结束后返回 nullptr；返回的批在下一次调用 next() 前有效
+    virtual const Minibatch *next() = 0;
+    virtual ~BatchSource() = default;
+};
+
+struct StreamOptions
+{
+    size_t shardBytes = size_t(1) << 20; // 每次读入的分片大小；CSV 分片按行边界对齐，二进制按整行取整
+    size_t shuffleRows = 4096;            // 洗牌缓冲的行数，越大越接近全局打乱
+    bool readAhead = 1;                   // 用后台线程预读下一个分片
+};
+
+// 流式读取超出内存的数据集（.csv 或 loadSamplesBinary 的二进制格式）：文件切成固定大小的分片，
+// 每轮按种子打乱分片顺序，分片内的行再经过有界的洗牌缓冲。常驻的只有两个分片和洗牌缓冲，与文件大小无关
+class SampleStream : public BatchSource
+{
+    StreamOptions m_options;
+    std::string m_path;
+    bool m_binary = 0;
+    DatasetHeader m_header{};
+    uint64_t m_fileSize = 0;
+    size_t m_shardCount = 0;
+    size_t m_rowBytes = 0; // 二进制格式每行特征的字节数
+    size_t m_shardRows = 0; // 二进制格式每个分片的行数
+    // 一个读入并解析好的分片
+    struct Shard
+    {
+        std::vector<char> raw;
+        AlignedVector<double> features;
+        AlignedVector<double> labels;
+        size_t rows = 0;
+        bool ok = 1;
+        bool badNumber = 0;
+    };
+    Shard m_current, m_pending;
+    std::future<void> m_loading;
+    size_t m_currentPos = 0;
+    bool loadShard(size_t shard, Shard &out) const;
+    // 当前分片耗尽时换上预读好的下一个，本轮没有更多分片时返回 false
+    bool advanceShard();
+
+    size_t m_batchSize = 1;
+    size_t m_epochs = 0;
+    size_t m_epoch = 0;
+    Augment m_augment;
+    std::mt19937 m_gen;
+    std::mt19937 m_augmentGen;
+    std::vector<size_t> m_order; // 本轮的分片顺序
+    size_t m_nextShard = 0;      // m_order 中下一个要读的位置
+    AlignedVector<double> m_bufferFeatures, m_bufferLabels;
+    size_t m_bufferRows = 0;
+    Minibatch m_batch;
+    bool m_error = 0;
+    bool m_warned = 0;
+    void startEpoch();
+
+public:
+    SampleStream(size_t featureSize_, size_t labelSize_, StreamOptions options = StreamOptions());
+    ~SampleStream();
+    SampleStream(const SampleStream &) = delete;
+    SampleStream &operator=(const SampleStream &) = delete;
+    // 按魔数识别格式，只读文件头和大小
+    bool open(const std::string &path);
+    // 准备 epochs 轮、每批 batchSize 行的批序列；之后用 next() 逐批读取
+    bool start(size_t batchSize, size_t epochs, unsigned seed, Augment augment = nullptr);
+    const Minibatch *next() override;
+    // 读取或解析分片出错（文件被截断、读失败）时为真，此时 next() 提前结束
+    bool failed() const;
+    size_t shardCount() const;
+    // 当前各缓冲实际占用的字节数；有分片正在预读时先等它读完
+    size_t bufferBytes() const;
+    const size_t featureSize;
+    const size_t labelSize;
+};
+
+enum class Optimizer
+{
+    SGD,
+    Momentum,
+    Adam
+};
+
+// 推理时 DenseLink 使用的权重精度；训练和保存始终使用 double 权重
+enum class Precision
+{
+    Double,
+    Float32, // 权重转成 float，输入逐批转换
+    Int8     // 权重按行、输入按样本对称量化到 int8，int32 累加
+};
+
+// PoolLink 的汇聚方式
+enum class Pooling
+{
+    Max,
+    Average
+};
+
+struct TrainOptions
 {
+    Optimizer optimizer = Optimizer::SGD;
+    size_t epochs = 10;
+    size_t batchSize = 32;
+    double learningRate = 0.1;
+    double momentum = 0.9; // Momentum
+    double beta1 = 0.9;    // Adam
+    double beta2 = 0.999;  // Adam
+    double epsilon = 1e-8; // Adam
+    unsigned seed = 0;     // 每轮打乱样本顺序用的随机种子
+    size_t threads = 1;    // 数据并行的线程数，0 表示硬件线程数；线程数和种子固定时结果可复现
+    // 后台线程提前收集好的批数，缓冲占 (prefetch + 1) 个批的内存；0 表示在训练线程上同步收集。
+    // 两种方式的批序列完全相同
+    size_t prefetch = 1;
+    // 可选的数据增强：在收集好的批上原地修改 rows x featureSize 的特征，gen 由 seed 派生，结果可复现
+    Augment augment;
+    // 每轮结束时在训练线程上调用，epoch 从 0 起，loss 为该轮的平均损失；返回 false 时提前结束训练。
+    // 回调里可以用 accuracy、predict、saveModel 等只读接口查看当前权重（按 double 精度计算）
+    std::function<bool(size_t epoch, double loss)> onEpoch;
+    bool verbose = 1;
+};
 
+class Network
+{
+public:
     class Layer;
 
     class Link;
 
     class DenseLink;
 
-    std::vector<Layer> m_layers;
-    std::vector<Link> m_links;
-    std::vector<std::vector<size_t>> m_forwardCache;
-    std::vector<std::vector<size_t>> m_backwardCache;
+    class SparseLink;
+
+    class LocalLink;
+
+    class ConvLink;
+
+    class PoolLink;
+
+    // 一块缓冲里的一层：capacity x cols 的行主序矩阵
+    struct LayerBuffer
+    {
+        double *data = nullptr;
+        size_t cols = 0;
+    };
+
+    // 一次前向所需的全部激活缓冲，每层一对 [batch x size] 矩阵，都切自同一块对齐内存。
+    // 模型参数在前向时只读，各线程各持一个 InferenceContext 即可无锁并发调用 predict
+    class InferenceContext
+    {
+        AlignedVector<double> m_block;
+        std::vector<LayerBuffer> m_inputs;  // 各层激活前输入，融合的层不写
+        std::vector<LayerBuffer> m_outputs; // 各层输出
+        std::vector<uint64_t> m_bits;       // 二值输入时打包好的输入位图
+        size_t m_capacity = 0;
+        uint64_t m_planId = 0; // 缓冲按哪一份执行计划分配
+        // predictIncremental 的状态：上一次的输入，和有输入层入链接的层来自这些链接的累加（含偏置）
+        AlignedVector<double> m_lastInput;
+        AlignedVector<double> m_partialBlock;
+        std::vector<LayerBuffer> m_partial; // 按层下标，没有输入层入链接的层为空
+        std::vector<size_t> m_changedIdx;   // 本次增量里确实变了的下标
+        std::vector<double> m_changedDelta; // 对应的变化量
+        size_t m_updates = 0;               // 上次完整计算以来的增量更新次数
+        uint64_t m_partialPlanId = 0;       // 状态按哪一份执行计划建立，0 表示还没有
+        uint64_t m_partialVersion = 0;      // 建立时的 parameterVersion()
+        friend Network;
+    };
+
+private:
+    std::vector<std::shared_ptr<Layer>> m_layers;
+    std::vector<std::shared_ptr<Link>> m_links;
+    std::vector<std::vector<size_t>> m_forwardCache;  // 每层的出链接下标
+    std::vector<std::vector<size_t>> m_backwardCache; // 每层的入链接下标
     void updateForwardCache();
     void clearForwardCache();
     void updateBackwardCache();
     void clearBackwardCache();
+
+    // compile() 生成的执行计划：按拓扑序排好的链接
+    struct Step
+    {
+        Link *link;
+        size_t source;                               // 源层下标
+        size_t target;                               // 目标层下标
+        bool first;                                  // 目标层的第一条入链接，未融合时在这里清零目标层输入
+        bool activates;                              // 目标层输入已收齐，需要激活
+        Activation activation;                       // 目标层的激活函数
+        bool backprop;                               // 源层有入链接，反向时需要它的梯度
+        size_t paramOffset;                          // 该链接在梯度区中的起点
+        size_t paramCount;                           // 编译时该链接的参数个数
+        size_t index;                                // 链接在 m_links 中的下标
+    };
+    std::vector<Step> m_plan;
+    // 入链接全部是 DenseLink 的层：各链接的权重沿输入方向拼接，在该层最后一步一次算完
+    // act(sum W x + b) 写进输出，不经过激活前的输入缓冲
+    struct FusedLayer
+    {
+        std::vector<const DenseLink *> links;
+        std::vector<size_t> sources; // 各链接的源层下标
+    };
+    std::vector<FusedLayer> m_fused; // 按层下标，links 为空表示不能融合
+    bool m_fusion = 1;
+    // 链接都是 double 精度、且不需要让给 forwardBits 时才走融合内核
+    bool canFuse(const FusedLayer &fused, const uint64_t *bits) const;
+    void forwardFused(InferenceContext &ctx, const FusedLayer &fused, const Step &step, const double *input, size_t n) const;
+    std::vector<size_t> m_zeroLayers; // 有入链接的层，反向前需要清零它的 delta
+    Activation m_outputActivation = Activation::Linear; // 为 Softmax 时训练使用交叉熵
+    bool m_compiled = 0;
+    uint64_t m_planId = 0; // 每次 compile 递增的全局编号，用于判断 InferenceContext 是否过期
+    uint64_t m_paramVersion = 0; // train 改写参数时取的新编号，与链接的编号同属一个全局计数
+    // 网络与读输入层的链接上最近一次参数改动的编号，增量前向据此判断缓存的累加是否过期
+    uint64_t parameterVersion() const;
+    void reserveContext(InferenceContext &ctx, size_t batchSize) const;
+    // bits 非空时为 input 打包后的位图，读输入层的链接可走 forwardBits
+    void forward(InferenceContext &ctx, const double *input, const uint64_t *bits = nullptr) const;
+    // input 为输入层的 n 行输出，可直接指向 SampleSet 的连续存储
+    void forwardBatch(InferenceContext &ctx, const double *input, size_t n, const uint64_t *bits = nullptr) const;
+    // 输入层的出链接都是 double 精度的 DenseLink 时才能按列增量更新
+    bool canUpdateIncrementally() const;
+    // 按 changed 更新（或重建）ctx 里的累加，再从那里重算下游各层
+    void forwardIncremental(InferenceContext &ctx, const double *input, std::span<const size_t> changed) const;
+
+    // 训练缓冲：在激活缓冲之外加上各层的 delta，缓冲只在批大小变大时重新分配；
+    // deltas 先累加 dL/d(输出)，反向经过激活后原地变为 dL/d(输入)
+    struct Workspace
+    {
+        InferenceContext act;
+        AlignedVector<double> block;
+        std::vector<LayerBuffer> deltas;
+    };
+    // 训练时每个线程一个
+    std::vector<Workspace> m_workspaces;
+    void reserveWorkspace(Workspace &ws, size_t batchSize);
+    // 把本批的梯度累加进 grad，返回本批损失之和（均方误差为 1/2 * sum ||y - t||^2，softmax 输出为交叉熵）；
+    // targets 为 n x 输出层大小，scale 为整个批的 1/n
+    double backwardBatch(Workspace &ws, const double *input, const double *targets, size_t n, double *grad, double scale);
+
+    // 梯度与优化器状态共用一块内存：
+    // [分片 0 梯度 | ... | 分片 T-1 梯度 | 一阶矩 | 二阶矩]，每个链接在各区占同样偏移的一段
+    AlignedVector<double> m_arena;
+    // compile 时各链接参数搬进的块，布局与梯度区的一个分片相同；链接也持有它，链接比网络活得久时不会悬空
+    std::shared_ptr<AlignedVector<double>> m_params;
+    size_t m_paramTotal = 0;
+    size_t m_shards = 1;
+    // 编译后又有链接改变了参数个数（如 addSynapse），计划里的偏移和 m_paramTotal 已不可用
+    bool planStale() const;
+    void initArena(const TrainOptions &options, size_t shards);
+    void reduceShards(ThreadPool &pool);
+    void applyGradients(const TrainOptions &options, size_t step);
+    // 两种 train 共用的训练循环，batchSize 为批的最大行数
+    bool trainBatches(BatchSource &batches, size_t batchSize, const TrainOptions &options);
+    Precision m_precision = Precision::Double;
+    bool m_binaryInput = 0;
+    void loadModelV1(const char *data, size_t size);
+    void loadModelV2(std::shared_ptr<MappedFile> file);
+    // 性能计数，第一次 setProfiling(true) 时创建；没有定义 NN_PROFILE 时始终为空
+    std::unique_ptr<Profiler> m_profiler;
+    bool m_profiling = 0;
     friend Link;
 
 public:
     std::string comment;
     Network(std::shared_ptr<Layer> input, std::shared_ptr<Layer> output);
+    // 读取 .nll 模型：v2 映射文件，DenseLink 的参数直接指向映射页（写时复制，训练不会改动文件）；
+    // v1 文本突触格式按突触逐条读入。文件无法解析时抛出 std::runtime_error
     Network(std::string path);
-    // void saveModel(const std::string &file);
-    Sample predict(const Sample &sample);
-    bool train(const SampleSet &sampleSet);
+    // 写成 .nll v2：每个链接的参数是一段 64 字节对齐的连续块
+    bool saveModel(const std::string &path) const;
+    bool addLayer(std::shared_ptr<Layer> layer);
+    bool addLink(std::shared_ptr<Link> link);
+    // 拓扑排序层/链接图，生成执行计划；增删层或链接时会重新编译，旧的 InferenceContext 随之失效。
+    // 编译时链接参数搬进网络的参数块，之前取得的 weights() / bias() 指针随之失效
+    bool compile();
+    InferenceContext makeContext(size_t batchSize = 1) const;
+    // 输入层、输出层的大小
+    size_t inputSize() const;
+    size_t outputSize() const;
+    // 按加入顺序的层和链接，第一层为输入层、最后一层为输出层
+    const std::vector<std::shared_ptr<Layer>> &layers() const;
+    const std::vector<std::shared_ptr<Link>> &links() const;
+    // 用当前权重生成各 DenseLink 的低精度副本供 predict 使用；直接改过权重后需要重新调用。
+    // train 期间临时回到 double，结束后按新权重重新生成
+    void setPrecision(Precision precision);
+    Precision precision() const;
+    // 输入全是 0/1 时，读输入层的 DenseLink 只累加置位特征对应的权重列；
+    // 输入含其他取值时自动走普通路径。和 setPrecision 一样是按当前权重生成的快照
+    void setBinaryInput(bool enable);
+    bool binaryInput() const;
+    // 默认开启：入链接全是 DenseLink 的层把矩阵乘、偏置和激活合成一个内核，输出只写一次。
+    // 关闭时逐链接累加再单独激活，用于对照
+    void setFusion(bool enable);
+    bool fusion() const;
+    // 以下前向接口都不修改模型，使用调用方提供的 ctx 时可多线程并发调用；
+    // 不传 ctx 的版本使用本线程私有的缓冲
+    Sample predict(std::span<const double> features, InferenceContext &ctx) const;
+    Sample predict(std::span<const double> features) const;
+    Sample predict(const Sample &sample, InferenceContext &ctx) const;
+    Sample predict(const Sample &sample) const;
+    // 结果写进调用方的 outputs（长度为输出层大小）；ctx 容量够时不做任何堆分配
+    bool predict(std::span<const double> features, std::span<double> outputs, InferenceContext &ctx) const;
+    bool predict(std::span<const double> features, std::span<double> outputs) const;
+    // 增量前向：features 为完整的新输入，changed 列出相对于上次用同一个 ctx 增量前向时可能变了的特征下标。
+    // 读输入层的链接只按 (新值 - 旧值) × 权重列更新 ctx 里保存的累加，代价为 O(变化数 × 目标层大小)，
+    // 下游各层照常重算。ctx 还没有状态、网络重新编译过、参数改过（train，或经 weights() / bias() / parameters()、
+    // *InitSynapses、addSynapse 改动链接）、变化太多或累计更新过多次时自动做一次完整计算；
+    // 输入层有其他种类或低精度的出链接时等同于 predict。同一个 ctx 上穿插普通 predict 不影响这份状态
+    bool predictIncremental(std::span<const double> features, std::span<const size_t> changed, std::span<double> outputs,
+                            InferenceContext &ctx) const;
+    // 每 batchSize 个样本一组做前向，返回 sampleSet.size() x 输出层大小 的矩阵
+    Matrix predictBatch(const SampleSet &sampleSet, size_t batchSize, InferenceContext &ctx) const;
+    Matrix predictBatch(const SampleSet &sampleSet, size_t batchSize = 64) const;
+    // features 为连续的 rows 行输入，结果按行写进调用方的 outputs（rows x 输出层大小），一次前向完成
+    bool predictBatch(std::span<const double> features, size_t rows, std::span<double> outputs, InferenceContext &ctx) const;
+    bool train(const SampleSet &sampleSet, const TrainOptions &options = TrainOptions());
+    // 从流中按轮读取训练，prefetch 不起作用（流自己预读分片）；峰值内存与数据集大小无关
+    bool train(SampleStream &stream, const TrainOptions &options = TrainOptions());
+    // 输出层最大值所在下标与标签最大值所在下标一致的比例
+    double accuracy(const SampleSet &sampleSet) const;
+    // 开启计数后 predict / train 按层和链接累计调用次数、墙钟时间、估算的 FLOPs 和访存量，
+    // 有计数时 printLayersInfo / printLinksInfo 会附带打印。每次开启都清空之前的计数；
+    // trace 为真时另外记录每次调用的时间线，供 saveTrace 导出。
+    // 计时点只在定义 NN_PROFILE 编译时存在，否则开启会打印错误并返回 false
+    bool setProfiling(bool enable, bool trace = false);
+    bool profiling() const;
+    // 当前计数的快照，下标与层、链接的添加顺序一致；从未开启过时为空
+    NetworkProfile profile() const;
+    // 导出 Chrome trace JSON，需要先以 trace = true 开启计数
+    bool saveTrace(const std::string &path) const;
     void printLayersInfo();
     void printLinksInfo();
 };
 
-static double sigmoid(double x);
-
-static double sigmoidDeri(double x);
+double sigmoid(double x);
 
-static double linear(double x);
+double sigmoidDeri(double x);
 
-static double linearDeri(double x);
+double linear(double x);
 
-const std::unordered_map<std::string, std::function<double(double)>> activateFunc =
-    {
-        {"sigmoid", sigmoid},
-        {"linear", linear}};
+double linearDeri(double x);
 
-const std::unordered_map<std::string, std::function<double(double)>> activateDeriFunc =
-    {
-        {"sigmoidDeri", sigmoidDeri},
-        {"linearDeri", linearDeri}};
 
 class Network::Layer
 {
-    struct Nueron
-    {
-        double delta = 0;
-        double input = 0;
-        double output = 0;
-        double bias = 0;
-    };
-
-    std::vector<Nueron> m_neurons;
+    size_t m_size;
     std::vector<size_t> m_shape;
     std::vector<size_t> m_strides;
     std::string m_activate;
     void initStrides();
-    friend Network::Link;
+    friend Network;
 
 public:
     Layer(std::vector<size_t> shape, std::string activate = "linear");
-    const size_t &size();
-    const std::vector<size_t> &shape();
+    size_t size() const;
+    const std::vector<size_t> &shape() const;
+    // 行主序下各维的步长，最后一维为 1
+    const std::vector<size_t> &strides() const;
+    const std::string &activate() const;
     std::string comment;
 };
 
 class Network::Link
 {
+protected:
     struct Synapse
     {
-        double weight;
-        double gradient;
         size_t fromIdx;
         size_t toIdx;
     };
 
-protected:
-    size_t m_source;
-    size_t m_target;
+    std::shared_ptr<Layer> m_source;
+    std::shared_ptr<Layer> m_target;
     std::vector<Synapse> m_synapses;
+    AlignedVector<double> m_weights; // 与 m_synapses 一一对应
+    // bindParameters 之后参数位于 Network 的参数块内，各链接共同持有这块内存
+    std::shared_ptr<AlignedVector<double>> m_block;
+    // 参数可能被改写的非 const 接口里调用，取一个新的全局编号；链接可能被多个网络共用，所以编号记在链接上
+    void touchParameters();
+    uint64_t m_paramVersion = 0;
     virtual void initSynapses();
+    // 把参数拷到 params（长度为 parameters().size()，位于 block 内）并改为在那里读写，由 compile 调用；
+    // 参数映射自模型文件或无法搬移的链接返回 false，参数留在原处
+    virtual bool bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params);
+    friend Network;
 
 public:
-    Link(size_t source, size_t target);
-    const size_t &source();
-    const size_t &target();
+    Link(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target);
+    const std::shared_ptr<Layer> &source() const;
+    const std::shared_ptr<Layer> &target() const;
+    // 所在网络已编译时参数个数随之改变，下次 train 会重新编译
+    virtual bool addSynapse(size_t fromIdx, size_t toIdx, double weight = 0);
+    // 给定 seed 时结果可复现，否则使用全局随机数引擎
+    virtual void normalInitSynapses(std::optional<unsigned> seed = std::nullopt);
+    virtual void valueInitSynapses(double value);
+    // out[target] += W * in[source]
+    virtual void forward(const double *in, double *out) const;
+    // n 个样本逐行存放：in 为 n x source.size()，out 为 n x target.size()
+    virtual void forwardBatch(const double *in, double *out, size_t n) const;
+    // dOut 为 n x target.size() 的 dL/d(目标层输入)；梯度按 parameters() 的布局累加进 grad，
+    // dIn 非空时累加 dL/d(源层输出)
+    virtual void backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const;
+    // 全部可训练参数所在的连续内存（可能含对齐填充）
+    virtual std::span<double> parameters();
+    virtual size_t paramCount() const;
+    // 前向时每个样本的浮点运算数（乘加算 2 次），只用于性能计数
+    virtual double flopsPerSample() const;
+    virtual std::string type() const;
+    // 按当前 double 权重生成推理用的低精度副本；不支持的链接保持 double
+    virtual void setPrecision(Precision precision);
+    // 为 forwardBits 准备权重；不支持的链接忽略
+    virtual void setBinaryInput(bool enable);
+    // out[target] += W * in，in 为 n 行打包好的 0/1 位图（每行 words 个字）；不支持时返回 false
+    virtual bool forwardBits(const uint64_t *bits, size_t words, double *out, size_t n) const;
     virtual ~Link();
 };
 
 class Network::DenseLink : public Link
 {
-
+    // [weights | bias]，两段都按 64 字节对齐
+    AlignedVector<double> m_storage;
+    // 从 v2 模型加载时参数位于映射页内，m_storage 为空
+    std::shared_ptr<MappedFile> m_mapping;
+    // setPrecision 生成的低精度权重，每行 m_ld 个元素，行尾补零
+    Precision m_precision = Precision::Double;
+    size_t m_ld = 0;
+    AlignedVector<float> m_weightsF32;
+    AlignedVector<int8_t> m_weightsI8;
+    AlignedVector<float> m_scales; // int8 每行的缩放
+    AlignedVector<double> m_columns; // setBinaryInput 生成的按列存放权重，每列 m_columnStride 个 double
+    size_t m_columnStride = 0;
+    double *m_weights = nullptr; // 行主序 target.size() x source.size()
+    double *m_bias = nullptr;
+    size_t m_rows = 0;
+    size_t m_cols = 0;
     void initSynapses() override;
+    bool bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params) override;
+    // 参数布局与 m_storage 相同，位于 mapping 内的 params 处
+    DenseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::shared_ptr<MappedFile> mapping, double *params);
+    friend Network;
+
+public:
+    DenseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target);
+    // 参数区的长度（weights、对齐填充、bias），与 parameters().size() 相同
+    static size_t storageSize(size_t rows, size_t cols);
+    void normalInitSynapses(std::optional<unsigned> seed = std::nullopt) override;
+    void valueInitSynapses(double value) override;
+    void forward(const double *in, double *out) const override;
+    void forwardBatch(const double *in, double *out, size_t n) const override;
+    void backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const override;
+    std::span<double> parameters() override;
+    size_t paramCount() const override;
+    double flopsPerSample() const override;
+    std::string type() const override;
+    void setPrecision(Precision precision) override;
+    Precision precision() const;
+    void setBinaryInput(bool enable) override;
+    bool forwardBits(const uint64_t *bits, size_t words, double *out, size_t n) const override;
+    // 推理时实际读取的权重字节数
+    size_t weightBytes() const;
+    size_t rows() const;
+    size_t cols() const;
+    double *weights();
+    const double *weights() const;
+    double *bias();
+    const double *bias() const;
+};
+
+// 稀疏连接：按目标神经元分行的 CSR，每行只存有连接的源下标和权重，另有每个目标一个偏置。
+// m_synapses 按 CSR 顺序保存同一份连接关系，供保存模型使用
+class Network::SparseLink : public Link
+{
+    // [values | bias]，两段都按 64 字节对齐，布局与 DenseLink 相同
+    AlignedVector<double> m_storage;
+    // 从 v2 模型加载时参数位于映射页内，m_storage 为空
+    std::shared_ptr<MappedFile> m_mapping;
+    std::vector<uint32_t> m_rowPtr; // rows + 1 个，第 r 行的连接为 [m_rowPtr[r], m_rowPtr[r + 1])
+    std::vector<uint32_t> m_colIdx; // 每个连接的源下标，行内递增
+    double *m_values = nullptr;
+    double *m_bias = nullptr;
+    size_t m_rows = 0;
+    size_t m_cols = 0;
+    // 按 (目标, 源) 排序去重后建立 CSR；weights 为空时权重取 0，保留 bias（可为空）
+    void build(std::vector<Synapse> synapses, std::vector<double> weights, std::vector<double> bias);
+    // 由 m_synapses 生成 m_rowPtr / m_colIdx
+    void indexSynapses();
+    bool bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params) override;
+    // 参数位于 mapping 内的 params 处，synapses 已按 CSR 顺序排好
+    SparseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::shared_ptr<MappedFile> mapping,
+               double *params, std::vector<Synapse> synapses);
+    friend Network;
+
+protected:
+    SparseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target);
+    // 子类按自己的规则生成连接后调用
+    void setConnections(const std::vector<std::pair<size_t, size_t>> &connections);
+
+public:
+    // connections 为 (源下标, 目标下标)，重复的只保留一个，越界的忽略
+    SparseLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target,
+               const std::vector<std::pair<size_t, size_t>> &connections);
+    // 参数区的长度（values、对齐填充、bias），与 parameters().size() 相同
+    static size_t storageSize(size_t nnz, size_t rows);
+    // 插入一个连接并重建 CSR，已有连接只更新权重
+    bool addSynapse(size_t fromIdx, size_t toIdx, double weight = 0) override;
+    // 按每个目标的实际扇入缩放
+    void normalInitSynapses(std::optional<unsigned> seed = std::nullopt) override;
+    void valueInitSynapses(double value) override;
+    void forward(const double *in, double *out) const override;
+    void forwardBatch(const double *in, double *out, size_t n) const override;
+    void backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const override;
+    std::span<double> parameters() override;
+    size_t paramCount() const override;
+    double flopsPerSample() const override;
+    std::string type() const override;
+    size_t rows() const;
+    size_t cols() const;
+    size_t nnz() const;
+    double *values();
+    const double *values() const;
+    double *bias();
+    const double *bias() const;
+};
+
+// 局部连接（感受野）：目标层的每个位置只连源层上一块相邻区域，权重不共享。
+// 源层形状为空间维度（如 {16, 16}）；目标层与源层维数相同，或多一个最前面的通道维（如 {4, 8, 8}），
+// 各通道在同一位置看同一块区域。目标位置 p 在第 d 维看源层的 [p * stride[d], p * stride[d] + field[d])，
+// 超出源层的部分截掉。生成连接后就是普通的 SparseLink，保存为同一种格式
+class Network::LocalLink : public SparseLink
+{
+public:
+    // stride 为空时取 1；形状不匹配时打印错误，得到一个没有连接的链接
+    LocalLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::vector<size_t> field,
+              std::vector<size_t> stride = {});
+};
+
+// 空间层的形状约定为 {C, H, W}（行主序、通道在前），{H, W} 视为单通道
+
+// 二维卷积：每个输出通道一个 inC x kh x kw 的卷积核和一个偏置，所有位置共享。
+// 输出尺寸必须满足 OH = (H + 2 * ph - kh) / sh + 1（宽同理），输出通道数取自目标层形状。
+// 前向按样本 im2col 后用 gemmNN，反向用 gemm / gemmTN 再 col2im
+class Network::ConvLink : public Link
+{
+    // [weights | bias]，weights 为 outC x (inC * kh * kw) 的行主序，两段都按 64 字节对齐
+    AlignedVector<double> m_storage;
+    // 从 v2 模型加载时参数位于映射页内，m_storage 为空
+    std::shared_ptr<MappedFile> m_mapping;
+    double *m_weights = nullptr;
+    double *m_bias = nullptr;
+    size_t m_inC = 0, m_inH = 0, m_inW = 0;
+    size_t m_outC = 0, m_outH = 0, m_outW = 0;
+    size_t m_kh = 0, m_kw = 0, m_sh = 1, m_sw = 1, m_ph = 0, m_pw = 0;
+    // 检查形状并算出各维尺寸，不匹配时打印错误、m_outC 置 0
+    bool initGeometry(const std::vector<size_t> &kernel, const std::vector<size_t> &stride, const std::vector<size_t> &padding);
+    // 把一个样本展开成 (inC * kh * kw) x (outH * outW) 的矩阵，越界处为 0；col2im 为其转置，累加回输入
+    void im2col(const double *in, double *col) const;
+    void col2im(const double *col, double *in) const;
+    bool bindParameters(std::shared_ptr<AlignedVector<double>> block, double *params) override;
+    ConvLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, const std::vector<size_t> &kernel,
+             const std::vector<size_t> &stride, const std::vector<size_t> &padding, std::shared_ptr<MappedFile> mapping,
+             double *params);
+    friend Network;
+
+public:
+    // kernel 为 {kh, kw}；stride 为空时取 {1, 1}，padding 为空时取 {0, 0}
+    ConvLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::vector<size_t> kernel,
+             std::vector<size_t> stride = {}, std::vector<size_t> padding = {});
+    static size_t storageSize(size_t outC, size_t patch);
+    // 按扇入 inC * kh * kw 缩放
+    void normalInitSynapses(std::optional<unsigned> seed = std::nullopt) override;
+    void valueInitSynapses(double value) override;
+    void forward(const double *in, double *out) const override;
+    void forwardBatch(const double *in, double *out, size_t n) const override;
+    void backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const override;
+    std::span<double> parameters() override;
+    size_t paramCount() const override;
+    double flopsPerSample() const override;
+    std::string type() const override;
+    // 每个卷积核的长度 inC * kh * kw
+    size_t patchSize() const;
+    size_t outChannels() const;
+    double *weights();
+    const double *weights() const;
+    double *bias();
+    const double *bias() const;
+};
+
+// 二维汇聚：每个通道独立地在 wh x ww 的窗口里取最大值或平均值，没有参数。
+// 源层与目标层通道数相同，OH = (H - wh) / sh + 1（宽同理）。目标层一般用 linear 激活
+class Network::PoolLink : public Link
+{
+    Pooling m_mode;
+    size_t m_c = 0, m_inH = 0, m_inW = 0, m_outH = 0, m_outW = 0;
+    size_t m_wh = 0, m_ww = 0, m_sh = 0, m_sw = 0;
+    friend Network;
 
 public:
-    DenseLink(size_t source, size_t target);
-    void normalInitSynapses();
-    void valueInitSynapses(double value);
+    // window 为 {wh, ww}；stride 为空时等于窗口，即不重叠。形状不匹配时打印错误，前向不输出
+    PoolLink(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, std::vector<size_t> window,
+             Pooling mode = Pooling::Max, std::vector<size_t> stride = {});
+    void forward(const double *in, double *out) const override;
+    void forwardBatch(const double *in, double *out, size_t n) const override;
+    // 最大值汇聚的梯度只回到窗口内（第一个）最大的输入，平均汇聚均分到窗口内
+    void backwardBatch(const double *in, const double *dOut, double *dIn, double *grad, size_t n) const override;
+    std::span<double> parameters() override;
+    size_t paramCount() const override;
+    double flopsPerSample() const override;
+    std::string type() const override;
+    Pooling mode() const;
 };
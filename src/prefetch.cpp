@@ -0,0 +1,126 @@
+#include "prefetch.h"
+#include <numeric>
+#include <algorithm>
+
+BatchPrefetcher::BatchPrefetcher(const SampleSet &samples, size_t batchSize, size_t epochs, unsigned seed, size_t prefetch,
+                                 Augment augment)
+    : m_samples(samples), m_batchSize(std::max<size_t>(batchSize, 1)), m_epochs(epochs), m_augment(std::move(augment)),
+      m_shuffleGen(seed), m_order(samples.size())
+{
+    std::seed_seq augmentSeed{seed, 1u};
+    m_augmentGen.seed(augmentSeed);
+    std::iota(m_order.begin(), m_order.end(), 0);
+    const size_t rows = std::min(m_batchSize, std::max<size_t>(samples.size(), 1));
+    m_slots.resize(prefetch + 1);
+    m_free.reserve(m_slots.size());
+    m_ready.resize(m_slots.size());
+    for (size_t s = 0; s < m_slots.size(); s++)
+    {
+        m_slots[s].features.resize(rows * samples.featureSize);
+        m_slots[s].labels.resize(rows * samples.labelSize);
+        m_slots[s].indices.reserve(rows);
+        m_free.push_back(s);
+    }
+    if (prefetch)
+        m_worker = std::thread(&BatchPrefetcher::workerLoop, this);
+}
+
+BatchPrefetcher::~BatchPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = 1;
+    }
+    m_freeCv.notify_all();
+    if (m_worker.joinable())
+        m_worker.join();
+}
+
+bool BatchPrefetcher::produce(Minibatch &batch)
+{
+    const size_t total = m_order.size();
+    if (m_epoch >= m_epochs || total == 0)
+        return 0;
+    if (m_begin == 0)
+        std::shuffle(m_order.begin(), m_order.end(), m_shuffleGen);
+    const size_t n = std::min(m_batchSize, total - m_begin);
+    std::span<const size_t> rows = std::span<const size_t>(m_order).subspan(m_begin, n);
+    SampleSet::Permutation view = m_samples.permute(rows);
+    const size_t fs = m_samples.featureSize, ls = m_samples.labelSize;
+    for (size_t r = 0; r < n; r++)
+    {
+        SampleView v = view[r];
+        std::copy(v.features.begin(), v.features.end(), batch.features.data() + r * fs);
+        std::copy(v.labels.begin(), v.labels.end(), batch.labels.data() + r * ls);
+    }
+    batch.indices.assign(rows.begin(), rows.end());
+    batch.rows = n;
+    batch.epoch = m_epoch;
+    m_begin += n;
+    batch.last = m_begin == total;
+    if (batch.last)
+    {
+        m_begin = 0;
+        m_epoch++;
+    }
+    if (m_augment)
+        m_augment(batch.features.data(), n, fs, m_augmentGen);
+    return 1;
+}
+
+void BatchPrefetcher::workerLoop()
+{
+    for (;;)
+    {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_freeCv.wait(lock, [&]
+                          { return m_stop || !m_free.empty(); });
+            if (m_stop)
+                return;
+            slot = m_free.back();
+            m_free.pop_back();
+        }
+        // 收集和增强在锁外进行，和调用方的训练重叠
+        bool produced = produce(m_slots[slot]);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (produced)
+                m_ready[(m_readyHead + m_readyCount++) % m_ready.size()] = slot;
+            else
+            {
+                m_free.push_back(slot);
+                m_finished = 1;
+            }
+        }
+        m_readyCv.notify_one();
+        if (!produced)
+            return;
+    }
+}
+
+const Minibatch *BatchPrefetcher::next()
+{
+    if (!m_worker.joinable())
+    {
+        // 同步模式只用一个槽
+        m_current = 0;
+        return produce(m_slots[0]) ? &m_slots[0] : nullptr;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_current != SIZE_MAX)
+    {
+        m_free.push_back(m_current);
+        m_current = SIZE_MAX;
+        m_freeCv.notify_one();
+    }
+    m_readyCv.wait(lock, [&]
+                   { return m_finished || m_readyCount; });
+    if (!m_readyCount)
+        return nullptr;
+    m_current = m_ready[m_readyHead];
+    m_readyHead = (m_readyHead + 1) % m_ready.size();
+    m_readyCount--;
+    return &m_slots[m_current];
+}
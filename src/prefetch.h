@@ -0,0 +1,51 @@
+#pragma once
+
+#include "net.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// 按轮打乱样本顺序、把每批样本收集成连续的行，并可选地做数据增强。
+// prefetch > 0 时由后台线程提前准备最多 prefetch 批，和调用方正在用的一批共用 prefetch + 1 个复用的缓冲槽，
+// 内存上限与样本总数无关；prefetch 为 0 时在 next() 里同步准备。
+// 打乱与 Network::train 原来的做法一致：一个以 seed 初始化的 mt19937 每轮 shuffle 一次；
+// 增强使用另一个由 seed 派生的引擎，按批的顺序调用，所以两种模式给出完全相同的批序列
+class BatchPrefetcher : public BatchSource
+{
+public:
+    BatchPrefetcher(const SampleSet &samples, size_t batchSize, size_t epochs, unsigned seed, size_t prefetch = 1,
+                    Augment augment = nullptr);
+    ~BatchPrefetcher();
+    BatchPrefetcher(const BatchPrefetcher &) = delete;
+    BatchPrefetcher &operator=(const BatchPrefetcher &) = delete;
+    const Minibatch *next() override;
+
+private:
+    const SampleSet &m_samples;
+    const size_t m_batchSize;
+    const size_t m_epochs;
+    Augment m_augment;
+    // 以下只由生产者使用（同步模式下即调用线程）
+    std::mt19937 m_shuffleGen;
+    std::mt19937 m_augmentGen;
+    std::vector<size_t> m_order;
+    size_t m_epoch = 0;
+    size_t m_begin = 0;
+    // 准备下一批，轮次用完时返回 false
+    bool produce(Minibatch &batch);
+
+    std::vector<Minibatch> m_slots;
+    // 槽的编号在两个容器间循环，容量都预留为槽数，稳态下不再分配内存
+    std::vector<size_t> m_free;  // 空闲的槽，顺序无关
+    std::vector<size_t> m_ready; // 已准备好、按顺序等待取走的槽：从 m_readyHead 起的 m_readyCount 个，环形使用
+    size_t m_readyHead = 0;
+    size_t m_readyCount = 0;
+    size_t m_current = SIZE_MAX; // 调用方手上的槽，下一次 next() 时归还
+    bool m_finished = 0;         // 生产者已经准备完全部批次
+    bool m_stop = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_readyCv;
+    std::condition_variable m_freeCv;
+    std::thread m_worker;
+    void workerLoop();
+};
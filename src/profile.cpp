@@ -0,0 +1,109 @@
+#include "profile.h"
+#include <fstream>
+#include <atomic>
+#include <iomanip>
+
+void Profiler::reset(size_t layers, size_t links, bool trace)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_profile.linkForward.assign(links, ProfileCounter());
+    m_profile.linkBackward.assign(links, ProfileCounter());
+    m_profile.layerForward.assign(layers, ProfileCounter());
+    m_profile.layerBackward.assign(layers, ProfileCounter());
+    m_events.clear();
+    m_trace = trace;
+    m_origin = Clock::now();
+}
+
+// 给每个线程一个从 0 开始的小编号，作为 trace 的 tid
+static uint32_t threadIndex()
+{
+    static std::atomic<uint32_t> next{0};
+    thread_local uint32_t index = next++;
+    return index;
+}
+
+void Profiler::record(Kind kind, size_t index, Clock::time_point begin, Clock::time_point end, size_t samples,
+                      double flops, double bytes)
+{
+    const double seconds = std::chrono::duration<double>(end - begin).count();
+    const uint32_t thread = threadIndex();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<ProfileCounter> *counters = nullptr;
+    switch (kind)
+    {
+    case Kind::LinkForward:
+        counters = &m_profile.linkForward;
+        break;
+    case Kind::LinkBackward:
+        counters = &m_profile.linkBackward;
+        break;
+    case Kind::LayerForward:
+        counters = &m_profile.layerForward;
+        break;
+    case Kind::LayerBackward:
+        counters = &m_profile.layerBackward;
+        break;
+    }
+    // 开启计数后又改了层或链接时，超出下标的记录直接丢弃
+    if (index >= counters->size())
+        return;
+    ProfileCounter &c = (*counters)[index];
+    c.calls++;
+    c.samples += samples;
+    c.seconds += seconds;
+    c.flops += flops;
+    c.bytes += bytes;
+    if (m_trace && m_events.size() < maxEvents)
+    {
+        m_events.push_back({kind, uint32_t(index), thread, samples,
+                            std::chrono::duration<double, std::micro>(begin - m_origin).count(), seconds * 1e6});
+    }
+}
+
+NetworkProfile Profiler::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_profile;
+}
+
+// 层名来自用户的 comment，写进 JSON 前转义引号、反斜杠和控制字符
+static std::string jsonEscape(const std::string &s)
+{
+    std::string out;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20)
+            out += ' ';
+        else
+            out += c;
+    }
+    return out;
+}
+
+bool Profiler::writeTrace(const std::string &path, const std::vector<std::string> &layerNames,
+                          const std::vector<std::string> &linkNames) const
+{
+    std::ofstream os(path, std::ios::trunc);
+    if (!os)
+        return 0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 时间戳为微秒，保留到纳秒
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    for (size_t e = 0; e < m_events.size(); e++)
+    {
+        const Event &ev = m_events[e];
+        const bool link = ev.kind == Kind::LinkForward || ev.kind == Kind::LinkBackward;
+        const bool forward = ev.kind == Kind::LinkForward || ev.kind == Kind::LayerForward;
+        const std::vector<std::string> &names = link ? linkNames : layerNames;
+        const std::string name = ev.index < names.size() ? names[ev.index] : std::to_string(ev.index);
+        os << "{\"name\": \"" << jsonEscape(name) << "\", \"cat\": \"" << (link ? "link" : "layer") << (forward ? ".forward" : ".backward")
+           << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ev.thread << ", \"ts\": " << ev.begin << ", \"dur\": "
+           << ev.duration << ", \"args\": {\"samples\": " << ev.samples << "}}" << (e + 1 < m_events.size() ? "," : "") << "\n";
+    }
+    os << "]}\n";
+    return bool(os);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// 按层 / 链接累计的性能计数。只有定义了 NN_PROFILE 编译时 Network 才插入计时点，
+// 否则计时点全部编译掉，计数始终为空
+struct ProfileCounter
+{
+    uint64_t calls = 0;   // 调用次数（一次 forwardBatch 算一次）
+    uint64_t samples = 0; // 累计处理的样本数
+    double seconds = 0;   // 累计墙钟时间
+    double flops = 0;     // 按形状估算的浮点运算数
+    double bytes = 0;     // 估算的访存量：参数读一遍，激活按批读写
+};
+
+// 下标与 Network 的层表、链接表一一对应
+struct NetworkProfile
+{
+    std::vector<ProfileCounter> linkForward;
+    std::vector<ProfileCounter> linkBackward; // 含权重梯度和回传给源层的梯度
+    std::vector<ProfileCounter> layerForward; // 激活；融合的层是整层的矩阵乘 + 偏置 + 激活
+    std::vector<ProfileCounter> layerBackward; // 激活导数
+};
+
+// 计数与时间线的收集器，predict 可多线程并发，记录时加锁
+class Profiler
+{
+public:
+    enum class Kind
+    {
+        LinkForward,
+        LinkBackward,
+        LayerForward,
+        LayerBackward
+    };
+    using Clock = std::chrono::steady_clock;
+
+    // 清空计数并按层数、链接数重新分配；trace 为真时同时保留每次调用的时间线
+    void reset(size_t layers, size_t links, bool trace);
+    void record(Kind kind, size_t index, Clock::time_point begin, Clock::time_point end, size_t samples,
+                double flops, double bytes);
+    NetworkProfile snapshot() const;
+    // 写成 Chrome trace 的 JSON（chrome://tracing、Perfetto 可直接打开），事件名取自 layerNames / linkNames
+    bool writeTrace(const std::string &path, const std::vector<std::string> &layerNames,
+                    const std::vector<std::string> &linkNames) const;
+
+private:
+    struct Event
+    {
+        Kind kind;
+        uint32_t index;
+        uint32_t thread;
+        uint64_t samples;
+        double begin; // 相对 m_origin 的微秒
+        double duration;
+    };
+    // 时间线最多保留的事件数，超出后只累计计数
+    static constexpr size_t maxEvents = size_t(1) << 20;
+    mutable std::mutex m_mutex;
+    NetworkProfile m_profile;
+    std::vector<Event> m_events;
+    bool m_trace = 0;
+    Clock::time_point m_origin = Clock::now();
+};
+
+// 计时点：构造时读时钟，析构时把这段时间记到对应的层或链接上；profiler 为空时什么也不做
+class ProfileScope
+{
+    Profiler *m_profiler;
+    Profiler::Kind m_kind;
+    size_t m_index;
+    size_t m_samples;
+    double m_flops;
+    double m_bytes;
+    Profiler::Clock::time_point m_begin;
+
+public:
+    ProfileScope(Profiler *profiler, Profiler::Kind kind, size_t index, size_t samples, double flops, double bytes)
+        : m_profiler(profiler), m_kind(kind), m_index(index), m_samples(samples), m_flops(flops), m_bytes(bytes)
+    {
+        if (m_profiler)
+            m_begin = Profiler::Clock::now();
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+    ~ProfileScope()
+    {
+        if (m_profiler)
+            m_profiler->record(m_kind, m_index, m_begin, Profiler::Clock::now(), m_samples, m_flops, m_bytes);
+    }
+};
@@ -0,0 +1,672 @@
+#include "server.h"
+#include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <future>
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+static const int sendFlags = 0;
+static void closeSocket(intptr_t fd)
+{
+    closesocket(SOCKET(fd));
+}
+static void shutdownSocket(intptr_t fd)
+{
+    shutdown(SOCKET(fd), SD_BOTH);
+}
+static bool initSockets()
+{
+    static const bool ok = []
+    {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return ok;
+}
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+// 对端先关闭时不要收到 SIGPIPE
+static const int sendFlags = MSG_NOSIGNAL;
+static void closeSocket(intptr_t fd)
+{
+    ::close(int(fd));
+}
+static void shutdownSocket(intptr_t fd)
+{
+    ::shutdown(int(fd), SHUT_RDWR);
+}
+static bool initSockets()
+{
+    return 1;
+}
+#endif
+
+static double percentile(std::vector<double> values, double q)
+{
+    if (values.empty())
+        return 0;
+    size_t k = std::min(values.size() - 1, size_t(q * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+BatchingServer::BatchingServer(const Network &net, ServerOptions options)
+    : m_net(net), m_options{std::max<size_t>(options.maxBatch, 1), options.maxDelay},
+      m_featureSize(net.inputSize()), m_outputSize(net.outputSize())
+{
+    m_latencies.reserve(latencyWindow);
+    m_worker = std::thread(&BatchingServer::workerLoop, this);
+}
+
+BatchingServer::~BatchingServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = 1;
+    }
+    m_cv.notify_all();
+    m_worker.join();
+}
+
+bool BatchingServer::submit(std::span<const double> features, Callback done)
+{
+    if (features.size() != m_featureSize)
+    {
+        std::cout << "BatchingServer Error: expected " << m_featureSize << " features, got " << features.size() << std::endl;
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop)
+            return 0;
+        Request r;
+        if (!m_spare.empty())
+        {
+            r = std::move(m_spare.back());
+            m_spare.pop_back();
+        }
+        r.features.assign(features.begin(), features.end());
+        r.done = std::move(done);
+        r.arrival = Clock::now();
+        m_queue.push_back(std::move(r));
+    }
+    m_cv.notify_one();
+    return 1;
+}
+
+bool BatchingServer::predict(std::span<const double> features, std::span<double> outputs)
+{
+    if (outputs.size() != m_outputSize)
+    {
+        std::cout << "BatchingServer Error: expected " << m_outputSize << " outputs, got " << outputs.size() << std::endl;
+        return 0;
+    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool finished = 0, predicted = 0;
+    bool ok = submit(features, [&](std::span<const double> result)
+                     {
+        std::copy(result.begin(), result.end(), outputs.begin());
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = 1;
+        predicted = !result.empty();
+        cv.notify_one(); });
+    if (!ok)
+        return 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]
+            { return finished; });
+    return predicted;
+}
+
+void BatchingServer::workerLoop()
+{
+    const size_t fs = m_featureSize, os = m_outputSize;
+    AlignedVector<double> input(m_options.maxBatch * fs), output(m_options.maxBatch * os);
+    Network::InferenceContext ctx;
+    std::vector<Request> batch;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&]
+                      { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+                return;
+            // 凑批：等到批满、最早的请求到期或服务停止
+            const Clock::time_point deadline = m_queue.front().arrival + m_options.maxDelay;
+            m_cv.wait_until(lock, deadline, [&]
+                            { return m_stop || m_queue.size() >= m_options.maxBatch; });
+            const size_t n = std::min(m_options.maxBatch, m_queue.size());
+            for (size_t i = 0; i < n; i++)
+            {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+        const size_t n = batch.size();
+        for (size_t i = 0; i < n; i++)
+            std::copy(batch[i].features.begin(), batch[i].features.end(), input.begin() + i * fs);
+        const bool ok =
+            m_net.predictBatch(std::span<const double>(input.data(), n * fs), n, std::span<double>(output.data(), n * os), ctx);
+        // 先记统计再回调，回调之后调用方看到的 stats 已包含自己的请求；失败的批不计入
+        const Clock::time_point now = Clock::now();
+        if (ok)
+        {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            for (const Request &r : batch)
+            {
+                const double us = std::chrono::duration<double, std::micro>(now - r.arrival).count();
+                if (m_latencies.size() < latencyWindow)
+                    m_latencies.push_back(us);
+                else
+                    m_latencies[m_requests % latencyWindow] = us;
+                m_requests++;
+            }
+            m_batches++;
+        }
+        for (size_t i = 0; i < n; i++)
+            batch[i].done(ok ? std::span<const double>(output.data() + i * os, os) : std::span<const double>());
+        // 回调已执行完，把请求连同特征缓冲还回去复用
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Request &r : batch)
+        {
+            r.done = nullptr;
+            m_spare.push_back(std::move(r));
+        }
+        batch.clear();
+    }
+}
+
+ServerStats BatchingServer::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    ServerStats s;
+    s.requests = m_requests;
+    s.batches = m_batches;
+    s.seconds = std::chrono::duration<double>(Clock::now() - m_since).count();
+    s.qps = s.seconds > 0 ? m_requests / s.seconds : 0;
+    s.meanBatch = m_batches ? double(m_requests) / m_batches : 0;
+    s.p50 = percentile(m_latencies, 0.5);
+    s.p99 = percentile(m_latencies, 0.99);
+    s.max = m_latencies.empty() ? 0 : *std::max_element(m_latencies.begin(), m_latencies.end());
+    return s;
+}
+
+void BatchingServer::resetStats()
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    m_requests = m_batches = 0;
+    m_latencies.clear();
+    m_since = Clock::now();
+}
+
+size_t BatchingServer::featureSize() const
+{
+    return m_featureSize;
+}
+
+size_t BatchingServer::outputSize() const
+{
+    return m_outputSize;
+}
+
+// 空白分隔的数，个数必须正好为 count
+static bool parseRequest(const std::string &line, std::vector<double> &values, size_t count)
+{
+    values.clear();
+    const char *p = line.data(), *end = p + line.size();
+    while (1)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == ','))
+            p++;
+        if (p == end)
+            break;
+        double v;
+        auto [q, ec] = std::from_chars(p, end, v);
+        if (ec != std::errc() || values.size() == count)
+            return 0;
+        values.push_back(v);
+        p = q;
+    }
+    return values.size() == count;
+}
+
+// "<类别> <输出...>"，输出用最短的可往返表示
+static std::string formatReply(std::span<const double> outputs)
+{
+    std::string reply = std::to_string(std::max_element(outputs.begin(), outputs.end()) - outputs.begin());
+    char buf[32];
+    for (double v : outputs)
+    {
+        auto [e, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+        reply += ' ';
+        reply.append(buf, e);
+    }
+    return reply;
+}
+
+static std::string formatStats(const ServerStats &s)
+{
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "requests %llu batches %llu meanBatch %.2f qps %.0f p50 %.1fus p99 %.1fus max %.1fus",
+                  (unsigned long long)s.requests, (unsigned long long)s.batches, s.meanBatch, s.qps, s.p50, s.p99, s.max);
+    return buf;
+}
+
+bool serveLines(BatchingServer &server, const std::function<bool(std::string &)> &readLine,
+                const std::function<bool(const std::string &)> &writeLine, size_t window)
+{
+    window = std::max<size_t>(window, 1);
+    // 在途请求按到达顺序排队，写线程依次等结果写回，读线程不必等应答就能继续读下一行
+    std::deque<std::future<std::string>> pending;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool inputDone = 0, peerClosed = 0;
+    std::thread writer([&]
+                       {
+        for (;;)
+        {
+            std::future<std::string> reply;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]
+                        { return inputDone || !pending.empty(); });
+                if (pending.empty())
+                    return;
+                reply = std::move(pending.front());
+            }
+            std::string line = reply.get();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.pop_front();
+            }
+            cv.notify_all();
+            if (!peerClosed && !writeLine(line))
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                peerClosed = 1;
+            }
+        } });
+
+    auto enqueue = [&](std::future<std::string> reply)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]
+                { return pending.size() < window; });
+        pending.push_back(std::move(reply));
+        cv.notify_all();
+    };
+    auto ready = [](std::string text)
+    {
+        std::promise<std::string> p;
+        p.set_value(std::move(text));
+        return p.get_future();
+    };
+    // 控制行要反映它之前全部请求的结果，先等在途请求写完
+    auto drain = [&]
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]
+                { return pending.empty(); });
+    };
+
+    bool shutdown = 0;
+    std::string line;
+    std::vector<double> features;
+    while (!shutdown && readLine(line))
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (peerClosed)
+                break;
+        }
+        if (line == "stats" || line == "stats\r")
+        {
+            drain();
+            enqueue(ready(formatStats(server.stats())));
+            continue;
+        }
+        if (line == "shutdown" || line == "shutdown\r")
+        {
+            drain();
+            enqueue(ready("bye"));
+            shutdown = 1;
+            continue;
+        }
+        if (line.empty())
+            continue;
+        if (!parseRequest(line, features, server.featureSize()))
+        {
+            enqueue(ready("error expected " + std::to_string(server.featureSize()) + " numbers"));
+            continue;
+        }
+        auto promise = std::make_shared<std::promise<std::string>>();
+        std::future<std::string> reply = promise->get_future();
+        if (!server.submit(features, [promise](std::span<const double> outputs)
+                           { promise->set_value(outputs.empty() ? "error predict failed" : formatReply(outputs)); }))
+        {
+            enqueue(ready("error server stopped"));
+            continue;
+        }
+        enqueue(std::move(reply));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inputDone = 1;
+    }
+    cv.notify_all();
+    writer.join();
+    return shutdown;
+}
+
+// 按行读 socket，行尾的 '\n' 不含在结果里
+class SocketReader
+{
+    intptr_t m_fd;
+    std::string m_buffer;
+    size_t m_pos = 0;
+
+public:
+    explicit SocketReader(intptr_t fd) : m_fd(fd) {}
+    bool readLine(std::string &line)
+    {
+        for (;;)
+        {
+            size_t nl = m_buffer.find('\n', m_pos);
+            if (nl != std::string::npos)
+            {
+                line.assign(m_buffer, m_pos, nl - m_pos);
+                m_pos = nl + 1;
+                return 1;
+            }
+            m_buffer.erase(0, m_pos);
+            m_pos = 0;
+            char chunk[16384];
+            auto got = recv(m_fd, chunk, sizeof(chunk), 0);
+            if (got <= 0)
+                return 0;
+            m_buffer.append(chunk, size_t(got));
+        }
+    }
+};
+
+static bool sendAll(intptr_t fd, const char *data, size_t size)
+{
+    while (size)
+    {
+        auto sent = send(fd, data, int(std::min<size_t>(size, 1 << 30)), sendFlags);
+        if (sent <= 0)
+            return 0;
+        data += sent;
+        size -= size_t(sent);
+    }
+    return 1;
+}
+
+static void setNoDelay(intptr_t fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&one), sizeof(one));
+}
+
+TcpServer::TcpServer(BatchingServer &server, size_t window) : m_server(server), m_window(window)
+{
+}
+
+TcpServer::~TcpServer()
+{
+    stop();
+    for (std::thread &t : m_threads)
+        if (t.joinable())
+            t.join();
+    if (m_listen != -1)
+        closeSocket(m_listen);
+}
+
+bool TcpServer::listen(uint16_t port)
+{
+    if (!initSockets())
+    {
+        std::cout << "TcpServer Error: couldn't initialize sockets" << std::endl;
+        return 0;
+    }
+    intptr_t fd = intptr_t(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if (fd == -1)
+    {
+        std::cout << "TcpServer Error: couldn't create socket" << std::endl;
+        return 0;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&one), sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+    {
+        std::cout << "TcpServer Error: couldn't listen on 127.0.0.1:" << port << std::endl;
+        closeSocket(fd);
+        return 0;
+    }
+    m_listen = fd;
+    m_port = ntohs(addr.sin_port);
+    return 1;
+}
+
+uint16_t TcpServer::port() const
+{
+    return m_port;
+}
+
+void TcpServer::run()
+{
+    while (!m_stop)
+    {
+        intptr_t fd = intptr_t(accept(m_listen, nullptr, nullptr));
+        if (fd == -1)
+            break;
+        reap();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop)
+        {
+            closeSocket(fd);
+            break;
+        }
+        setNoDelay(fd);
+        m_clients.push_back(fd);
+        m_threads.emplace_back(&TcpServer::handle, this, fd);
+    }
+    // 断开仍在读的连接，让各连接线程退出
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (intptr_t fd : m_clients)
+            shutdownSocket(fd);
+    }
+    for (std::thread &t : m_threads)
+        t.join();
+    m_threads.clear();
+    m_finished.clear();
+}
+
+void TcpServer::reap()
+{
+    std::vector<std::thread> done;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (std::thread::id id : m_finished)
+        {
+            auto it = std::find_if(m_threads.begin(), m_threads.end(), [&](const std::thread &t)
+                                   { return t.get_id() == id; });
+            done.push_back(std::move(*it));
+            m_threads.erase(it);
+        }
+        m_finished.clear();
+    }
+    // 在锁外 join：线程收尾时可能还要调用 stop()，它也要拿这把锁
+    for (std::thread &t : done)
+        t.join();
+}
+
+void TcpServer::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stop.exchange(true))
+        return;
+    // 关闭监听的读写方向，阻塞在 accept 上的 run() 随之返回
+    if (m_listen != -1)
+        shutdownSocket(m_listen);
+}
+
+void TcpServer::handle(intptr_t fd)
+{
+    SocketReader reader(fd);
+    bool shutdown = serveLines(
+        m_server, [&](std::string &line)
+        { return reader.readLine(line); },
+        [&](const std::string &line)
+        {
+            std::string data = line + '\n';
+            return sendAll(fd, data.data(), data.size());
+        },
+        m_window);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_clients.erase(std::find(m_clients.begin(), m_clients.end(), fd));
+        closeSocket(fd);
+        m_finished.push_back(std::this_thread::get_id());
+    }
+    if (shutdown)
+        stop();
+}
+
+static intptr_t connectLocal(uint16_t port)
+{
+    if (!initSockets())
+        return -1;
+    intptr_t fd = intptr_t(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if (fd == -1)
+        return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        closeSocket(fd);
+        return -1;
+    }
+    setNoDelay(fd);
+    return fd;
+}
+
+LoadgenResult runLoadgen(uint16_t port, const SampleSet &samples, size_t connections, size_t requests, size_t pipeline)
+{
+    LoadgenResult result;
+    if (samples.size() == 0 || connections == 0)
+        return result;
+    pipeline = std::max<size_t>(pipeline, 1);
+    // 请求行提前格式化好，压测时只剩收发
+    std::vector<std::string> lines(samples.size());
+    std::vector<size_t> expected(samples.size());
+    char buf[32];
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        SampleView v = samples.at(i);
+        for (double f : v.features)
+        {
+            auto [e, ec] = std::to_chars(buf, buf + sizeof(buf), f);
+            lines[i].append(buf, e);
+            lines[i] += ' ';
+        }
+        lines[i].back() = '\n';
+        expected[i] = std::max_element(v.labels.begin(), v.labels.end()) - v.labels.begin();
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<uint64_t> errors(connections), correct(connections);
+    std::vector<std::thread> threads;
+    const Clock::time_point begin = Clock::now();
+    for (size_t c = 0; c < connections; c++)
+    {
+        threads.emplace_back([&, c]
+                             {
+            intptr_t fd = connectLocal(port);
+            if (fd == -1)
+            {
+                errors[c] = requests;
+                return;
+            }
+            SocketReader reader(fd);
+            std::deque<std::pair<size_t, Clock::time_point>> inflight;
+            std::string reply;
+            size_t sent = 0, received = 0;
+            latencies[c].reserve(requests);
+            while (received < requests)
+            {
+                // 在途未满就继续发，否则收一个应答
+                if (sent < requests && inflight.size() < pipeline)
+                {
+                    const size_t idx = (c + sent * connections) % lines.size();
+                    inflight.emplace_back(idx, Clock::now());
+                    if (!sendAll(fd, lines[idx].data(), lines[idx].size()))
+                        break;
+                    sent++;
+                    continue;
+                }
+                if (!reader.readLine(reply))
+                    break;
+                auto [idx, t0] = inflight.front();
+                inflight.pop_front();
+                latencies[c].push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+                received++;
+                size_t cls = 0;
+                auto [p, ec] = std::from_chars(reply.data(), reply.data() + reply.size(), cls);
+                if (ec != std::errc())
+                    errors[c]++;
+                else
+                    correct[c] += cls == expected[idx];
+            }
+            errors[c] += requests - received;
+            closeSocket(fd); });
+    }
+    for (std::thread &t : threads)
+        t.join();
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    std::vector<double> all;
+    uint64_t right = 0;
+    for (size_t c = 0; c < connections; c++)
+    {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        result.errors += errors[c];
+        right += correct[c];
+    }
+    result.requests = all.size();
+    result.qps = result.seconds > 0 ? result.requests / result.seconds : 0;
+    result.p50 = percentile(all, 0.5);
+    result.p99 = percentile(all, 0.99);
+    result.max = all.empty() ? 0 : *std::max_element(all.begin(), all.end());
+    result.accuracy = result.requests ? double(right) / result.requests : 0;
+
+    intptr_t fd = connectLocal(port);
+    if (fd != -1)
+    {
+        SocketReader reader(fd);
+        if (sendAll(fd, "stats\n", 6))
+            reader.readLine(result.serverStats);
+        closeSocket(fd);
+    }
+    return result;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "net.h"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+struct ServerOptions
+{
+    size_t maxBatch = 32;                        // 一个微批最多合并的请求数
+    std::chrono::microseconds maxDelay{500};     // 微批里最早的请求最多等这么久，到时不满也发车
+};
+
+// 延迟为从提交到结果写回的微秒数，只统计最近 latencyWindow 个请求
+struct ServerStats
+{
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    double seconds = 0; // 从上次重置到现在的墙钟时间
+    double qps = 0;
+    double meanBatch = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+// 把并发到达的单样本请求合并成微批，由一个批处理线程做批量前向。
+// 网络须已编译，服务期间只读，调用方负责不在此期间训练或修改它
+class BatchingServer
+{
+public:
+    // 回调在批处理线程里调用，outputs 只在回调期间有效；该批前向失败时 outputs 为空
+    using Callback = std::function<void(std::span<const double> outputs)>;
+
+    BatchingServer(const Network &net, ServerOptions options = ServerOptions());
+    // 处理完已提交的请求后退出
+    ~BatchingServer();
+    BatchingServer(const BatchingServer &) = delete;
+    BatchingServer &operator=(const BatchingServer &) = delete;
+
+    // 异步提交，特征被拷贝进队列，调用后即可复用 features
+    bool submit(std::span<const double> features, Callback done);
+    // 提交并等待结果写进 outputs，前向失败时返回 false
+    bool predict(std::span<const double> features, std::span<double> outputs);
+    ServerStats stats() const;
+    void resetStats();
+    size_t featureSize() const;
+    size_t outputSize() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Request
+    {
+        AlignedVector<double> features;
+        Callback done;
+        Clock::time_point arrival;
+    };
+    static constexpr size_t latencyWindow = size_t(1) << 16;
+
+    const Network &m_net;
+    const ServerOptions m_options;
+    const size_t m_featureSize;
+    const size_t m_outputSize;
+    std::deque<Request> m_queue;
+    std::vector<Request> m_spare; // 用过的请求，复用其中的特征缓冲
+    bool m_stop = 0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    mutable std::mutex m_statsMutex;
+    uint64_t m_requests = 0;
+    uint64_t m_batches = 0;
+    std::vector<double> m_latencies; // 环形缓冲
+    Clock::time_point m_since = Clock::now();
+
+    std::thread m_worker;
+    void workerLoop();
+};
+
+// 行协议：每行一个请求，为 featureSize 个空白分隔的数；应答一行 "<类别> <各输出...>"，出错时为 "error <原因>"。
+// 另有两个控制行："stats" 应答一行统计，"shutdown" 应答 "bye" 后关闭服务。
+// 同一连接上可以连续发送多行，最多 window 个请求同时在途，应答保持请求顺序
+// readLine 返回 false 表示输入结束；writeLine 返回 false 表示对端已关闭。返回值为是否收到 shutdown
+bool serveLines(BatchingServer &server, const std::function<bool(std::string &)> &readLine,
+                const std::function<bool(const std::string &)> &writeLine, size_t window);
+
+// 只监听 127.0.0.1 的 TCP 服务，每个连接一个线程，所有连接共用一个 BatchingServer
+class TcpServer
+{
+public:
+    TcpServer(BatchingServer &server, size_t window = 64);
+    ~TcpServer();
+    TcpServer(const TcpServer &) = delete;
+    TcpServer &operator=(const TcpServer &) = delete;
+    // port 为 0 时由系统分配，用 port() 查询
+    bool listen(uint16_t port);
+    uint16_t port() const;
+    // 接受连接直到 stop() 或某个连接发来 shutdown
+    void run();
+    void stop();
+
+private:
+    BatchingServer &m_server;
+    const size_t m_window;
+    intptr_t m_listen = -1;
+    uint16_t m_port = 0;
+    std::atomic<bool> m_stop{false};
+    std::mutex m_mutex;
+    std::vector<intptr_t> m_clients;
+    std::vector<std::thread> m_threads;
+    std::vector<std::thread::id> m_finished; // 已处理完、等待 join 的连接线程
+    void handle(intptr_t fd);
+    // join 已结束的连接线程，长时间运行时线程对象不会越积越多
+    void reap();
+};
+
+// 本地压测客户端的结果，延迟为客户端看到的往返微秒数
+struct LoadgenResult
+{
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double seconds = 0;
+    double qps = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double max = 0;
+    double accuracy = 0; // 应答的类别与样本标签一致的比例
+    std::string serverStats; // 结束时向服务端要的 stats 行
+};
+
+// connections 个连接各发 requests 个请求，样本从 samples 里轮流取；
+// 每个连接最多 pipeline 个请求在途（1 为严格的一问一答）
+LoadgenResult runLoadgen(uint16_t port, const SampleSet &samples, size_t connections, size_t requests,
+                         size_t pipeline = 1);
@@ -0,0 +1,63 @@
+#include "staticnet.h"
+#include "net.h"
+#include <stdexcept>
+
+bool readDenseChain(const std::string &path, std::vector<DenseStage> &stages)
+{
+    std::unique_ptr<Network> net;
+    try
+    {
+        net = std::make_unique<Network>(path);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        return 0;
+    }
+    stages.clear();
+    const auto &layers = net->layers();
+    const auto &links = net->links();
+    std::shared_ptr<Network::Layer> current = layers.front();
+    while (current != layers.back())
+    {
+        const Network::Link *out = nullptr;
+        size_t outCount = 0;
+        for (const auto &link : links)
+            if (link->source() == current)
+            {
+                out = link.get();
+                outCount++;
+            }
+        if (outCount != 1)
+        {
+            std::cout << path << ": layer " << stages.size() << " has " << outCount << " outgoing links, expected a single chain"
+                      << std::endl;
+            return 0;
+        }
+        const Network::DenseLink *next = dynamic_cast<const Network::DenseLink *>(out);
+        if (!next)
+        {
+            std::cout << path << ": only chains of Dense links are supported, found " << out->type() << std::endl;
+            return 0;
+        }
+        DenseStage stage;
+        stage.rows = next->rows();
+        stage.cols = next->cols();
+        if (!parseActivation(next->target()->activate(), stage.activation))
+        {
+            std::cout << path << ": unknown activation " << next->target()->activate() << std::endl;
+            return 0;
+        }
+        stage.weights.assign(next->weights(), next->weights() + stage.rows * stage.cols);
+        stage.bias.assign(next->bias(), next->bias() + stage.rows);
+        stages.push_back(std::move(stage));
+        current = next->target();
+    }
+    // 链以外还有链接（汇合进链上的层，或挂在链外的层）时前向结果会不同
+    if (stages.size() != links.size())
+    {
+        std::cout << path << " has links outside the input-to-output chain" << std::endl;
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "activation.h"
+#include "vecmath.h"
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <span>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// 从 .nll 读出的一条全连接链：输入层起每层恰有一条 DenseLink 出链接，直到输出层
+struct DenseStage
+{
+    size_t rows = 0; // 目标层大小
+    size_t cols = 0; // 源层大小
+    Activation activation = Activation::Linear; // 目标层的激活
+    std::vector<double> weights; // 行主序 rows x cols
+    std::vector<double> bias;
+};
+
+// 模型不是这样的链（有其他种类的链接、分叉或汇合）时打印原因并返回 false
+bool readDenseChain(const std::string &path, std::vector<DenseStage> &stages);
+
+// 形状与激活在编译期固定的全连接层。输出补齐到 4 的倍数（padded 个，多出的行权重和偏置为 0），
+// 按 block 行分块；每块的权重按列连续存放（In x 块宽），前向时整块的累加器留在寄存器里，
+// 对每个输入广播 x[c] 做一次 FMA，不需要横向求和。块数、块宽和循环次数都是常量
+template <size_t In, size_t Out, Activation Act>
+struct Dense
+{
+    static_assert(In > 0 && Out > 0, "layer sizes must be positive");
+    static constexpr size_t inputs = In;
+    static constexpr size_t outputs = Out;
+    static constexpr size_t padded = (Out + 3) / 4 * 4;
+    static constexpr size_t block = 32; // 8 个 AVX 累加器，足以掩盖 FMA 的延迟
+    static constexpr Activation activation = Act;
+
+    alignas(64) std::array<double, In * padded> panels{};
+    alignas(64) std::array<double, padded> bias{};
+
+    bool assign(const DenseStage &stage)
+    {
+        if (stage.rows != Out || stage.cols != In || stage.activation != Act)
+            return 0;
+        for (size_t begin = 0; begin < padded; begin += block)
+        {
+            const size_t width = std::min(block, padded - begin);
+            double *panel = panels.data() + begin * In;
+            for (size_t c = 0; c < In; c++)
+                for (size_t r = 0; r < width; r++)
+                    panel[c * width + r] = begin + r < Out ? stage.weights[(begin + r) * In + c] : 0;
+        }
+        std::copy(stage.bias.begin(), stage.bias.end(), bias.begin());
+        return 1;
+    }
+
+    // y 需有 padded 个元素，补齐的部分结果无意义
+    void forward(const double *x, double *y) const
+    {
+        forwardBlock<0>(x, y);
+        if constexpr (Act == Activation::Softmax)
+            activate(Act, y, y, 1, Out);
+    }
+
+private:
+    template <size_t Begin>
+    void forwardBlock(const double *x, double *y) const
+    {
+        constexpr size_t width = std::min(block, padded - Begin);
+        blockKernel<Begin, width>(x, y, std::make_index_sequence<width / 4>());
+        if constexpr (Begin + width < padded)
+            forwardBlock<Begin + width>(x, y);
+    }
+
+    // V 为块内的各个 4 元素分组；用折叠表达式展开，累加器都是常量下标，编译器不会把它们放回内存
+    template <size_t Begin, size_t Width, size_t... V>
+    void blockKernel(const double *x, double *y, std::index_sequence<V...>) const
+    {
+        const double *panel = panels.data() + Begin * In;
+#if defined(__AVX2__) && defined(__FMA__)
+        __m256d acc[] = {_mm256_load_pd(bias.data() + Begin + 4 * V)...};
+        size_t c = 0;
+        if constexpr (sizeof...(V) <= 4)
+        {
+            // 块窄时累加器不够掩盖 FMA 延迟，奇偶列各用一组，最后相加
+            __m256d odd[] = {(void(V), _mm256_setzero_pd())...};
+            for (; c + 2 <= In; c += 2)
+            {
+                const __m256d x0 = _mm256_broadcast_sd(x + c);
+                const __m256d x1 = _mm256_broadcast_sd(x + c + 1);
+                ((acc[V] = _mm256_fmadd_pd(_mm256_load_pd(panel + c * Width + 4 * V), x0, acc[V])), ...);
+                ((odd[V] = _mm256_fmadd_pd(_mm256_load_pd(panel + (c + 1) * Width + 4 * V), x1, odd[V])), ...);
+            }
+            ((acc[V] = _mm256_add_pd(acc[V], odd[V])), ...);
+        }
+        for (; c < In; c++)
+        {
+            const __m256d xc = _mm256_broadcast_sd(x + c);
+            ((acc[V] = _mm256_fmadd_pd(_mm256_load_pd(panel + c * Width + 4 * V), xc, acc[V])), ...);
+        }
+        (_mm256_storeu_pd(y + Begin + 4 * V, activate4<Act>(acc[V])), ...);
+#else
+        double acc[Width];
+        for (size_t r = 0; r < Width; r++)
+            acc[r] = bias[Begin + r];
+        for (size_t c = 0; c < In; c++)
+            for (size_t r = 0; r < Width; r++)
+                acc[r] += panel[c * Width + r] * x[c];
+        if constexpr (Act != Activation::Softmax)
+            activate(Act, acc, acc, 1, Width);
+        std::copy(acc, acc + Width, y + Begin);
+#endif
+    }
+};
+
+// 层数、各层大小和激活都由模板参数给出的前向网络，例如
+// StaticNetwork<Dense<256, 64, Activation::Sigmoid>, Dense<64, 10, Activation::Softmax>>。
+// 参数内嵌在对象里，predict 的中间结果都在栈上，不做任何堆分配；对象可能很大，大模型请放在堆上。
+// 只做推理，参数由 load 从 Network 保存的 .nll 读入
+template <typename... Layers>
+class StaticNetwork
+{
+    static_assert(sizeof...(Layers) > 0, "a network needs at least one layer");
+    using Tuple = std::tuple<Layers...>;
+    template <size_t I>
+    using LayerAt = std::tuple_element_t<I, Tuple>;
+    static constexpr size_t depth = sizeof...(Layers);
+
+    template <size_t... I>
+    static constexpr bool chained(std::index_sequence<I...>)
+    {
+        return ((LayerAt<I>::outputs == LayerAt<I + 1>::inputs) && ...);
+    }
+    static_assert(chained(std::make_index_sequence<depth - 1>()), "adjacent layer sizes must match");
+
+    Tuple m_layers;
+
+    template <size_t I>
+    void run(const double *x, double *y) const
+    {
+        alignas(64) double result[LayerAt<I>::padded];
+        std::get<I>(m_layers).forward(x, result);
+        if constexpr (I + 1 == depth)
+            std::copy(result, result + outputSize, y);
+        else
+            run<I + 1>(result, y);
+    }
+
+    template <size_t... I>
+    bool assign(const std::vector<DenseStage> &stages, std::index_sequence<I...>)
+    {
+        return (std::get<I>(m_layers).assign(stages[I]) && ...);
+    }
+
+public:
+    static constexpr size_t inputSize = LayerAt<0>::inputs;
+    static constexpr size_t outputSize = LayerAt<depth - 1>::outputs;
+
+    // 模型的层数、各层大小或激活与模板不一致时打印错误并返回 false，此时参数不确定
+    bool load(const std::string &path)
+    {
+        std::vector<DenseStage> stages;
+        if (!readDenseChain(path, stages))
+            return 0;
+        if (stages.size() != depth)
+        {
+            std::cout << path << " has " << stages.size() << " dense layers, expected " << depth << std::endl;
+            return 0;
+        }
+        if (!assign(stages, std::index_sequence_for<Layers...>()))
+        {
+            std::cout << path << " doesn't match the layer sizes or activations of this network" << std::endl;
+            return 0;
+        }
+        return 1;
+    }
+
+    void predict(const double *features, double *outputs) const
+    {
+        run<0>(features, outputs);
+    }
+
+    void predict(std::span<const double, inputSize> features, std::span<double, outputSize> outputs) const
+    {
+        run<0>(features.data(), outputs.data());
+    }
+
+    std::array<double, outputSize> predict(std::span<const double, inputSize> features) const
+    {
+        std::array<double, outputSize> outputs;
+        run<0>(features.data(), outputs.data());
+        return outputs;
+    }
+};
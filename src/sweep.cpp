@@ -0,0 +1,298 @@
+#include "sweep.h"
+#include "threadpool.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <filesystem>
+#include <mutex>
+
+static const char *optimizerName(Optimizer optimizer)
+{
+    switch (optimizer)
+    {
+    case Optimizer::Momentum:
+        return "momentum";
+    case Optimizer::Adam:
+        return "adam";
+    default:
+        return "sgd";
+    }
+}
+
+std::string SweepConfig::name() const
+{
+    std::ostringstream s;
+    s << "h";
+    if (hidden.empty())
+        s << "{}";
+    for (const std::vector<size_t> &shape : hidden)
+    {
+        s << "{";
+        for (size_t d = 0; d < shape.size(); d++)
+            s << (d ? "," : "") << shape[d];
+        s << "}";
+    }
+    s << "-" << activation << "-" << optimizerName(optimizer) << "-lr" << learningRate << "-b" << batchSize;
+    return s.str();
+}
+
+static size_t shapeSize(const std::vector<size_t> &shape)
+{
+    return std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>());
+}
+
+// 按形状估算参数量，只用于排任务的先后
+static size_t estimateParams(const SweepConfig &config, size_t featureSize, size_t labelSize)
+{
+    size_t total = 0, prev = featureSize;
+    for (const std::vector<size_t> &shape : config.hidden)
+    {
+        total += (prev + 1) * shapeSize(shape);
+        prev = shapeSize(shape);
+    }
+    return total + (prev + 1) * labelSize;
+}
+
+bool splitValidation(const SampleSet &samples, double fraction, unsigned seed, SampleSet &train, SampleSet &validation)
+{
+    if (train.featureSize != samples.featureSize || train.labelSize != samples.labelSize ||
+        validation.featureSize != samples.featureSize || validation.labelSize != samples.labelSize)
+    {
+        std::cout << "splitValidation Error: sample sizes don't match" << std::endl;
+        return 0;
+    }
+    const size_t held = size_t(std::lround(samples.size() * fraction));
+    if (held == 0 || held >= samples.size())
+    {
+        std::cout << "splitValidation Error: holding out " << fraction << " of " << samples.size()
+                  << " samples leaves one side empty" << std::endl;
+        return 0;
+    }
+    std::vector<size_t> order(samples.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(seed));
+    train.clear();
+    validation.clear();
+    train.reserve(samples.size() - held);
+    validation.reserve(held);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        SampleView v = samples.at(order[i]);
+        (i < held ? validation : train).push_back(v.features, v.labels);
+    }
+    return 1;
+}
+
+std::vector<SweepConfig> defaultSweepGrid()
+{
+    std::vector<SweepConfig> configs;
+    const std::vector<std::vector<std::vector<size_t>>> shapes = {{{3, 3}}, {{16}}, {{32}}, {{64}}, {{64}, {32}}};
+    for (const auto &hidden : shapes)
+        for (const char *activation : {"sigmoid", "relu"})
+            for (double lr : {0.01, 0.003})
+            {
+                SweepConfig c;
+                c.hidden = hidden;
+                c.activation = activation;
+                c.learningRate = lr;
+                configs.push_back(c);
+            }
+    return configs;
+}
+
+// 形状为空或含 0、激活名未知时打印原因并返回空
+static std::unique_ptr<Network> buildNetwork(const SweepConfig &config, size_t featureSize, size_t labelSize)
+{
+    Activation act;
+    if (!parseActivation(config.activation, act) || !parseActivation(config.outputActivation, act))
+    {
+        std::cout << "sweep Error: unknown activation in " << config.name() << std::endl;
+        return nullptr;
+    }
+    for (const std::vector<size_t> &shape : config.hidden)
+    {
+        if (shape.empty() || shapeSize(shape) == 0)
+        {
+            std::cout << "sweep Error: empty hidden layer in " << config.name() << std::endl;
+            return nullptr;
+        }
+    }
+    std::vector<std::shared_ptr<Network::Layer>> layers;
+    layers.push_back(std::make_shared<Network::Layer>(std::vector<size_t>({featureSize})));
+    for (const std::vector<size_t> &shape : config.hidden)
+        layers.push_back(std::make_shared<Network::Layer>(shape, config.activation));
+    layers.push_back(std::make_shared<Network::Layer>(std::vector<size_t>({labelSize}), config.outputActivation));
+    auto net = std::make_unique<Network>(layers.front(), layers.back());
+    for (size_t i = 1; i + 1 < layers.size(); i++)
+        net->addLayer(layers[i]);
+    for (size_t i = 0; i + 1 < layers.size(); i++)
+    {
+        auto link = std::make_shared<Network::DenseLink>(layers[i], layers[i + 1]);
+        link->normalInitSynapses(config.seed * 1000003u + unsigned(i));
+        net->addLink(link);
+    }
+    return net;
+}
+
+// 训练一个配置；snapshot 非空时每当验证准确率创新高就把当前模型存到那里
+static SweepResult runJob(const SweepConfig &config, const SampleSet &train, const SampleSet &validation,
+                          const SweepOptions &options, const std::string &snapshot)
+{
+    SweepResult r;
+    r.config = config;
+    auto t0 = std::chrono::steady_clock::now();
+    std::unique_ptr<Network> net = buildNetwork(config, train.featureSize, train.labelSize);
+    if (!net)
+        return r;
+    for (const auto &link : net->links())
+        r.params += link->paramCount();
+    TrainOptions t;
+    t.optimizer = config.optimizer;
+    t.learningRate = config.learningRate;
+    t.batchSize = config.batchSize;
+    t.epochs = options.maxEpochs;
+    t.seed = config.seed;
+    // 并行在任务之间，任务内部不再开训练线程和预取线程
+    t.threads = 1;
+    t.prefetch = 0;
+    t.verbose = 0;
+    size_t stale = 0;
+    t.onEpoch = [&](size_t epoch, double loss)
+    {
+        r.epochs = epoch + 1;
+        r.finalLoss = loss;
+        const double acc = net->accuracy(validation);
+        if (r.bestEpoch && acc <= r.bestAccuracy + options.minDelta)
+            stale++;
+        else
+            stale = 0;
+        if (!r.bestEpoch || acc > r.bestAccuracy)
+        {
+            r.bestAccuracy = acc;
+            r.bestEpoch = epoch + 1;
+            if (!snapshot.empty())
+                net->saveModel(snapshot);
+        }
+        if (options.patience && stale >= options.patience && r.epochs < options.maxEpochs)
+        {
+            r.stoppedEarly = 1;
+            return false;
+        }
+        return true;
+    };
+    r.ok = net->train(train, t);
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return r;
+}
+
+std::vector<SweepResult> runSweep(const SampleSet &train, const SampleSet &validation,
+                                  const std::vector<SweepConfig> &configs, const SweepOptions &options)
+{
+    std::vector<SweepResult> results(configs.size());
+    if (train.featureSize != validation.featureSize || train.labelSize != validation.labelSize)
+    {
+        std::cout << "sweep Error: train and validation sizes don't match" << std::endl;
+        return {};
+    }
+    std::vector<size_t> order(configs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return estimateParams(configs[a], train.featureSize, train.labelSize) >
+                              estimateParams(configs[b], train.featureSize, train.labelSize); });
+    auto snapshotPath = [&](size_t job)
+    {
+        return options.bestModelPath.empty() ? std::string() : options.bestModelPath + ".job" + std::to_string(job) + ".tmp";
+    };
+    std::mutex printMutex;
+    ThreadPool pool(options.threads);
+    pool.parallelFor(order.size(), [&](size_t k)
+                     {
+        const size_t job = order[k];
+        results[job] = runJob(configs[job], train, validation, options, snapshotPath(job));
+        if (options.verbose && results[job].ok)
+        {
+            const SweepResult &r = results[job];
+            std::lock_guard<std::mutex> lock(printMutex);
+            std::cout << "sweep " << r.config.name() << ": best accuracy " << r.bestAccuracy << " at epoch " << r.bestEpoch
+                      << " of " << r.epochs << (r.stoppedEarly ? " (stopped early)" : "") << ", " << r.seconds << " s"
+                      << std::endl;
+        } });
+
+    // 排名，再把第一名的快照改名为最终模型，其余的删掉
+    std::vector<size_t> rank(configs.size());
+    std::iota(rank.begin(), rank.end(), 0);
+    std::stable_sort(rank.begin(), rank.end(), [&](size_t a, size_t b)
+                     {
+        const SweepResult &x = results[a], &y = results[b];
+        if (x.ok != y.ok)
+            return x.ok > y.ok;
+        if (x.bestAccuracy != y.bestAccuracy)
+            return x.bestAccuracy > y.bestAccuracy;
+        return x.params < y.params; });
+    if (!options.bestModelPath.empty())
+    {
+        std::error_code ec;
+        for (size_t i = 0; i < rank.size(); i++)
+        {
+            const std::string path = snapshotPath(rank[i]);
+            if (i == 0 && results[rank[i]].ok)
+            {
+                std::filesystem::remove(options.bestModelPath, ec);
+                std::filesystem::rename(path, options.bestModelPath, ec);
+                if (ec)
+                    std::cout << "sweep Error: couldn't save " << options.bestModelPath << ": " << ec.message() << std::endl;
+            }
+            else
+                std::filesystem::remove(path, ec);
+        }
+    }
+    std::vector<SweepResult> ranked;
+    ranked.reserve(rank.size());
+    for (size_t i : rank)
+        ranked.push_back(std::move(results[i]));
+    return ranked;
+}
+
+bool saveSweepTable(const std::string &path, const std::vector<SweepResult> &results)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "saveSweepTable Error: couldn't open " << path << std::endl;
+        return 0;
+    }
+    out << "rank,name,params,best_accuracy,best_epoch,epochs,stopped_early,final_loss,seconds\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SweepResult &r = results[i];
+        // 名字里的形状含逗号，加引号
+        out << i + 1 << ",\"" << r.config.name() << "\"," << r.params << "," << r.bestAccuracy << "," << r.bestEpoch << ","
+            << r.epochs << "," << r.stoppedEarly << "," << r.finalLoss << "," << r.seconds << "\n";
+    }
+    return bool(out);
+}
+
+void printSweepTable(const std::vector<SweepResult> &results)
+{
+    std::cout << std::left << std::setw(6) << "rank" << std::setw(40) << "config" << std::right << std::setw(9) << "params"
+              << std::setw(10) << "accuracy" << std::setw(7) << "best" << std::setw(8) << "epochs" << std::setw(10)
+              << "seconds" << std::endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SweepResult &r = results[i];
+        std::cout << std::left << std::setw(6) << i + 1 << std::setw(40) << r.config.name() << std::right;
+        if (!r.ok)
+        {
+            std::cout << "  failed" << std::endl;
+            continue;
+        }
+        std::cout << std::setw(9) << r.params << std::setw(10) << r.bestAccuracy << std::setw(7) << r.bestEpoch
+                  << std::setw(7) << r.epochs << (r.stoppedEarly ? "*" : " ") << std::setw(10) << r.seconds << std::endl;
+    }
+}
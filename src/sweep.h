@@ -0,0 +1,59 @@
+#pragma once
+
+#include "net.h"
+
+// 一组要试的超参数：输入层 -> 各隐藏层 -> 输出层，相邻层之间一条 DenseLink
+struct SweepConfig
+{
+    std::vector<std::vector<size_t>> hidden = {{64}}; // 各隐藏层的形状，如 {{3, 3}}；为空时输入直连输出
+    std::string activation = "sigmoid";              // 隐藏层激活
+    std::string outputActivation = "softmax";
+    Optimizer optimizer = Optimizer::Adam;
+    double learningRate = 0.01;
+    size_t batchSize = 32;
+    unsigned seed = 1; // 权重初始化和打乱顺序都由它派生
+    // 例如 "h{3,3}-sigmoid-adam-lr0.01-b32"
+    std::string name() const;
+};
+
+struct SweepOptions
+{
+    size_t maxEpochs = 30;
+    size_t patience = 3;   // 验证准确率连续这么多轮没有超过最好成绩 minDelta 以上就停，0 表示不提前停
+    double minDelta = 1e-4;
+    size_t threads = 0;    // 同时训练的任务数，0 表示硬件线程数；每个任务内部单线程训练
+    std::string bestModelPath; // 非空时把验证准确率最高的那一轮模型保存到这里
+    bool verbose = 1;          // 每个任务结束时打印一行
+};
+
+struct SweepResult
+{
+    SweepConfig config;
+    bool ok = 0;             // 网络搭建或训练失败时为 false，其余字段无意义
+    size_t params = 0;       // 可训练参数个数
+    double bestAccuracy = 0; // 各轮验证准确率的最大值
+    size_t bestEpoch = 0;    // 取得 bestAccuracy 的轮次，从 1 起
+    size_t epochs = 0;       // 实际训练的轮数
+    bool stoppedEarly = 0;
+    double finalLoss = 0;    // 最后一轮的平均训练损失
+    double seconds = 0;
+};
+
+// 按 configs 搭网络并同时训练，每轮结束后在 validation 上评估，停滞时提前结束。
+// validation 用来选模型，应与最终报告准确率的测试集分开（见 splitValidation）。
+// 所有任务只读地共用 train 和 validation；任务按参数量从大到小交给线程池动态领取，大任务先开跑，尾部更整齐。
+// 返回按最佳验证准确率从高到低排好的结果，同分时参数少的在前
+std::vector<SweepResult> runSweep(const SampleSet &train, const SampleSet &validation,
+                                  const std::vector<SweepConfig> &configs, const SweepOptions &options = SweepOptions());
+
+// 按 seed 打乱后把约 fraction 比例的样本拷进 validation，其余拷进 train（两者原有内容清空，大小须与 samples 相同）；
+// 两边都要至少一个样本，否则打印原因并返回 false
+bool splitValidation(const SampleSet &samples, double fraction, unsigned seed, SampleSet &train, SampleSet &validation);
+
+// main sweep 的默认网格：隐藏层 {3,3}、{16}、{32}、{64}、{64}+{32} x sigmoid / relu x 学习率 0.01 / 0.003，共 20 组
+std::vector<SweepConfig> defaultSweepGrid();
+
+// 写成 CSV，一行一个配置，按结果的顺序给出名次
+bool saveSweepTable(const std::string &path, const std::vector<SweepResult> &results);
+
+void printSweepTable(const std::vector<SweepResult> &results);
@@ -1,7 +1,172 @@
 
 #include "test.h"
 #include "net.h"
+#include "prefetch.h"
+#include "server.h"
+#include "staticnet.h"
+#include "sweep.h"
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <numeric>
+#include <filesystem>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// 16x16 输入 -> hidden 个 sigmoid -> 10 个 softmax 的两层全连接网络，两条链接分别用 seed 和 seed + 1 初始化
+static Network makeDigitNet(size_t hidden, unsigned seed)
+{
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({hidden}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "softmax");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses(seed);
+    hid2out->normalInitSynapses(seed + 1);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+    return net;
+}
+
+// 分配计数钩子：替换全局 operator new，统计整个进程的堆分配次数，用来验证稳态的 predict / train 不分配内存。
+// 会替换整个可执行文件的分配器，只在定义 NN_COUNT_ALLOCATIONS 编译时存在，否则相关测试跳过
+#ifdef NN_COUNT_ALLOCATIONS
+static std::atomic<size_t> allocationCount{0};
+
+static void *countedAlloc(std::size_t size, std::size_t alignment)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    size = std::max<std::size_t>(size, 1);
+#ifdef _WIN32
+    void *p = _aligned_malloc(size, alignment);
+#else
+    void *p = alignment <= alignof(std::max_align_t) ? std::malloc(size)
+                                                     : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+static void countedFree(void *p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *operator new(std::size_t size)
+{
+    return countedAlloc(size, alignof(std::max_align_t));
+}
+void *operator new[](std::size_t size)
+{
+    return countedAlloc(size, alignof(std::max_align_t));
+}
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return countedAlloc(size, std::size_t(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return countedAlloc(size, std::size_t(alignment));
+}
+// nothrow 版本也要替换，否则标准库（如 stable_sort 的临时缓冲）分配的内存会被上面的 delete 释放
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return countedAlloc(size, alignof(std::max_align_t));
+    }
+    catch (const std::bad_alloc &)
+    {
+        return nullptr;
+    }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return countedAlloc(size, std::size_t(alignment));
+    }
+    catch (const std::bad_alloc &)
+    {
+        return nullptr;
+    }
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return operator new(size, alignment, std::nothrow);
+}
+void operator delete(void *p) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, std::size_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, std::size_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    countedFree(p);
+}
+
+// f 执行期间的堆分配次数
+template <typename F>
+static size_t countAllocations(F &&f)
+{
+    size_t before = allocationCount.load();
+    f();
+    return allocationCount.load() - before;
+}
+#endif
 
 void testLoadSample()
 {
@@ -12,32 +177,56 @@ void testLoadSample()
 
 void testSavingModel()
 {
-    /*auto in = std::make_shared<Layer>(std::vector<size_t>({2, 2}));
-    auto out = std::make_shared<Layer>(std::vector<size_t>({1}));
-    auto hid = std::make_shared<Layer>(std::vector<size_t>({3, 3}));
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({2, 2}));
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({1}), "sigmoid");
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({3, 3}), "sigmoid");
+    hid->comment = "hid";
 
-    auto in2hid = std::make_shared<DenseLink>(in, hid);
-    in2hid->normalInitSynapses();
-    auto hid2out = std::make_shared<DenseLink>(hid, out);
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    in2hid->normalInitSynapses(1);
+    std::fill(in2hid->bias(), in2hid->bias() + in2hid->rows(), 0.25);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    hid2out->normalInitSynapses(2);
+    auto in2out = std::make_shared<Network::Link>(in, out);
+    in2out->addSynapse(0, 0, 0.5);
+    in2out->addSynapse(3, 0, -0.5);
 
-    hid2out->normalInitSynapses();
     Network net(in, out);
-    net.addLayer("hid", hid);
+    net.comment = "inHidOut";
+    net.addLayer(hid);
     net.addLink(in2hid);
     net.addLink(hid2out);
-    net.saveModel("../models/inHidOutDenseLink.nll");*/
+    net.addLink(in2out);
+    const std::string path = (std::filesystem::temp_directory_path() / "inHidOut.nll").string();
+    if (!net.saveModel(path))
+        return;
+
+    double maxDiff = 0;
+    {
+        Network loaded(path);
+        std::vector<double> x = {0.1, -0.2, 0.3, 0.9};
+        maxDiff = std::abs(net.predict(x).labels.at(0) - loaded.predict(x).labels.at(0));
+    }
+    std::filesystem::remove(path);
+    std::cout << "saved model max diff: " << maxDiff << std::endl;
+
+    // v1 文本突触格式
+    Network legacy("../models/inHidOutDenseLink.nll");
+    legacy.printLayersInfo();
+    legacy.printLinksInfo();
+    std::cout << "v1 model predict: " << legacy.predict(std::vector<double>({1, 1, 1, 1})).labels.at(0) << std::endl;
 }
 
 void testPredict()
 {
-    auto in = std::make_shared<Layer>(std::vector<size_t>({1, 5}));
-    auto out = std::make_shared<Layer>(std::vector<size_t>({1}));
-    auto hid = std::make_shared<Layer>(std::vector<size_t>({3, 3}));
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({1, 5}));
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({1}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({3, 3}));
 
-    auto in2hid = std::make_shared<DenseLink>(in, hid);
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
     // in2hid->normalInitSynapses();
     in2hid->valueInitSynapses(1);
-    auto hid2out = std::make_shared<DenseLink>(hid, out);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
     // hid2out->normalInitSynapses();
     hid2out->valueInitSynapses(1);
 
@@ -53,4 +242,1113 @@ void testPredict()
 
     Sample outputSample = net.predict(inputSample);
     std::cout << outputSample.labels.at(0);
-}
\ No newline at end of file
+}
+void testPredictBatch()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({30}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses();
+    hid2out->normalInitSynapses();
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+
+    Matrix batch = net.predictBatch(smpSet, 32);
+    double maxDiff = 0;
+    for (size_t i = 0; i < smpSet.size(); i++)
+    {
+        Sample single = net.predict(smpSet.at(i).features);
+        for (size_t j = 0; j < batch.cols; j++)
+        {
+            maxDiff = std::max(maxDiff, std::abs(single.labels.at(j) - batch.row(i)[j]));
+        }
+    }
+    std::cout << "predictBatch max diff vs predict: " << maxDiff << std::endl;
+}
+
+void testTrain()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({64}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses();
+    hid2out->normalInitSynapses();
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 20;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    std::cout << "train accuracy: " << net.accuracy(trainSet) << " test accuracy: " << net.accuracy(testSet) << std::endl;
+}
+
+void testConcurrentPredict()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({64}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses();
+    hid2out->normalInitSynapses();
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+
+    const Network &model = net;
+    Matrix expected = model.predictBatch(smpSet, 64);
+    std::vector<size_t> mismatches(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < mismatches.size(); t++)
+    {
+        threads.emplace_back([&, t]
+                             {
+            Network::InferenceContext ctx = model.makeContext();
+            for (size_t i = 0; i < smpSet.size(); i++)
+            {
+                Sample s = model.predict(smpSet.at(i).features, ctx);
+                for (size_t j = 0; j < expected.cols; j++)
+                    mismatches[t] += s.labels.at(j) != expected.row(i)[j];
+            } });
+    }
+    for (auto &th : threads)
+        th.join();
+    std::cout << "concurrent predict mismatches: " << std::accumulate(mismatches.begin(), mismatches.end(), size_t(0)) << std::endl;
+}
+
+void testBinarySamples()
+{
+    SampleSet csvSet(256, 10);
+    if (!loadSamples("../data/test.csv", csvSet))
+        return;
+    const std::string path = (std::filesystem::temp_directory_path() / "digits_test.nlds").string();
+    for (SampleType type : {SampleType::F64, SampleType::U8, SampleType::Bit})
+    {
+        SampleSet binSet(256, 10);
+        if (!saveSamplesBinary(path, csvSet, type) || !loadSamplesBinary(path, binSet))
+            return;
+        size_t mismatches = binSet.size() != csvSet.size();
+        for (size_t i = 0; !mismatches && i < csvSet.size(); i++)
+        {
+            SampleView a = csvSet.at(i), b = binSet.at(i);
+            mismatches += !std::equal(a.features.begin(), a.features.end(), b.features.begin()) ||
+                          !std::equal(a.labels.begin(), a.labels.end(), b.labels.begin());
+        }
+        std::cout << "binary samples (" << (type == SampleType::F64 ? "f64" : type == SampleType::U8 ? "u8" : "bit")
+                  << ", " << std::filesystem::file_size(path) << " bytes) mismatches: " << mismatches << std::endl;
+    }
+    std::filesystem::remove(path);
+}
+
+void testPrecision()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({30}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses(1);
+    hid2out->normalInitSynapses(2);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+
+    Matrix expected = net.predictBatch(smpSet, 32);
+    for (Precision p : {Precision::Float32, Precision::Int8})
+    {
+        net.setPrecision(p);
+        Matrix batch = net.predictBatch(smpSet, 32);
+        double maxDiff = 0;
+        for (size_t i = 0; i < batch.data.size(); i++)
+            maxDiff = std::max(maxDiff, std::abs(batch.data[i] - expected.data[i]));
+        std::cout << (p == Precision::Float32 ? "f32" : "int8") << " predictBatch max diff vs f64: " << maxDiff << std::endl;
+    }
+}
+
+void testBinaryInput()
+{
+    SampleSet smpSet(256, 10);
+    if (!loadSamples("../data/test.csv", smpSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({30}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses(1);
+    hid2out->normalInitSynapses(2);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+
+    Matrix expected = net.predictBatch(smpSet, 32);
+    net.setBinaryInput(1);
+    Matrix packedPerBatch = net.predictBatch(smpSet, 32);
+    bool packed = smpSet.packFeatureBits();
+    Matrix packedSet = net.predictBatch(smpSet, 32);
+    double maxDiff = 0;
+    for (size_t i = 0; i < expected.data.size(); i++)
+    {
+        maxDiff = std::max(maxDiff, std::abs(packedPerBatch.data[i] - expected.data[i]));
+        maxDiff = std::max(maxDiff, std::abs(packedSet.data[i] - expected.data[i]));
+    }
+    for (size_t i = 0; i < smpSet.size(); i++)
+    {
+        Sample single = net.predict(smpSet.at(i).features);
+        for (size_t j = 0; j < expected.cols; j++)
+            maxDiff = std::max(maxDiff, std::abs(single.labels.at(j) - expected.row(i)[j]));
+    }
+    std::cout << "binary input packed: " << packed << " max diff vs dense: " << maxDiff << std::endl;
+}
+
+void testActivation()
+{
+    std::vector<double> z(1003), fast(z.size()), ref(z.size());
+    for (size_t i = 0; i < z.size(); i++)
+        z[i] = -40.0 + 80.0 * i / (z.size() - 1);
+    for (const char *name : {"sigmoid", "tanh", "relu", "softmax"})
+    {
+        Activation act;
+        parseActivation(name, act);
+        // softmax 按 17 列一行，行尾不足一个向量
+        size_t cols = act == Activation::Softmax ? 17 : z.size();
+        size_t n = z.size() / cols;
+        activate(act, z.data(), fast.data(), n, cols);
+        activateScalar(act, z.data(), ref.data(), n, cols);
+        double maxDiff = 0;
+        for (size_t i = 0; i < n * cols; i++)
+            maxDiff = std::max(maxDiff, std::abs(fast[i] - ref[i]));
+        std::cout << name << " simd max diff vs std: " << maxDiff << std::endl;
+    }
+
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({64}), "relu");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "softmax");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses(1);
+    hid2out->normalInitSynapses(2);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 20;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    std::cout << "relu/softmax train accuracy: " << net.accuracy(trainSet) << " test accuracy: " << net.accuracy(testSet) << std::endl;
+}
+
+void testFusion()
+{
+    SampleSet testSet(256, 10);
+    if (!loadSamples("../data/test.csv", testSet))
+        return;
+    // 输出层有两条入链接（隐藏层 + 输入层直连），权重在融合内核里沿输入方向拼接
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({37}), "tanh");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "softmax");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    auto in2out = std::make_shared<Network::DenseLink>(in, out);
+    in2hid->normalInitSynapses(3);
+    hid2out->normalInitSynapses(4);
+    in2out->normalInitSynapses(5);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+    net.addLink(in2out);
+    Matrix fused = net.predictBatch(testSet, 64);
+    net.setFusion(0);
+    Matrix plain = net.predictBatch(testSet, 64);
+    net.setFusion(1);
+    double maxDiff = 0, singleDiff = 0;
+    for (size_t e = 0; e < fused.data.size(); e++)
+        maxDiff = std::max(maxDiff, std::abs(fused.data[e] - plain.data[e]));
+    for (size_t i = 0; i < testSet.size(); i += 97)
+    {
+        Sample s = net.predict(testSet.at(i).features);
+        for (size_t j = 0; j < s.labels.size(); j++)
+            singleDiff = std::max(singleDiff, std::abs(s.labels[j] - fused.row(i)[j]));
+    }
+    std::cout << "fused max diff vs unfused: " << maxDiff << ", predict vs predictBatch: " << singleDiff << std::endl;
+}
+
+void testSparseLink()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    // 16x16 图像上 5x5 的感受野、步长 2，4 个通道各得到 8x8 的输出
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({4, 8, 8}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto local = std::make_shared<Network::LocalLink>(in, hid, std::vector<size_t>({5, 5}), std::vector<size_t>({2, 2}));
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    local->normalInitSynapses(1);
+    std::fill(local->bias(), local->bias() + local->rows(), 0.1);
+    hid2out->normalInitSynapses(2);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(local);
+    net.addLink(hid2out);
+
+    // 用独热输入逐列取出等价的稠密权重，没有连接的位置为 0
+    auto dense = std::make_shared<Network::DenseLink>(in, hid);
+    std::copy(local->bias(), local->bias() + local->rows(), dense->bias());
+    std::vector<double> x(local->cols()), y(local->rows());
+    for (size_t c = 0; c < local->cols(); c++)
+    {
+        x.assign(x.size(), 0.0);
+        y.assign(y.size(), 0.0);
+        x[c] = 1;
+        local->forward(x.data(), y.data());
+        for (size_t r = 0; r < local->rows(); r++)
+            dense->weights()[r * local->cols() + c] = y[r] - local->bias()[r];
+    }
+    Network denseNet(in, out);
+    denseNet.addLayer(hid);
+    denseNet.addLink(dense);
+    denseNet.addLink(hid2out);
+    Matrix bySparse = net.predictBatch(testSet, 64);
+    Matrix byDense = denseNet.predictBatch(testSet, 64);
+    double maxDiff = 0, singleDiff = 0;
+    for (size_t e = 0; e < bySparse.data.size(); e++)
+        maxDiff = std::max(maxDiff, std::abs(bySparse.data[e] - byDense.data[e]));
+    for (size_t i = 0; i < testSet.size(); i += 97)
+    {
+        Sample s = net.predict(testSet.at(i).features);
+        for (size_t j = 0; j < s.labels.size(); j++)
+            singleDiff = std::max(singleDiff, std::abs(s.labels[j] - bySparse.row(i)[j]));
+    }
+    std::cout << "local link nnz: " << local->nnz() << " (dense " << local->rows() * local->cols()
+              << "), max diff vs dense: " << maxDiff << ", predict vs predictBatch: " << singleDiff << std::endl;
+
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 20;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    std::cout << "local link train accuracy: " << net.accuracy(trainSet) << " test accuracy: " << net.accuracy(testSet) << std::endl;
+
+    const std::string path = (std::filesystem::temp_directory_path() / "localLink.nll").string();
+    if (!net.saveModel(path))
+        return;
+    double savedDiff = 0;
+    {
+        Network loaded(path);
+        Matrix a = net.predictBatch(testSet, 64);
+        Matrix b = loaded.predictBatch(testSet, 64);
+        for (size_t e = 0; e < a.data.size(); e++)
+            savedDiff = std::max(savedDiff, std::abs(a.data[e] - b.data[e]));
+    }
+    std::filesystem::remove(path);
+    std::cout << "saved sparse model max diff: " << savedDiff << std::endl;
+}
+
+void testGrowLink()
+{
+    SampleSet trainSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet))
+        return;
+    // 每个隐藏单元先只连一个像素，训练一轮（编译）后再给每个单元补连一行像素接着训练
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({256}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({16}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    std::vector<std::pair<size_t, size_t>> connections;
+    for (size_t r = 0; r < 16; r++)
+        connections.push_back({r * 16, r});
+    auto sparse = std::make_shared<Network::SparseLink>(in, hid, connections);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    auto plain = std::make_shared<Network::Link>(in, out);
+    sparse->normalInitSynapses(1);
+    hid2out->normalInitSynapses(2);
+    plain->addSynapse(0, 0, 0.1);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(sparse);
+    net.addLink(hid2out);
+    net.addLink(plain);
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 1;
+    options.verbose = 0;
+    bool first = net.train(trainSet, options);
+    const size_t before = sparse->nnz();
+    for (size_t r = 0; r < 16; r++)
+        for (size_t c = 1; c < 16; c++)
+            sparse->addSynapse(r * 16 + c, r, 0.01);
+    for (size_t t = 1; t < 10; t++)
+        plain->addSynapse(t * 16, t, 0.1);
+    options.epochs = 10;
+    bool second = net.train(trainSet, options);
+    std::cout << "grow link: nnz " << before << " -> " << sparse->nnz() << ", train " << first << " " << second
+              << ", accuracy " << net.accuracy(trainSet) << std::endl;
+}
+
+void testConvLink()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    // 16x16 图像上 5x5 卷积、四周补 2，4 个通道保持 16x16，再 2x2 最大池化到 8x8
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto conv = std::make_shared<Network::Layer>(std::vector<size_t>({4, 16, 16}), "relu");
+    auto pool = std::make_shared<Network::Layer>(std::vector<size_t>({4, 8, 8}));
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2conv = std::make_shared<Network::ConvLink>(in, conv, std::vector<size_t>({5, 5}), std::vector<size_t>({1, 1}),
+                                                       std::vector<size_t>({2, 2}));
+    auto conv2pool = std::make_shared<Network::PoolLink>(conv, pool, std::vector<size_t>({2, 2}));
+    auto pool2out = std::make_shared<Network::DenseLink>(pool, out);
+    in2conv->normalInitSynapses(1);
+    std::fill(in2conv->bias(), in2conv->bias() + in2conv->outChannels(), 0.1);
+    pool2out->normalInitSynapses(2);
+    Network net(in, out);
+    net.addLayer(conv);
+    net.addLayer(pool);
+    net.addLink(in2conv);
+    net.addLink(conv2pool);
+    net.addLink(pool2out);
+
+    // 按定义直接滑窗计算，和 im2col + GEMM 的结果对比
+    double convDiff = 0;
+    std::vector<double> y(conv->size());
+    for (size_t i = 0; i < testSet.size(); i += 97)
+    {
+        const double *x = testSet.at(i).features.data();
+        y.assign(y.size(), 0.0);
+        in2conv->forward(x, y.data());
+        for (size_t k = 0; k < 4; k++)
+            for (int oh = 0; oh < 16; oh++)
+                for (int ow = 0; ow < 16; ow++)
+                {
+                    double v = in2conv->bias()[k];
+                    for (int a = 0; a < 5; a++)
+                        for (int b = 0; b < 5; b++)
+                        {
+                            int ih = oh + a - 2, iw = ow + b - 2;
+                            if (ih >= 0 && ih < 16 && iw >= 0 && iw < 16)
+                                v += in2conv->weights()[k * 25 + a * 5 + b] * x[ih * 16 + iw];
+                        }
+                    convDiff = std::max(convDiff, std::abs(v - y[(k * 16 + oh) * 16 + ow]));
+                }
+    }
+    Matrix batch = net.predictBatch(testSet, 64);
+    double singleDiff = 0;
+    for (size_t i = 0; i < testSet.size(); i += 97)
+    {
+        Sample s = net.predict(testSet.at(i).features);
+        for (size_t j = 0; j < s.labels.size(); j++)
+            singleDiff = std::max(singleDiff, std::abs(s.labels[j] - batch.row(i)[j]));
+    }
+    std::cout << "conv link max diff vs direct convolution: " << convDiff << ", predict vs predictBatch: " << singleDiff << std::endl;
+
+    // 步长 2、补 2：im2col 走逐列路径，col2im 把梯度散回输入，和按定义的结果对比
+    auto strided = std::make_shared<Network::Layer>(std::vector<size_t>({4, 8, 8}));
+    auto in2strided = std::make_shared<Network::ConvLink>(in, strided, std::vector<size_t>({5, 5}), std::vector<size_t>({2, 2}),
+                                                          std::vector<size_t>({2, 2}));
+    in2strided->normalInitSynapses(3);
+    std::vector<double> dOut(strided->size()), dIn(in->size()), grad(in2strided->parameters().size());
+    for (size_t e = 0; e < dOut.size(); e++)
+        dOut[e] = std::sin(double(e));
+    double stridedDiff = 0, gradDiff = 0;
+    {
+        const double *x = testSet.at(0).features.data();
+        y.assign(strided->size(), 0.0);
+        in2strided->forward(x, y.data());
+        in2strided->backwardBatch(x, dOut.data(), dIn.data(), grad.data(), 1);
+        std::vector<double> expectIn(in->size(), 0.0);
+        for (size_t k = 0; k < 4; k++)
+            for (int oh = 0; oh < 8; oh++)
+                for (int ow = 0; ow < 8; ow++)
+                {
+                    const size_t o = (k * 8 + oh) * 8 + ow;
+                    double v = in2strided->bias()[k];
+                    for (int a = 0; a < 5; a++)
+                        for (int b = 0; b < 5; b++)
+                        {
+                            int ih = oh * 2 + a - 2, iw = ow * 2 + b - 2;
+                            if (ih >= 0 && ih < 16 && iw >= 0 && iw < 16)
+                            {
+                                v += in2strided->weights()[k * 25 + a * 5 + b] * x[ih * 16 + iw];
+                                expectIn[ih * 16 + iw] += in2strided->weights()[k * 25 + a * 5 + b] * dOut[o];
+                            }
+                        }
+                    stridedDiff = std::max(stridedDiff, std::abs(v - y[o]));
+                }
+        for (size_t e = 0; e < dIn.size(); e++)
+            gradDiff = std::max(gradDiff, std::abs(dIn[e] - expectIn[e]));
+    }
+    std::cout << "strided conv max diff vs direct convolution: " << stridedDiff << ", input gradient: " << gradDiff << std::endl;
+
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 20;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    std::cout << "conv net train accuracy: " << net.accuracy(trainSet) << " test accuracy: " << net.accuracy(testSet) << std::endl;
+
+    const std::string path = (std::filesystem::temp_directory_path() / "convLink.nll").string();
+    if (!net.saveModel(path))
+        return;
+    double savedDiff = 0;
+    {
+        Network loaded(path);
+        Matrix a = net.predictBatch(testSet, 64);
+        Matrix b = loaded.predictBatch(testSet, 64);
+        for (size_t e = 0; e < a.data.size(); e++)
+            savedDiff = std::max(savedDiff, std::abs(a.data[e] - b.data[e]));
+    }
+    std::filesystem::remove(path);
+    std::cout << "saved conv model max diff: " << savedDiff << std::endl;
+}
+
+void testProfile()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    // 隐藏层一个走融合内核（DenseLink），一个走逐链接路径（LocalLink）；输出层两条 DenseLink 一起融合
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({32}), "sigmoid");
+    auto local = std::make_shared<Network::Layer>(std::vector<size_t>({4, 8, 8}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLayer(local);
+    std::vector<std::shared_ptr<Network::Link>> links = {
+        std::make_shared<Network::DenseLink>(in, hid),
+        std::make_shared<Network::LocalLink>(in, local, std::vector<size_t>({5, 5}), std::vector<size_t>({2, 2})),
+        std::make_shared<Network::DenseLink>(hid, out), std::make_shared<Network::DenseLink>(local, out)};
+    for (size_t k = 0; k < links.size(); k++)
+    {
+        links[k]->normalInitSynapses(unsigned(k));
+        net.addLink(links[k]);
+    }
+    if (!net.setProfiling(1, 1))
+    {
+        std::cout << "profiling compiled out, profile empty: " << net.profile().linkForward.empty() << std::endl;
+        return;
+    }
+    for (size_t i = 0; i < 10; i++)
+        net.predict(testSet.at(i).features);
+    net.predictBatch(testSet, 64);
+    TrainOptions options;
+    options.epochs = 1;
+    options.threads = 1;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    NetworkProfile p = net.profile();
+    auto calls = [](const std::vector<ProfileCounter> &counters)
+    {
+        std::string s;
+        for (const ProfileCounter &c : counters)
+            s += (s.empty() ? "" : ",") + std::to_string(c.calls);
+        return "[" + s + "]";
+    };
+    std::cout << "profile calls: link forward " << calls(p.linkForward) << " backward " << calls(p.linkBackward)
+              << ", layer forward " << calls(p.layerForward) << " backward " << calls(p.layerBackward) << std::endl;
+    double flops = 0;
+    for (const ProfileCounter &c : p.linkForward)
+        flops += c.flops;
+    for (const ProfileCounter &c : p.layerForward)
+        flops += c.flops;
+    std::cout << "profiled forward MFLOP: " << flops / 1e6 << std::endl;
+
+    const std::string path = (std::filesystem::temp_directory_path() / "profile.json").string();
+    if (!net.saveTrace(path))
+        return;
+    std::ifstream trace(path);
+    size_t events = 0;
+    for (std::string line; std::getline(trace, line);)
+        events += line.find("\"ph\": \"X\"") != std::string::npos;
+    trace.close();
+    std::filesystem::remove(path);
+    std::cout << "trace events: " << events << std::endl;
+}
+
+void testPrefetch()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    // 每轮每个样本恰好出现一次，批内的行就是对应下标的样本，两轮的顺序不同
+    BatchPrefetcher batches(trainSet, 64, 2, 7, 2);
+    std::vector<size_t> seen(trainSet.size() * 2);
+    std::vector<size_t> firstOrder, secondOrder;
+    size_t wrongRows = 0, batchCount = 0;
+    while (const Minibatch *b = batches.next())
+    {
+        batchCount++;
+        for (size_t r = 0; r < b->rows; r++)
+        {
+            const size_t idx = b->indices[r];
+            seen[b->epoch * trainSet.size() + idx]++;
+            (b->epoch ? secondOrder : firstOrder).push_back(idx);
+            SampleView v = trainSet.at(idx);
+            wrongRows += !std::equal(v.features.begin(), v.features.end(), b->features.data() + r * trainSet.featureSize) ||
+                         !std::equal(v.labels.begin(), v.labels.end(), b->labels.data() + r * trainSet.labelSize);
+        }
+    }
+    bool once = std::all_of(seen.begin(), seen.end(), [](size_t c)
+                            { return c == 1; });
+    std::cout << "prefetch batches: " << batchCount << ", each sample once per epoch: " << once
+              << ", wrong rows: " << wrongRows << ", reshuffled: " << (firstOrder != secondOrder) << std::endl;
+
+    // 同步收集和后台预取（含数据增强）训练出的权重应完全相同
+    auto noise = [](double *features, size_t rows, size_t featureSize, std::mt19937 &gen)
+    {
+        std::normal_distribution<double> dist(0.0, 0.05);
+        for (size_t e = 0; e < rows * featureSize; e++)
+            features[e] += dist(gen);
+    };
+    Matrix outputs[2];
+    for (size_t prefetch : {0, 3})
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({32}), "sigmoid");
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+        auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+        auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+        in2hid->normalInitSynapses(1);
+        hid2out->normalInitSynapses(2);
+        Network net(in, out);
+        net.addLayer(hid);
+        net.addLink(in2hid);
+        net.addLink(hid2out);
+        TrainOptions options;
+        options.optimizer = Optimizer::Adam;
+        options.learningRate = 0.01;
+        options.epochs = 5;
+        options.verbose = 0;
+        options.prefetch = prefetch;
+        options.augment = noise;
+        net.train(trainSet, options);
+        outputs[prefetch != 0] = net.predictBatch(testSet, 64);
+        if (prefetch)
+            std::cout << "augmented train test accuracy: " << net.accuracy(testSet) << std::endl;
+    }
+    double maxDiff = 0;
+    for (size_t e = 0; e < outputs[0].data.size(); e++)
+        maxDiff = std::max(maxDiff, std::abs(outputs[0].data[e] - outputs[1].data[e]));
+    std::cout << "prefetch vs synchronous max diff: " << maxDiff << std::endl;
+}
+
+void testStreaming()
+{
+    // 合成数据：前 20 个特征是行号的二进制位，类别 c 对应的一段像素较大概率为 1，其余较小概率为 1
+    const size_t rows = 40000;
+    auto makeRow = [](size_t id, std::mt19937 &gen, double *features, double *labels)
+    {
+        std::bernoulli_distribution on(0.5), off(0.2);
+        const size_t c = id % 10;
+        for (size_t i = 0; i < 256; i++)
+        {
+            if (i < 20)
+                features[i] = (id >> i) & 1;
+            else
+                features[i] = i >= 36 + c * 22 && i < 58 + c * 22 ? on(gen) : off(gen);
+        }
+        std::fill(labels, labels + 10, 0.0);
+        labels[c] = 1;
+    };
+    const std::string csvPath = (std::filesystem::temp_directory_path() / "stream_synthetic.csv").string();
+    {
+        std::ofstream ofs(csvPath, std::ios::trunc);
+        std::mt19937 gen(3);
+        double features[256], labels[10];
+        std::string line;
+        for (size_t id = 0; id < rows; id++)
+        {
+            makeRow(id, gen, features, labels);
+            line.clear();
+            for (double v : features)
+                line += v ? "1 " : "0 ";
+            for (double v : labels)
+                line += v ? "1 " : "0 ";
+            line.back() = '\n';
+            ofs << line;
+        }
+    }
+    SampleSet testSet(256, 10);
+    testSet.resize(2000);
+    std::mt19937 testGen(4);
+    for (size_t i = 0; i < testSet.size(); i++)
+        makeRow(i, testGen, testSet.featureData() + i * 256, testSet.labelData() + i * 10);
+
+    // 缓冲上限远小于数据集：每轮每行恰好出现一次，标签与行号对得上
+    StreamOptions streamOptions;
+    streamOptions.shardBytes = 64 << 10;
+    streamOptions.shuffleRows = 512;
+    SampleStream stream(256, 10, streamOptions);
+    if (!stream.open(csvPath) || !stream.start(100, 2, 5))
+        return;
+    std::vector<size_t> seen(rows * 2);
+    std::vector<size_t> firstOrder, secondOrder;
+    size_t wrongLabels = 0, peakBytes = 0, lastBatches = 0;
+    while (const Minibatch *b = stream.next())
+    {
+        lastBatches += b->last;
+        peakBytes = std::max(peakBytes, stream.bufferBytes());
+        for (size_t r = 0; r < b->rows; r++)
+        {
+            const double *f = b->features.data() + r * 256;
+            size_t id = 0;
+            for (size_t i = 0; i < 20; i++)
+                id |= size_t(f[i]) << i;
+            if (id >= rows)
+            {
+                wrongLabels++;
+                continue;
+            }
+            seen[b->epoch * rows + id]++;
+            (b->epoch ? secondOrder : firstOrder).push_back(id);
+            wrongLabels += b->labels[r * 10 + id % 10] != 1;
+        }
+    }
+    bool once = std::all_of(seen.begin(), seen.end(), [](size_t c)
+                            { return c == 1; });
+    const double decodedBytes = double(rows) * (256 + 10) * sizeof(double);
+    std::cout << "stream shards: " << stream.shardCount() << ", each row once per epoch: " << once
+              << ", wrong labels: " << wrongLabels << ", epochs ended: " << lastBatches
+              << ", reshuffled: " << (firstOrder != secondOrder) << std::endl;
+    std::cout << "stream peak buffers: " << peakBytes / 1024 << " KB, csv " << std::filesystem::file_size(csvPath) / 1024
+              << " KB, decoded " << size_t(decodedBytes) / 1024 << " KB (" << decodedBytes / peakBytes << "x)" << std::endl;
+
+    // 从 CSV 流和二进制流各训练一个网络
+    auto train = [](SampleStream &source, size_t epochs, const SampleSet &evalSet, const char *what)
+    {
+        auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+        auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({32}), "sigmoid");
+        auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+        auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+        auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+        in2hid->normalInitSynapses(1);
+        hid2out->normalInitSynapses(2);
+        Network net(in, out);
+        net.addLayer(hid);
+        net.addLink(in2hid);
+        net.addLink(hid2out);
+        TrainOptions options;
+        options.optimizer = Optimizer::Adam;
+        options.learningRate = 0.01;
+        options.epochs = epochs;
+        options.verbose = 0;
+        if (net.train(source, options))
+            std::cout << what << " streamed train accuracy: " << net.accuracy(evalSet) << std::endl;
+    };
+    train(stream, 2, testSet, "synthetic csv");
+    std::filesystem::remove(csvPath);
+
+    SampleSet digits(256, 10);
+    if (!loadSamples("../data/test.csv", digits))
+        return;
+    const std::string binPath = (std::filesystem::temp_directory_path() / "stream_digits.nlds").string();
+    if (!convertSamples("../data/train.csv", binPath, 256, 10, SampleType::Bit))
+        return;
+    SampleStream binStream(256, 10, streamOptions);
+    if (binStream.open(binPath))
+    {
+        std::cout << "digits bit stream shards: " << binStream.shardCount() << std::endl;
+        train(binStream, 10, digits, "digits bit");
+    }
+    std::filesystem::remove(binPath);
+}
+
+void testServer()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    auto in = std::make_shared<Network::Layer>(std::vector<size_t>({16, 16}));
+    auto hid = std::make_shared<Network::Layer>(std::vector<size_t>({32}), "sigmoid");
+    auto out = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    auto in2hid = std::make_shared<Network::DenseLink>(in, hid);
+    auto hid2out = std::make_shared<Network::DenseLink>(hid, out);
+    in2hid->normalInitSynapses(1);
+    hid2out->normalInitSynapses(2);
+    Network net(in, out);
+    net.addLayer(hid);
+    net.addLink(in2hid);
+    net.addLink(hid2out);
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 5;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    Matrix expected = net.predictBatch(testSet, 64);
+
+    // 多个线程并发地逐个请求，结果应与直接批量前向一致，并且确实被合并成了微批
+    ServerOptions serverOptions;
+    serverOptions.maxBatch = 16;
+    serverOptions.maxDelay = std::chrono::microseconds(2000);
+    double maxDiff = 0;
+    ServerStats stats;
+    {
+        BatchingServer server(net, serverOptions);
+        const size_t threads = 8;
+        std::vector<double> diffs(threads);
+        std::vector<std::thread> clients;
+        for (size_t t = 0; t < threads; t++)
+            clients.emplace_back([&, t]
+                                 {
+                double outputs[10];
+                for (size_t i = t; i < testSet.size(); i += threads)
+                {
+                    server.predict(testSet.at(i).features, outputs);
+                    for (size_t k = 0; k < 10; k++)
+                        diffs[t] = std::max(diffs[t], std::abs(outputs[k] - expected.row(i)[k]));
+                } });
+        for (std::thread &c : clients)
+            c.join();
+        maxDiff = *std::max_element(diffs.begin(), diffs.end());
+        stats = server.stats();
+    }
+    std::cout << "batching server requests: " << stats.requests << ", mean batch > 1: " << (stats.meanBatch > 1)
+              << ", max diff vs predictBatch: " << maxDiff << std::endl;
+
+    // 行协议：合法请求、列数不对的请求和 stats 控制行，应答按请求顺序
+    {
+        BatchingServer server(net, serverOptions);
+        std::string request;
+        for (double f : testSet.at(0).features)
+            request += std::to_string(int(f)) + " ";
+        std::istringstream input(request + "\n1 2 3\nstats\n");
+        std::vector<std::string> replies;
+        serveLines(server, [&](std::string &line)
+                   { return bool(std::getline(input, line)); },
+                   [&](const std::string &line)
+                   { replies.push_back(line); return true; }, 4);
+        const size_t predicted = std::max_element(expected.row(0), expected.row(0) + 10) - expected.row(0);
+        std::cout << "line protocol replies: " << replies.size() << ", class ok: "
+                  << (replies.size() == 3 && replies[0].substr(0, replies[0].find(' ')) == std::to_string(predicted))
+                  << ", error line: " << (replies.size() > 1 && replies[1].rfind("error", 0) == 0)
+                  << ", stats line: " << (replies.size() > 2 && replies[2].rfind("requests 1 ", 0) == 0) << std::endl;
+    }
+
+    // 前向失败（带环的图无法编译）时每个请求都得到 error 应答，predict 返回 false
+    {
+        auto a = std::make_shared<Network::Layer>(std::vector<size_t>({4}));
+        auto b = std::make_shared<Network::Layer>(std::vector<size_t>({4}), "sigmoid");
+        auto c = std::make_shared<Network::Layer>(std::vector<size_t>({2}), "sigmoid");
+        Network broken(a, c);
+        broken.addLayer(b);
+        broken.addLink(std::make_shared<Network::DenseLink>(a, b));
+        broken.addLink(std::make_shared<Network::DenseLink>(b, c));
+        broken.addLink(std::make_shared<Network::DenseLink>(c, b));
+        BatchingServer server(broken, serverOptions);
+        std::istringstream input("1 2 3 4\n5 6 7 8\n");
+        std::vector<std::string> replies;
+        serveLines(server, [&](std::string &line)
+                   { return bool(std::getline(input, line)); },
+                   [&](const std::string &line)
+                   { replies.push_back(line); return true; }, 4);
+        double x[4] = {1, 2, 3, 4}, y[2];
+        bool predicted = server.predict(x, y);
+        std::cout << "failed batch replies: " << replies.size() << ", all errors: "
+                  << std::all_of(replies.begin(), replies.end(), [](const std::string &r)
+                                 { return r.rfind("error", 0) == 0; })
+                  << ", predict returns: " << predicted << std::endl;
+    }
+
+    // 回环 TCP：一个连接流水线地发完整个测试集，准确率应与直接计算一致
+    {
+        BatchingServer server(net, serverOptions);
+        TcpServer tcp(server);
+        if (!tcp.listen(0))
+            return;
+        std::thread acceptor([&]
+                             { tcp.run(); });
+        LoadgenResult r = runLoadgen(tcp.port(), testSet, 1, testSet.size(), 8);
+        tcp.stop();
+        acceptor.join();
+        std::cout << "tcp loadgen requests: " << r.requests << ", errors: " << r.errors << ", accuracy matches: "
+                  << (std::abs(r.accuracy - net.accuracy(testSet)) < 1e-12) << std::endl;
+    }
+}
+
+void testAllocations()
+{
+#ifndef NN_COUNT_ALLOCATIONS
+    std::cout << "allocation counting compiled out, skipped" << std::endl;
+#else
+    SampleSet trainSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet))
+        return;
+    Network net = makeDigitNet(64, 1);
+    Network::InferenceContext ctx = net.makeContext(64);
+    double outputs[64 * 10];
+    std::span<const double> features = trainSet.at(0).features;
+    net.predict(features, std::span<double>(outputs, 10), ctx);
+    size_t spanAllocs = countAllocations([&]
+                                         {
+        for (size_t i = 0; i < 1000; i++)
+            net.predict(trainSet.at(i % trainSet.size()).features, std::span<double>(outputs, 10), ctx); });
+    size_t batchAllocs = countAllocations([&]
+                                          {
+        for (size_t i = 0; i + 64 <= trainSet.size(); i += 64)
+            net.predictBatch(std::span<const double>(trainSet.featureData() + i * 256, 64 * 256), 64, outputs, ctx); });
+    size_t sampleAllocs = countAllocations([&]
+                                           { net.predict(features, ctx); });
+    std::cout << "allocations: 1000 predict into span " << spanAllocs << ", predictBatch into span " << batchAllocs
+              << ", one Sample-returning predict " << sampleAllocs << std::endl;
+
+    // train 的分配都发生在开始时（线程池、工作区、预取槽），多训练几轮不应多分配
+    for (size_t prefetch : {0, 1})
+    {
+        size_t perRun[2];
+        for (size_t e = 0; e < 2; e++)
+        {
+            Network trainNet = makeDigitNet(64, 1);
+            TrainOptions options;
+            options.optimizer = Optimizer::Adam;
+            options.epochs = e ? 4 : 1;
+            options.verbose = 0;
+            options.prefetch = prefetch;
+            perRun[e] = countAllocations([&]
+                                         { trainNet.train(trainSet, options); });
+        }
+        std::cout << "train (prefetch " << prefetch << ") allocations: 1 epoch " << perRun[0] << ", 4 epochs " << perRun[1]
+                  << ", extra per epoch " << (double(perRun[1]) - double(perRun[0])) / 3 << std::endl;
+    }
+#endif
+}
+
+void testStaticNetwork()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    Network net = makeDigitNet(64, 1);
+    TrainOptions options;
+    options.optimizer = Optimizer::Adam;
+    options.learningRate = 0.01;
+    options.epochs = 5;
+    options.verbose = 0;
+    net.train(trainSet, options);
+    const std::string path = (std::filesystem::temp_directory_path() / "staticNet.nll").string();
+    net.saveModel(path);
+
+    using Digits = StaticNetwork<Dense<256, 64, Activation::Sigmoid>, Dense<64, 10, Activation::Softmax>>;
+    auto fixed = std::make_unique<Digits>();
+    bool loaded = fixed->load(path);
+    Matrix expected = net.predictBatch(testSet, 64);
+    double maxDiff = 0;
+    size_t correct = 0;
+    for (size_t i = 0; i < testSet.size(); i++)
+    {
+        std::array<double, 10> y = fixed->predict(std::span<const double, 256>(testSet.at(i).features.data(), 256));
+        for (size_t k = 0; k < 10; k++)
+            maxDiff = std::max(maxDiff, std::abs(y[k] - expected.row(i)[k]));
+        std::span<const double> labels = testSet.at(i).labels;
+        correct += std::max_element(y.begin(), y.end()) - y.begin() ==
+                   std::max_element(labels.begin(), labels.end()) - labels.begin();
+    }
+    std::cout << "static network loaded: " << loaded << ", max diff vs Network: " << maxDiff
+              << ", accuracy matches: " << (std::abs(double(correct) / testSet.size() - net.accuracy(testSet)) < 1e-12)
+              << std::endl;
+#ifdef NN_COUNT_ALLOCATIONS
+    double y[10];
+    size_t allocs = countAllocations([&]
+                                     {
+        for (size_t i = 0; i < 1000; i++)
+            fixed->predict(testSet.at(i % testSet.size()).features.data(), y); });
+    std::cout << "static network allocations in 1000 predicts: " << allocs << std::endl;
+#endif
+
+    // 层大小或激活与模型不符时拒绝加载
+    auto wrongSize = std::make_unique<StaticNetwork<Dense<256, 32, Activation::Sigmoid>, Dense<32, 10, Activation::Softmax>>>();
+    auto wrongAct = std::make_unique<StaticNetwork<Dense<256, 64, Activation::ReLU>, Dense<64, 10, Activation::Softmax>>>();
+    auto wrongDepth = std::make_unique<StaticNetwork<Dense<256, 10, Activation::Softmax>>>();
+    bool rejects[3] = {!wrongSize->load(path), !wrongAct->load(path), !wrongDepth->load(path)};
+    std::cout << "static network rejects wrong size: " << rejects[0] << ", wrong activation: " << rejects[1]
+              << ", wrong depth: " << rejects[2] << std::endl;
+    std::filesystem::remove(path);
+}
+
+void testIncrementalPredict()
+{
+    SampleSet trainSet(256, 10), testSet(256, 10);
+    if (!loadSamples("../data/train.csv", trainSet) || !loadSamples("../data/test.csv", testSet))
+        return;
+    // 在 256-64-10 的基础上加一条输入层直连输出层的链接，输出层同时有来自输入层和隐藏层的入链接
+    Network net = makeDigitNet(64, 1);
+    const std::shared_ptr<Network::Layer> in = net.layers().front();
+    auto in2out = std::make_shared<Network::DenseLink>(in, net.layers().back());
+    in2out->normalInitSynapses(3);
+    net.addLink(in2out);
+
+    // 模拟画板：从一个样本出发，每笔改 1 或 10 个像素，偶尔换成另一个样本（变化多，走完整计算）。
+    // 二值输入时增量更新读按列存放的权重，两种都要与完整前向一致
+    std::vector<double> features(testSet.at(0).features.begin(), testSet.at(0).features.end());
+    double y[10], expected[10];
+    double maxDiff = 0;
+    for (bool binary : {false, true})
+    {
+        net.setBinaryInput(binary);
+        Network::InferenceContext ctx = net.makeContext();
+        std::mt19937 gen(5);
+        std::vector<size_t> changed;
+        net.predictIncremental(features, {}, y, ctx);
+        for (size_t edit = 0; edit < 3000; edit++)
+        {
+            changed.clear();
+            if (edit % 500 == 499)
+            {
+                std::span<const double> next = testSet.at(edit / 500 + 1).features;
+                std::copy(next.begin(), next.end(), features.begin());
+                changed.resize(features.size());
+                std::iota(changed.begin(), changed.end(), 0);
+            }
+            else
+            {
+                for (size_t k = 0; k < (edit % 2 ? 10 : 1); k++)
+                {
+                    size_t i = gen() % features.size();
+                    features[i] = 1 - features[i];
+                    changed.push_back(i);
+                }
+            }
+            net.predictIncremental(features, changed, y, ctx);
+            // 穿插的普通 predict 用同一个 ctx，不应破坏增量状态
+            net.predict(features, expected, ctx);
+            for (size_t k = 0; k < 10; k++)
+                maxDiff = std::max(maxDiff, std::abs(y[k] - expected[k]));
+        }
+    }
+    std::cout << "incremental predict over 2 x 3000 edits, max diff vs predict: " << maxDiff << std::endl;
+
+    // 两次增量之间训练一轮、直接改一个偏置，缓存的累加都要作废，结果仍与完整前向一致
+    net.setBinaryInput(false);
+    double afterTrain = 0, afterEdit = 0;
+    {
+        Network::InferenceContext ctx = net.makeContext();
+        auto flip = [&](size_t i)
+        {
+            features[i] = 1 - features[i];
+            net.predictIncremental(features, std::span<const size_t>(&i, 1), y, ctx);
+            net.predict(features, expected, ctx);
+            double diff = 0;
+            for (size_t k = 0; k < 10; k++)
+                diff = std::max(diff, std::abs(y[k] - expected[k]));
+            return diff;
+        };
+        flip(0);
+        TrainOptions options;
+        options.epochs = 1;
+        options.verbose = 0;
+        net.train(trainSet, options);
+        afterTrain = flip(1);
+        in2out->bias()[0] += 1;
+        afterEdit = flip(2);
+    }
+    std::cout << "incremental predict after train max diff: " << afterTrain << ", after editing a bias: " << afterEdit
+              << std::endl;
+
+    // 越界的下标报错；输入层有 SparseLink 时退回普通前向
+    size_t bad = features.size();
+    Network::InferenceContext ctx = net.makeContext();
+    bool rejected = !net.predictIncremental(features, std::span<const size_t>(&bad, 1), y, ctx);
+    auto sparseOut = std::make_shared<Network::Layer>(std::vector<size_t>({10}), "sigmoid");
+    std::vector<std::pair<size_t, size_t>> connections;
+    for (size_t i = 0; i < 256; i += 3)
+        connections.push_back({i, i % 10});
+    auto sparse = std::make_shared<Network::SparseLink>(in, sparseOut, connections);
+    sparse->normalInitSynapses(4);
+    Network sparseNet(in, sparseOut);
+    sparseNet.addLink(sparse);
+    Network::InferenceContext sparseCtx = sparseNet.makeContext();
+    size_t first = 0;
+    features[0] = 1 - features[0];
+    sparseNet.predictIncremental(features, std::span<const size_t>(&first, 1), y, sparseCtx);
+    sparseNet.predict(features, expected);
+    std::cout << "incremental predict rejects bad index: " << rejected << ", sparse input falls back: "
+              << std::equal(y, y + 10, expected) << std::endl;
+}
+
+void testSweep()
+{
+    SampleSet samples(256, 10), trainSet(256, 10), validationSet(256, 10);
+    if (!loadSamples("../data/train.csv", samples) || !splitValidation(samples, 0.2, 1, trainSet, validationSet))
+        return;
+    std::vector<SweepConfig> configs(5);
+    configs[0].hidden = {{3, 3}};
+    configs[1].hidden = {{16}};
+    configs[2].hidden = {{32}};
+    configs[2].activation = "relu";
+    configs[3].hidden = {{32}};
+    configs[3].learningRate = 0.5; // 学习率过大，准确率很快停滞
+    configs[4].activation = "swish"; // 未知激活，排在最后
+    SweepOptions options;
+    options.maxEpochs = 8;
+    options.patience = 2;
+    options.verbose = 0;
+    options.bestModelPath = (std::filesystem::temp_directory_path() / "sweep_best.nll").string();
+
+    // 每个任务内部单线程、种子固定，同时跑几个任务不改变结果
+    options.threads = 1;
+    std::vector<SweepResult> serial = runSweep(trainSet, validationSet, configs, options);
+    options.threads = 3;
+    std::vector<SweepResult> parallel = runSweep(trainSet, validationSet, configs, options);
+    bool same = serial.size() == parallel.size();
+    bool ranked = 1, early = 0;
+    for (size_t i = 0; same && i < serial.size(); i++)
+    {
+        same &= serial[i].config.name() == parallel[i].config.name() && serial[i].bestAccuracy == parallel[i].bestAccuracy &&
+                serial[i].epochs == parallel[i].epochs;
+        if (i && parallel[i].ok)
+            ranked &= parallel[i - 1].bestAccuracy >= parallel[i].bestAccuracy;
+        early |= parallel[i].stoppedEarly;
+    }
+    double reloaded = -1;
+    try
+    {
+        reloaded = Network(options.bestModelPath).accuracy(validationSet);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+    std::cout << "sweep split: " << trainSet.size() << " train, " << validationSet.size() << " validation" << std::endl;
+    std::cout << "sweep configs: " << parallel.size() << ", parallel matches serial: " << same << ", ranked: " << ranked
+              << ", failed config last: " << (!parallel.empty() && !parallel.back().ok) << ", some stopped early: " << early
+              << ", best model reloads with its accuracy: " << (!parallel.empty() && reloaded == parallel[0].bestAccuracy)
+              << ", no leftover snapshots: " << !std::filesystem::exists(options.bestModelPath + ".job0.tmp") << std::endl;
+    std::filesystem::remove(options.bestModelPath);
+}
@@ -2,4 +2,23 @@
 
 void testLoadSample();
 void testSavingModel();
-void testPredict();
\ No newline at end of file
+void testPredict();
+void testPredictBatch();
+void testTrain();
+void testConcurrentPredict();
+void testBinarySamples();
+void testPrecision();
+void testBinaryInput();
+void testActivation();
+void testFusion();
+void testSparseLink();
+void testGrowLink();
+void testConvLink();
+void testProfile();
+void testPrefetch();
+void testStreaming();
+void testServer();
+void testAllocations();
+void testStaticNetwork();
+void testIncrementalPredict();
+void testSweep();
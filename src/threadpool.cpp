@@ -0,0 +1,84 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 1; i < threads; i++)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = 1;
+    }
+    m_start.notify_all();
+    for (auto &w : m_workers)
+    {
+        w.join();
+    }
+}
+
+size_t ThreadPool::size() const
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::runTasks()
+{
+    for (size_t i = m_next.fetch_add(1); i < m_count; i = m_next.fetch_add(1))
+    {
+        m_fn(m_ctx, i);
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    size_t seen = 0;
+    while (1)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [&]
+                         { return m_stop || m_generation != seen; });
+            if (m_stop)
+                return;
+            seen = m_generation;
+        }
+        runTasks();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_pending;
+        }
+        m_done.notify_one();
+    }
+}
+
+void ThreadPool::dispatch(void (*fn)(void *, size_t), void *ctx, size_t count)
+{
+    if (m_workers.empty() || count <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            fn(ctx, i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = fn;
+        m_ctx = ctx;
+        m_count = count;
+        m_next.store(0);
+        m_pending = m_workers.size();
+        m_generation++;
+    }
+    m_start.notify_all();
+    runTasks();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&]
+                { return m_pending == 0; });
+}
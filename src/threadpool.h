@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+// 固定大小的线程池，调用 parallelFor 的线程也参与执行
+class ThreadPool
+{
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    // 当前任务，用函数指针 + 上下文保存，避免每次 parallelFor 都构造 std::function
+    void (*m_fn)(void *, size_t) = nullptr;
+    void *m_ctx = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next{0};
+    size_t m_pending = 0;
+    size_t m_generation = 0;
+    bool m_stop = 0;
+    void workerLoop();
+    void runTasks();
+    void dispatch(void (*fn)(void *, size_t), void *ctx, size_t count);
+
+public:
+    // threads 为参与计算的线程总数（含调用线程），0 表示硬件线程数
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    size_t size() const;
+
+    // 对 [0, count) 的每个下标调用一次 task，全部完成后返回
+    template <typename F>
+    void parallelFor(size_t count, F &&task)
+    {
+        dispatch([](void *ctx, size_t i)
+                 { (*static_cast<std::remove_reference_t<F> *>(ctx))(i); },
+                 const_cast<void *>(static_cast<const void *>(&task)), count);
+    }
+};
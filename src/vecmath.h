@@ -0,0 +1,72 @@
+#pragma once
+
+// 激活函数用到的 AVX2 向量数学，供 activation.cpp 和融合的稠密内核共用
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+#include "activation.h"
+
+// exp(x) = 2^k * exp(r)，k = round(x / ln2)，|r| <= ln2 / 2；
+// exp(r) 用 11 阶泰勒多项式，截断误差约 6e-15（相对）
+static inline __m256d exp4(__m256d x)
+{
+    x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-708.0)), _mm256_set1_pd(709.0));
+    __m256d k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(1.4426950408889634)),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    // ln2 拆成高低两部分，减去 k * ln2 时不丢精度
+    __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(0.693147180369123816490), x);
+    r = _mm256_fnmadd_pd(k, _mm256_set1_pd(1.90821492927058770002e-10), r);
+    __m256d p = _mm256_set1_pd(1.0 / 39916800);
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 3628800));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 362880));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 40320));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 5040));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 720));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 120));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 24));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 6));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(0.5));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+    // 2^k：k 加上 1.5 * 2^52 后低位即为 k 的补码，再加指数偏置移到指数域
+    const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+    __m256i bits = _mm256_castpd_si256(_mm256_add_pd(k, magic));
+    bits = _mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52);
+    return _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+}
+
+static inline __m256d sigmoid4(__m256d x)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    return _mm256_div_pd(one, _mm256_add_pd(one, exp4(_mm256_sub_pd(_mm256_setzero_pd(), x))));
+}
+
+// tanh(x) = 2 / (1 + exp(-2x)) - 1
+static inline __m256d tanh4(__m256d x)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d ex = exp4(_mm256_mul_pd(x, _mm256_set1_pd(-2.0)));
+    return _mm256_sub_pd(_mm256_div_pd(_mm256_set1_pd(2.0), _mm256_add_pd(one, ex)), one);
+}
+
+static inline __m256d relu4(__m256d x)
+{
+    return _mm256_max_pd(x, _mm256_setzero_pd());
+}
+
+// 逐元素激活，编译期选定；Softmax 需要整行，这里按 Linear 处理，由调用方随后归一化
+template <Activation A>
+static inline __m256d activate4(__m256d x)
+{
+    if constexpr (A == Activation::Sigmoid)
+        return sigmoid4(x);
+    else if constexpr (A == Activation::Tanh)
+        return tanh4(x);
+    else if constexpr (A == Activation::ReLU)
+        return relu4(x);
+    else
+        return x;
+}
+
+#endif